@@ -0,0 +1,1074 @@
+
+#ifndef _CHESS_BITBOARD_CPP_
+#define _CHESS_BITBOARD_CPP_
+
+#include "bitboard.h"
+
+#if defined(__BMI2__) && !defined(CHESS_NO_PEXT)
+#include <immintrin.h>
+#define USE_PEXT 1
+#else
+#define USE_PEXT 0
+#endif
+
+Bitboard knight_attack_table[64];
+Bitboard king_attack_table[64];
+Bitboard pawn_attack_table[2][64];
+
+Magic rook_magics[64];
+Magic bishop_magics[64];
+
+// Sizes are the sum of 2^(bits in mask) over every square
+Bitboard rook_table[0x19000];
+Bitboard bishop_table[0x1480];
+
+// Castling rights that survive a move touching a square:
+uint8_t castle_mask[64];
+
+// For squares on the same rank, file or diagonal, the squares strictly
+// between them and the whole line through them. 0 otherwise.
+Bitboard between_table[64][64];
+Bitboard line_table[64][64];
+
+static bool bitboards_initialized = false;
+
+static const int rook_directions[4][2]   = {{ 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }};
+static const int bishop_directions[4][2] = {{ 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 }};
+
+inline int side_of(PieceType p) {
+  return (p & PBLACK) ? BLACK_SIDE : WHITE_SIDE;
+}
+
+// Walks each ray until it leaves the board or hits a piece. Only used to
+// fill the tables, lookups go through the magics.
+static Bitboard sliding_attacks(const int directions[4][2], int sq, Bitboard occupied) {
+  Bitboard result = 0;
+  for (int d = 0; d < 4; d++) {
+    int x = square_x(sq) + directions[d][0];
+    int y = square_y(sq) + directions[d][1];
+    while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+      Bitboard bit = square_bit(square_of(x, y));
+      result |= bit;
+      if (occupied & bit) break;
+      x += directions[d][0];
+      y += directions[d][1];
+    }
+  }
+  return result;
+}
+
+static Bitboard step_attacks(int sq, const int steps[][2], int count) {
+  Bitboard result = 0;
+  for (int i = 0; i < count; i++) {
+    int x = square_x(sq) + steps[i][0];
+    int y = square_y(sq) + steps[i][1];
+    if (x >= 0 && x < 8 && y >= 0 && y < 8) result |= square_bit(square_of(x, y));
+  }
+  return result;
+}
+
+inline uint32_t magic_index(Magic *m, Bitboard occupied) {
+#if USE_PEXT
+  return (uint32_t) _pext_u64(occupied, m->mask);
+#else
+  return (uint32_t) (((occupied & m->mask) * m->magic) >> m->shift);
+#endif
+}
+
+// xorshift64*, fixed seed so the magics are the same every run
+static uint64_t magic_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+static void init_magics(Magic *magics, Bitboard *table, const int directions[4][2]) {
+  // NOTE : static to keep these off the stack, 4096 is the most any square needs
+  static Bitboard occupancy[4096];
+  static Bitboard reference[4096];
+  static int epoch[4096];
+  int attempt = 0;
+  uint64_t seed = 0x2545F4914F6CDD1DULL;
+
+  Bitboard *attacks = table;
+  for (int sq = 0; sq < 64; sq++) {
+    Magic *m = magics + sq;
+
+    // The edges never block anything, unless we are on that edge
+    Bitboard edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * square_y(sq)))) |
+                     ((FILE_A | FILE_H) & ~(FILE_A << square_x(sq)));
+    m->mask = sliding_attacks(directions, sq, 0) & ~edges;
+    m->shift = 64 - popcount(m->mask);
+    m->attacks = attacks;
+
+    // Carry-rippler trick to enumerate every subset of the mask
+    int size = 0;
+    Bitboard b = 0;
+    do {
+      occupancy[size] = b;
+      reference[size] = sliding_attacks(directions, sq, b);
+#if USE_PEXT
+      m->attacks[magic_index(m, b)] = reference[size];
+#endif
+      size++;
+      b = (b - m->mask) & m->mask;
+    } while (b);
+    attacks += size;
+
+#if !USE_PEXT
+    // Try random sparse magics until every subset maps to a slot without
+    // a destructive collision.
+    for (int i = 0; i < size;) {
+      m->magic = 0;
+      while (popcount((m->magic * m->mask) >> 56) < 6) {
+        m->magic = magic_random(&seed) & magic_random(&seed) & magic_random(&seed);
+      }
+
+      attempt++;
+      for (i = 0; i < size; i++) {
+        uint32_t idx = magic_index(m, occupancy[i]);
+        if (epoch[idx] < attempt) {
+          epoch[idx] = attempt;
+          m->attacks[idx] = reference[i];
+        } else if (m->attacks[idx] != reference[i]) {
+          break;
+        }
+      }
+    }
+#endif
+  }
+}
+
+void init_bitboards() {
+  if (bitboards_initialized) return;
+
+  static const int knight_steps[8][2] = {
+    { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 }
+  };
+  static const int king_steps[8][2] = {
+    { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+  };
+  static const int white_pawn_steps[2][2] = {{ -1, 1 }, { 1, 1 }};
+  static const int black_pawn_steps[2][2] = {{ -1, -1 }, { 1, -1 }};
+
+  for (int sq = 0; sq < 64; sq++) {
+    knight_attack_table[sq] = step_attacks(sq, knight_steps, 8);
+    king_attack_table[sq]   = step_attacks(sq, king_steps, 8);
+    pawn_attack_table[WHITE_SIDE][sq] = step_attacks(sq, white_pawn_steps, 2);
+    pawn_attack_table[BLACK_SIDE][sq] = step_attacks(sq, black_pawn_steps, 2);
+    castle_mask[sq] = CASTLE_ALL;
+  }
+
+  castle_mask[square_of(4, 0)] &= ~(CASTLE_WK | CASTLE_WQ);
+  castle_mask[square_of(7, 0)] &= ~CASTLE_WK;
+  castle_mask[square_of(0, 0)] &= ~CASTLE_WQ;
+  castle_mask[square_of(4, 7)] &= ~(CASTLE_BK | CASTLE_BQ);
+  castle_mask[square_of(7, 7)] &= ~CASTLE_BK;
+  castle_mask[square_of(0, 7)] &= ~CASTLE_BQ;
+
+  init_magics(rook_magics, rook_table, rook_directions);
+  init_magics(bishop_magics, bishop_table, bishop_directions);
+
+  for (int a = 0; a < 64; a++) {
+    for (int b = 0; b < 64; b++) {
+      Bitboard ends = square_bit(a) | square_bit(b);
+      if (a != b && (rook_attacks(a, 0) & square_bit(b))) {
+        line_table[a][b]    = (rook_attacks(a, 0) & rook_attacks(b, 0)) | ends;
+        between_table[a][b] = rook_attacks(a, square_bit(b)) & rook_attacks(b, square_bit(a));
+      } else if (a != b && (bishop_attacks(a, 0) & square_bit(b))) {
+        line_table[a][b]    = (bishop_attacks(a, 0) & bishop_attacks(b, 0)) | ends;
+        between_table[a][b] = bishop_attacks(a, square_bit(b)) & bishop_attacks(b, square_bit(a));
+      }
+    }
+  }
+
+  bitboards_initialized = true;
+}
+
+inline Bitboard rook_attacks(int sq, Bitboard occupied) {
+  Magic *m = rook_magics + sq;
+  return m->attacks[magic_index(m, occupied)];
+}
+
+inline Bitboard bishop_attacks(int sq, Bitboard occupied) {
+  Magic *m = bishop_magics + sq;
+  return m->attacks[magic_index(m, occupied)];
+}
+
+inline Bitboard queen_attacks(int sq, Bitboard occupied) {
+  return rook_attacks(sq, occupied) | bishop_attacks(sq, occupied);
+}
+
+void clear(BitPosition *bp) {
+  memset(bp, 0, sizeof(BitPosition));
+  bp->en_passant = NO_SQUARE;
+  bp->move_number = 1;
+  bp->eval_table = &default_eval;
+}
+
+inline void put_piece(BitPosition *bp, int sq, PieceType p) {
+  assert(bp->squares[sq] == EMPTY);
+  Bitboard bit = square_bit(sq);
+  int side = side_of(p);
+  bp->pieces[side][p & PMASK] |= bit;
+  bp->pieces[side][EMPTY]     |= bit;
+  bp->occupied                |= bit;
+  bp->squares[sq] = p;
+  bp->hash ^= zobrist_pieces[side][p & PMASK][sq];
+  bp->eval += eval_piece(bp->eval_table, p, sq);
+}
+
+inline void remove_piece(BitPosition *bp, int sq) {
+  PieceType p = bp->squares[sq];
+  assert(p != EMPTY);
+  Bitboard bit = square_bit(sq);
+  int side = side_of(p);
+  bp->pieces[side][p & PMASK] &= ~bit;
+  bp->pieces[side][EMPTY]     &= ~bit;
+  bp->occupied                &= ~bit;
+  bp->squares[sq] = EMPTY;
+  bp->hash ^= zobrist_pieces[side][p & PMASK][sq];
+  bp->eval -= eval_piece(bp->eval_table, p, sq);
+}
+
+// Castling rights are not stored in ChessBoard, they are implied by
+// the PMOVED flags on the king and rooks.
+static bool unmoved(ChessBoard *cb, int x, int y, PieceType expected) {
+  PieceType p = cb->board[y][x];
+  return (p & FULL_MASK) == expected && !(p & PMOVED);
+}
+
+uint8_t castling_rights(ChessBoard *cb) {
+  uint8_t result = 0;
+  if (unmoved(cb, 4, 0, KING)) {
+    if (unmoved(cb, 7, 0, ROOK)) result |= CASTLE_WK;
+    if (unmoved(cb, 0, 0, ROOK)) result |= CASTLE_WQ;
+  }
+  if (unmoved(cb, 4, 7, KING | PBLACK)) {
+    if (unmoved(cb, 7, 7, ROOK | PBLACK)) result |= CASTLE_BK;
+    if (unmoved(cb, 0, 7, ROOK | PBLACK)) result |= CASTLE_BQ;
+  }
+  return result;
+}
+
+BitPosition to_bit_position(ChessBoard *cb, int player) {
+  assert(player == 1 || player == 2);
+  BitPosition result;
+  clear(&result);
+
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      PieceType p = cb->board[y][x] & FULL_MASK;
+      if (p != EMPTY) put_piece(&result, square_of(x, y), p);
+    }
+  }
+
+  result.castling = castling_rights(cb);
+  if (cb->en_passant.x >= 0) {
+    result.en_passant = square_of(cb->en_passant.x, cb->en_passant.y);
+  }
+  result.static_moves = cb->static_moves;
+  result.side = player == 1 ? WHITE_SIDE : BLACK_SIDE;
+  result.hash = compute_hash(&result);
+  return result;
+}
+
+// Inverse of to_bit_position. Pieces that lost their castling rights are
+// marked PMOVED so king_move refuses to castle with them.
+ChessBoard to_chess_board(BitPosition *bp) {
+  ChessBoard result;
+  for (int sq = 0; sq < 64; sq++) {
+    PieceType p = bp->squares[sq];
+    set_piece(&result, square_x(sq), square_y(sq), p);
+    if ((p & PMASK) == KING) {
+      Position pos = { square_x(sq), square_y(sq) };
+      if (side_of(p) == WHITE_SIDE) result.king_1_pos = pos;
+      else                          result.king_2_pos = pos;
+    }
+  }
+
+  struct { int x, y; uint8_t rights; } homes[] = {
+    { 4, 0, CASTLE_WK | CASTLE_WQ }, { 7, 0, CASTLE_WK }, { 0, 0, CASTLE_WQ },
+    { 4, 7, CASTLE_BK | CASTLE_BQ }, { 7, 7, CASTLE_BK }, { 0, 7, CASTLE_BQ }
+  };
+  for (int i = 0; i < 6; i++) {
+    PieceType p = get_piece(&result, homes[i].x, homes[i].y);
+    if (p != EMPTY && !(bp->castling & homes[i].rights)) {
+      set_piece(&result, homes[i].x, homes[i].y, p | PMOVED);
+    }
+  }
+
+  if (bp->en_passant != NO_SQUARE) {
+    result.en_passant = { square_x(bp->en_passant), square_y(bp->en_passant) };
+  }
+  result.static_moves = bp->static_moves;
+  init_hash(&result);
+  init_eval(&result);
+  return result;
+}
+
+static PieceType fen_piece(char c) {
+  PieceType color = (c >= 'a' && c <= 'z') ? PBLACK : PWHITE;
+  switch (c | 0x20) {
+    case 'p' : return PAWN   | color;
+    case 'r' : return ROOK   | color;
+    case 'b' : return BISHOP | color;
+    case 'n' : return KNIGHT | color;
+    case 'k' : return KING   | color;
+    case 'q' : return QUEEN  | color;
+    default  : return NON_VALID;
+  }
+}
+
+// Reads a FEN string into bp. Returns false if it is malformed, bp is
+// left in an unspecified state in that case. The move counters are optional.
+bool parse_fen(BitPosition *bp, const char *fen) {
+  clear(bp);
+  const char *c = fen;
+
+  // Piece placement, starting from a8
+  int x = 0, y = 7;
+  for (; *c && *c != ' '; c++) {
+    if (*c == '/') {
+      if (x != 8 || y == 0) return false;
+      x = 0;
+      y--;
+    } else if (*c >= '1' && *c <= '8') {
+      x += *c - '0';
+      if (x > 8) return false;
+    } else {
+      PieceType p = fen_piece(*c);
+      if (p == NON_VALID || x > 7) return false;
+      put_piece(bp, square_of(x, y), p);
+      x++;
+    }
+  }
+  if (x != 8 || y != 0) return false;
+  if (popcount(bp->pieces[WHITE_SIDE][KING]) != 1) return false;
+  if (popcount(bp->pieces[BLACK_SIDE][KING]) != 1) return false;
+
+  // Side to move
+  while (*c == ' ') c++;
+  if (*c == 'w')      bp->side = WHITE_SIDE;
+  else if (*c == 'b') bp->side = BLACK_SIDE;
+  else return false;
+  c++;
+
+  // Castling rights
+  while (*c == ' ') c++;
+  for (; *c && *c != ' '; c++) {
+    switch (*c) {
+      case 'K' : bp->castling |= CASTLE_WK; break;
+      case 'Q' : bp->castling |= CASTLE_WQ; break;
+      case 'k' : bp->castling |= CASTLE_BK; break;
+      case 'q' : bp->castling |= CASTLE_BQ; break;
+      case '-' : break;
+      default  : return false;
+    }
+  }
+  // Drop rights that the pieces on the board can't back up
+  if (bp->squares[square_of(4, 0)] != KING)            bp->castling &= ~(CASTLE_WK | CASTLE_WQ);
+  if (bp->squares[square_of(7, 0)] != ROOK)            bp->castling &= ~CASTLE_WK;
+  if (bp->squares[square_of(0, 0)] != ROOK)            bp->castling &= ~CASTLE_WQ;
+  if (bp->squares[square_of(4, 7)] != (KING | PBLACK)) bp->castling &= ~(CASTLE_BK | CASTLE_BQ);
+  if (bp->squares[square_of(7, 7)] != (ROOK | PBLACK)) bp->castling &= ~CASTLE_BK;
+  if (bp->squares[square_of(0, 7)] != (ROOK | PBLACK)) bp->castling &= ~CASTLE_BQ;
+
+  // En passant target
+  while (*c == ' ') c++;
+  if (*c == '-') {
+    c++;
+  } else if (check_in_range_low(c[0]) && check_in_range_num(c[1])) {
+    bp->en_passant = square_of(c[0] - 'a', c[1] - '1');
+    c += 2;
+  } else {
+    return false;
+  }
+
+  // Both counters are optional
+  while (*c == ' ') c++;
+  if (*c >= '0' && *c <= '9') bp->static_moves = (uint8_t) atoi(c);
+  while (*c >= '0' && *c <= '9') c++;
+  while (*c == ' ') c++;
+  if (*c >= '1' && *c <= '9') bp->move_number = (uint16_t) atoi(c);
+
+  bp->hash = compute_hash(bp);
+  return true;
+}
+
+static const char fen_chars[7] = { 0, 'p', 'r', 'b', 'n', 'k', 'q' };
+
+// Returns the length, parse_fen reads it back to the same position
+int position_to_fen(BitPosition *bp, char out[MAX_FEN_LENGTH]) {
+  char *c = out;
+  for (int y = 7; y >= 0; y--) {
+    int empty = 0;
+    for (int x = 0; x < 8; x++) {
+      PieceType p = bp->squares[square_of(x, y)];
+      if (p == EMPTY) {
+        empty++;
+        continue;
+      }
+      if (empty) *c++ = '0' + empty;
+      empty = 0;
+      char name = fen_chars[p & PMASK];
+      *c++ = side_of(p) == WHITE_SIDE ? name - 0x20 : name;
+    }
+    if (empty) *c++ = '0' + empty;
+    if (y) *c++ = '/';
+  }
+
+  *c++ = ' ';
+  *c++ = bp->side == WHITE_SIDE ? 'w' : 'b';
+  *c++ = ' ';
+  if (bp->castling & CASTLE_WK) *c++ = 'K';
+  if (bp->castling & CASTLE_WQ) *c++ = 'Q';
+  if (bp->castling & CASTLE_BK) *c++ = 'k';
+  if (bp->castling & CASTLE_BQ) *c++ = 'q';
+  if (!bp->castling) *c++ = '-';
+  *c++ = ' ';
+  if (bp->en_passant == NO_SQUARE) {
+    *c++ = '-';
+  } else {
+    *c++ = 'a' + square_x(bp->en_passant);
+    *c++ = '1' + square_y(bp->en_passant);
+  }
+  c += sprintf(c, " %d %d", bp->static_moves, bp->move_number);
+  assert(c - out < MAX_FEN_LENGTH);
+  return c - out;
+}
+
+// False if there are more than 32 pieces, which no game can reach
+bool pack_position(BitPosition *bp, PackedPosition *packed) {
+  memset(packed, 0, sizeof(PackedPosition));
+  if (popcount(bp->occupied) > 32) return false;
+
+  packed->occupied = bp->occupied;
+  Bitboard b = bp->occupied;
+  for (int i = 0; b; i++) {
+    PieceType p = bp->squares[pop_lsb(&b)];
+    uint8_t nibble = (side_of(p) << 3) | (p & PMASK);
+    packed->pieces[i / 2] |= nibble << ((i & 1) * 4);
+  }
+  packed->side_castling = (bp->side << 4) | bp->castling;
+  packed->en_passant = bp->en_passant;
+  packed->static_moves = bp->static_moves;
+  packed->move_number = bp->move_number;
+  return true;
+}
+
+// False if packed isn't something pack_position could have written
+bool unpack_position(PackedPosition *packed, BitPosition *bp) {
+  clear(bp);
+  if (popcount(packed->occupied) > 32) return false;
+
+  Bitboard b = packed->occupied;
+  for (int i = 0; b; i++) {
+    uint8_t nibble = (packed->pieces[i / 2] >> ((i & 1) * 4)) & 0xF;
+    int type = nibble & 7;
+    if (type == EMPTY || type > QUEEN) return false;
+    put_piece(bp, pop_lsb(&b), (PieceType) type | ((nibble & 8) ? PBLACK : PWHITE));
+  }
+  if (popcount(bp->pieces[WHITE_SIDE][KING]) != 1) return false;
+  if (popcount(bp->pieces[BLACK_SIDE][KING]) != 1) return false;
+  if (packed->side_castling >> 5 || packed->en_passant > NO_SQUARE) return false;
+
+  bp->side = packed->side_castling >> 4;
+  bp->castling = packed->side_castling & CASTLE_ALL;
+  bp->en_passant = packed->en_passant;
+  bp->static_moves = packed->static_moves;
+  bp->move_number = (uint16_t) packed->move_number;
+  bp->hash = compute_hash(bp);
+  return true;
+}
+
+inline Bitboard attackers_to(BitPosition *bp, int sq, Bitboard occupied) {
+  Bitboard (*p)[7] = bp->pieces;
+  Bitboard rooks   = p[0][ROOK]   | p[1][ROOK]   | p[0][QUEEN] | p[1][QUEEN];
+  Bitboard bishops = p[0][BISHOP] | p[1][BISHOP] | p[0][QUEEN] | p[1][QUEEN];
+
+  return (pawn_attack_table[BLACK_SIDE][sq] & p[WHITE_SIDE][PAWN]) |
+         (pawn_attack_table[WHITE_SIDE][sq] & p[BLACK_SIDE][PAWN]) |
+         (knight_attack_table[sq] & (p[0][KNIGHT] | p[1][KNIGHT])) |
+         (king_attack_table[sq]   & (p[0][KING]   | p[1][KING]))   |
+         (rook_attacks(sq, occupied)   & rooks) |
+         (bishop_attacks(sq, occupied) & bishops);
+}
+
+inline bool is_square_attacked(BitPosition *bp, int sq, int by_side) {
+  return attackers_to(bp, sq, bp->occupied) & bp->pieces[by_side][EMPTY];
+}
+
+inline bool in_check(BitPosition *bp) {
+  int king_sq = lsb(bp->pieces[bp->side][KING]);
+  return is_square_attacked(bp, king_sq, bp->side ^ 1);
+}
+
+// Either side, and false without a king for boards set up by hand
+inline bool king_attacked(BitPosition *bp, int side) {
+  Bitboard king = bp->pieces[side][KING];
+  return king && is_square_attacked(bp, lsb(king), side ^ 1);
+}
+
+// Where the rook goes when the king castles to king_to
+inline void castle_rook_squares(int king_to, int *rook_from, int *rook_to) {
+  int rank = king_to & ~7;
+  if (square_x(king_to) == 6) {
+    *rook_from = rank + 7;
+    *rook_to   = rank + 5;
+  } else {
+    *rook_from = rank;
+    *rook_to   = rank + 3;
+  }
+}
+
+// Promotion piece by the low 2 bits of the flags and the other way around
+static const PieceType promotion_pieces[4] = { KNIGHT, BISHOP, ROOK, QUEEN };
+static const uint8_t promotion_indices[7] = { 0, 0, 2, 1, 0, 0, 3 };
+
+inline uint8_t promotion_flags(PieceType promotion) {
+  return MOVE_PROMOTION | promotion_indices[promotion & PMASK];
+}
+
+inline PieceType promotion_piece(BitMove move) {
+  return is_promotion(move) ? promotion_pieces[move.flags & 3] : EMPTY;
+}
+
+inline uint16_t move_bits(BitMove move) {
+  uint16_t bits;
+  memcpy(&bits, &move, sizeof(bits));
+  return bits;
+}
+
+inline BitMove bits_move(uint16_t bits) {
+  BitMove move;
+  memcpy(&move, &bits, sizeof(move));
+  return move;
+}
+
+inline BitMove *add_move(BitMove *moves, int from, int to, uint8_t flags) {
+  moves->from = from;
+  moves->to = to;
+  moves->flags = flags;
+  return moves + 1;
+}
+
+inline BitMove *add_pawn_moves(BitMove *moves, int from, int to, uint8_t flags) {
+  if (to >= 56 || to < 8) {
+    moves = add_move(moves, from, to, flags | promotion_flags(QUEEN));
+    moves = add_move(moves, from, to, flags | promotion_flags(ROOK));
+    moves = add_move(moves, from, to, flags | promotion_flags(BISHOP));
+    moves = add_move(moves, from, to, flags | promotion_flags(KNIGHT));
+    return moves;
+  }
+  return add_move(moves, from, to, flags);
+}
+
+inline BitMove *add_targets(BitMove *moves, int from, Bitboard targets, Bitboard enemy) {
+  while (targets) {
+    int to = pop_lsb(&targets);
+    moves = add_move(moves, from, to, (enemy & square_bit(to)) ? MOVE_CAPTURE : MOVE_QUIET);
+  }
+  return moves;
+}
+
+// What generate includes
+#define GENERATE_ALL      0
+#define GENERATE_CAPTURES 1 // and promotions
+#define GENERATE_QUIETS   2 // everything GENERATE_CAPTURES leaves out
+
+static int generate(BitPosition *bp, BitMove *moves, int type) {
+  int us = bp->side;
+  int them = us ^ 1;
+  Bitboard own   = bp->pieces[us][EMPTY];
+  Bitboard enemy = bp->pieces[them][EMPTY];
+  Bitboard empty = ~bp->occupied;
+  BitMove *start = moves;
+
+  // Pawns, all at once
+  Bitboard pawns = bp->pieces[us][PAWN];
+  Bitboard single, twice, left, right;
+  int up;
+  if (us == WHITE_SIDE) {
+    up = 8;
+    single = (pawns << 8) & empty;
+    twice  = ((single & (RANK_2 << 8)) << 8) & empty;
+    left   = ((pawns & ~FILE_A) << 7) & enemy;
+    right  = ((pawns & ~FILE_H) << 9) & enemy;
+  } else {
+    up = -8;
+    single = (pawns >> 8) & empty;
+    twice  = ((single & (RANK_7 >> 8)) >> 8) & empty;
+    left   = ((pawns & ~FILE_A) >> 9) & enemy;
+    right  = ((pawns & ~FILE_H) >> 7) & enemy;
+  }
+  if (type == GENERATE_CAPTURES) {
+    single &= RANK_1 | RANK_8;
+    twice = 0;
+  } else if (type == GENERATE_QUIETS) {
+    single &= ~(RANK_1 | RANK_8);
+    left = right = 0;
+  }
+
+  while (single) {
+    int to = pop_lsb(&single);
+    moves = add_pawn_moves(moves, to - up, to, MOVE_QUIET);
+  }
+  while (twice) {
+    int to = pop_lsb(&twice);
+    moves = add_move(moves, to - 2 * up, to, MOVE_DOUBLE_PUSH);
+  }
+  while (left) {
+    int to = pop_lsb(&left);
+    moves = add_pawn_moves(moves, to - up + 1, to, MOVE_CAPTURE);
+  }
+  while (right) {
+    int to = pop_lsb(&right);
+    moves = add_pawn_moves(moves, to - up - 1, to, MOVE_CAPTURE);
+  }
+  if (bp->en_passant != NO_SQUARE && type != GENERATE_QUIETS) {
+    Bitboard attackers = pawn_attack_table[them][bp->en_passant] & pawns;
+    while (attackers) {
+      int from = pop_lsb(&attackers);
+      moves = add_move(moves, from, bp->en_passant, MOVE_EN_PASSANT);
+    }
+  }
+
+  // Everything else
+  Bitboard not_own = ~own;
+  if (type == GENERATE_CAPTURES)    not_own = enemy;
+  else if (type == GENERATE_QUIETS) not_own = empty;
+  Bitboard b = bp->pieces[us][KNIGHT];
+  while (b) {
+    int from = pop_lsb(&b);
+    moves = add_targets(moves, from, knight_attack_table[from] & not_own, enemy);
+  }
+  b = bp->pieces[us][BISHOP];
+  while (b) {
+    int from = pop_lsb(&b);
+    moves = add_targets(moves, from, bishop_attacks(from, bp->occupied) & not_own, enemy);
+  }
+  b = bp->pieces[us][ROOK];
+  while (b) {
+    int from = pop_lsb(&b);
+    moves = add_targets(moves, from, rook_attacks(from, bp->occupied) & not_own, enemy);
+  }
+  b = bp->pieces[us][QUEEN];
+  while (b) {
+    int from = pop_lsb(&b);
+    moves = add_targets(moves, from, queen_attacks(from, bp->occupied) & not_own, enemy);
+  }
+
+  int king = lsb(bp->pieces[us][KING]);
+  moves = add_targets(moves, king, king_attack_table[king] & not_own, enemy);
+
+  // Castling, the destination square is left to the legality check
+  uint8_t rights = bp->castling & (us == WHITE_SIDE ? (CASTLE_WK | CASTLE_WQ) : (CASTLE_BK | CASTLE_BQ));
+  if (rights && type != GENERATE_CAPTURES && !is_square_attacked(bp, king, them)) {
+    int rank = us == WHITE_SIDE ? 0 : 56;
+    uint8_t king_side  = us == WHITE_SIDE ? CASTLE_WK : CASTLE_BK;
+    uint8_t queen_side = us == WHITE_SIDE ? CASTLE_WQ : CASTLE_BQ;
+
+    if ((rights & king_side) &&
+        !(bp->occupied & (square_bit(rank + 5) | square_bit(rank + 6))) &&
+        !is_square_attacked(bp, rank + 5, them)) {
+      moves = add_move(moves, king, rank + 6, MOVE_CASTLE);
+    }
+    if ((rights & queen_side) &&
+        !(bp->occupied & (square_bit(rank + 1) | square_bit(rank + 2) | square_bit(rank + 3))) &&
+        !is_square_attacked(bp, rank + 3, them)) {
+      moves = add_move(moves, king, rank + 2, MOVE_CASTLE);
+    }
+  }
+
+  assert(moves - start <= MAX_MOVES);
+  return moves - start;
+}
+
+// Generates every pseudo-legal move for the side to move: the only thing
+// not checked is whether the mover leaves their own king in check. Castling
+// through or out of check is already filtered here.
+// moves must have room for MAX_MOVES.
+int generate_moves(BitPosition *bp, BitMove *moves) {
+  return generate(bp, moves, GENERATE_ALL);
+}
+
+// Same as generate_moves, but only captures and promotions
+int generate_captures(BitPosition *bp, BitMove *moves) {
+  return generate(bp, moves, GENERATE_CAPTURES);
+}
+
+// The rest of generate_moves, so the search can put off generating these
+// until the captures failed to cut off.
+int generate_quiets(BitPosition *bp, BitMove *moves) {
+  return generate(bp, moves, GENERATE_QUIETS);
+}
+
+// True if generate_moves would have produced move. For moves that come
+// from somewhere else, like the transposition table or killers, which
+// may not even be for this position.
+bool is_pseudo_legal(BitPosition *bp, BitMove move) {
+  int us = bp->side;
+  PieceType p = bp->squares[move.from];
+  if (p == EMPTY || side_of(p) != us) return false;
+
+  // Rare, and the generator already has all the conditions
+  if (is_castle(move)) {
+    if ((p & PMASK) != KING) return false;
+    BitMove moves[MAX_MOVES];
+    int count = generate_quiets(bp, moves);
+    for (int i = 0; i < count; i++) {
+      if (move_bits(moves[i]) == move_bits(move)) return true;
+    }
+    return false;
+  }
+
+  Bitboard to = square_bit(move.to);
+  if ((p & PMASK) == PAWN) {
+    if (is_en_passant(move)) return move.to == bp->en_passant && (pawn_attack_table[us][move.from] & to);
+
+    bool last_rank = move.to >= 56 || move.to < 8;
+    if (is_promotion(move) != last_rank) return false;
+    if (is_capture(move)) {
+      if (!is_promotion(move) && move.flags != MOVE_CAPTURE) return false;
+      return (pawn_attack_table[us][move.from] & to & bp->pieces[us ^ 1][EMPTY]) != 0;
+    }
+
+    int up = us == WHITE_SIDE ? 8 : -8;
+    if (bp->occupied & to) return false;
+    if (is_double_push(move)) {
+      int start_rank = us == WHITE_SIDE ? 1 : 6;
+      return square_y(move.from) == start_rank && move.to == move.from + 2 * up &&
+        !(bp->occupied & square_bit(move.from + up));
+    }
+    return (move.flags == MOVE_QUIET || is_promotion(move)) && move.to == move.from + up;
+  }
+
+  if (move.flags != MOVE_QUIET && move.flags != MOVE_CAPTURE) return false;
+  Bitboard targets = is_capture(move) ? bp->pieces[us ^ 1][EMPTY] : ~bp->occupied;
+  switch (p & PMASK) {
+    case KNIGHT: targets &= knight_attack_table[move.from]; break;
+    case BISHOP: targets &= bishop_attacks(move.from, bp->occupied); break;
+    case ROOK:   targets &= rook_attacks(move.from, bp->occupied); break;
+    case QUEEN:  targets &= queen_attacks(move.from, bp->occupied); break;
+    case KING:   targets &= king_attack_table[move.from]; break;
+    default:     targets = 0;
+  }
+  return (targets & to) != 0;
+}
+
+// Modifies bp in place, applying a move from generate_moves. It does NOT
+// check that the move is legal. undo gets what unmake_move needs to put
+// the position back.
+void make_move(BitPosition *bp, BitMove move, UndoInfo *undo) {
+  PieceType p = bp->squares[move.from];
+  assert(p != EMPTY);
+  assert(side_of(p) == bp->side);
+
+  undo->hash         = bp->hash;
+  undo->captured     = EMPTY;
+  undo->castling     = bp->castling;
+  undo->en_passant   = bp->en_passant;
+  undo->static_moves = bp->static_moves;
+
+  bp->static_moves++;
+  if (bp->side == BLACK_SIDE) bp->move_number++;
+
+  if (is_en_passant(move)) {
+    // The captured pawn is on the same file, one rank behind the target
+    undo->captured = bp->squares[move.to ^ 8];
+    remove_piece(bp, move.to ^ 8);
+  } else if (is_capture(move)) {
+    undo->captured = bp->squares[move.to];
+    remove_piece(bp, move.to);
+  }
+
+  remove_piece(bp, move.from);
+  if (is_promotion(move)) put_piece(bp, move.to, promotion_piece(move) | (p & PBLACK));
+  else                    put_piece(bp, move.to, p);
+
+  if (is_castle(move)) {
+    int rook_from, rook_to;
+    castle_rook_squares(move.to, &rook_from, &rook_to);
+    PieceType rook = bp->squares[rook_from];
+    remove_piece(bp, rook_from);
+    put_piece(bp, rook_to, rook);
+  }
+
+  if ((p & PMASK) == PAWN || is_capture(move)) bp->static_moves = 0;
+
+  if (bp->en_passant != NO_SQUARE) bp->hash ^= zobrist_en_passant[square_x(bp->en_passant)];
+  bp->en_passant = NO_SQUARE;
+  if (is_double_push(move)) {
+    bp->en_passant = (move.from + move.to) / 2;
+    bp->hash ^= zobrist_en_passant[square_x(bp->en_passant)];
+  }
+
+  bp->hash ^= zobrist_castling[bp->castling];
+  bp->castling &= castle_mask[move.from] & castle_mask[move.to];
+  bp->hash ^= zobrist_castling[bp->castling];
+
+  bp->side ^= 1;
+  bp->hash ^= zobrist_side;
+}
+
+// Passes the turn, for null move pruning. Never done in check.
+void make_null_move(BitPosition *bp, UndoInfo *undo) {
+  assert(!in_check(bp));
+  undo->hash         = bp->hash;
+  undo->captured     = EMPTY;
+  undo->castling     = bp->castling;
+  undo->en_passant   = bp->en_passant;
+  undo->static_moves = bp->static_moves;
+
+  bp->static_moves++;
+  if (bp->en_passant != NO_SQUARE) bp->hash ^= zobrist_en_passant[square_x(bp->en_passant)];
+  bp->en_passant = NO_SQUARE;
+  bp->side ^= 1;
+  bp->hash ^= zobrist_side;
+}
+
+void unmake_null_move(BitPosition *bp, UndoInfo *undo) {
+  bp->side ^= 1;
+  bp->en_passant   = undo->en_passant;
+  bp->static_moves = undo->static_moves;
+  bp->hash         = undo->hash;
+}
+
+// Reverses make_move. move and undo must be the ones make_move was given.
+void unmake_move(BitPosition *bp, BitMove move, UndoInfo *undo) {
+  bp->side ^= 1;
+  if (bp->side == BLACK_SIDE) bp->move_number--;
+
+  PieceType p = bp->squares[move.to];
+  remove_piece(bp, move.to);
+  if (is_promotion(move)) put_piece(bp, move.from, PAWN | (p & PBLACK));
+  else                    put_piece(bp, move.from, p);
+
+  if (is_castle(move)) {
+    int rook_from, rook_to;
+    castle_rook_squares(move.to, &rook_from, &rook_to);
+    PieceType rook = bp->squares[rook_to];
+    remove_piece(bp, rook_to);
+    put_piece(bp, rook_from, rook);
+  }
+
+  if (is_en_passant(move)) {
+    put_piece(bp, move.to ^ 8, undo->captured);
+  } else if (is_capture(move)) {
+    put_piece(bp, move.to, undo->captured);
+  }
+
+  bp->castling     = undo->castling;
+  bp->en_passant   = undo->en_passant;
+  bp->static_moves = undo->static_moves;
+  bp->hash         = undo->hash;
+}
+
+// Same as make_move for when the old position isn't needed
+void apply_move(BitPosition *bp, BitMove move) {
+  UndoInfo undo;
+  make_move(bp, move, &undo);
+}
+
+// After make_move, true if the side that just moved left its king attacked
+inline bool left_in_check(BitPosition *bp) {
+  int king_sq = lsb(bp->pieces[bp->side ^ 1][KING]);
+  return is_square_attacked(bp, king_sq, bp->side);
+}
+
+inline void init_check_info(BitPosition *bp, CheckInfo *info) {
+  int us = bp->side;
+  int them = us ^ 1;
+  int king = lsb(bp->pieces[us][KING]);
+  info->king = king;
+  info->checkers = attackers_to(bp, king, bp->occupied) & bp->pieces[them][EMPTY];
+
+  // Enemy sliders that would see the king on an empty board pin the
+  // piece between them if it is the only one and it's ours
+  Bitboard queens = bp->pieces[them][QUEEN];
+  Bitboard snipers = (rook_attacks(king, 0)   & (bp->pieces[them][ROOK]   | queens)) |
+                     (bishop_attacks(king, 0) & (bp->pieces[them][BISHOP] | queens));
+  info->pinned = 0;
+  while (snipers) {
+    Bitboard blockers = between_table[king][pop_lsb(&snipers)] & bp->occupied;
+    if (blockers && !(blockers & (blockers - 1))) info->pinned |= blockers & bp->pieces[us][EMPTY];
+  }
+}
+
+// True if a move from generate_moves does not leave the mover's king in
+// check. info has to be for the current position.
+inline bool is_legal(BitPosition *bp, BitMove move, CheckInfo *info) {
+  if (move.from == info->king) {
+    // Castling already checked the squares the king passes, only where
+    // it lands is left. The king doesn't block attacks on its own path.
+    Bitboard occupied = bp->occupied ^ square_bit(info->king);
+    return !(attackers_to(bp, move.to, occupied) & bp->pieces[bp->side ^ 1][EMPTY]);
+  }
+
+  // Two pawns leave the rank at once, too rare to be worth the special case
+  if (is_en_passant(move)) {
+    UndoInfo undo;
+    make_move(bp, move, &undo);
+    bool result = !left_in_check(bp);
+    unmake_move(bp, move, &undo);
+    return result;
+  }
+
+  if (info->checkers) {
+    // Double check, only the king can move
+    if (info->checkers & (info->checkers - 1)) return false;
+    // Otherwise capture the checker or block
+    Bitboard targets = info->checkers | between_table[info->king][lsb(info->checkers)];
+    if (!(targets & square_bit(move.to))) return false;
+  }
+
+  if (info->pinned & square_bit(move.from)) {
+    return line_table[info->king][move.from] & square_bit(move.to);
+  }
+  return true;
+}
+
+bool is_legal(BitPosition *bp, BitMove move) {
+  CheckInfo info;
+  init_check_info(bp, &info);
+  return is_legal(bp, move, &info);
+}
+
+int generate_legal_moves(BitPosition *bp, BitMove *moves) {
+  BitMove pseudo[MAX_MOVES];
+  int count = generate_moves(bp, pseudo);
+  CheckInfo info;
+  init_check_info(bp, &info);
+  int legal = 0;
+  for (int i = 0; i < count; i++) {
+    if (is_legal(bp, pseudo[i], &info)) moves[legal++] = pseudo[i];
+  }
+  return legal;
+}
+
+// Stops at the first legal move, with in_check this tells mate from
+// stalemate from neither.
+bool has_legal_move(BitPosition *bp) {
+  BitMove moves[MAX_MOVES];
+  int count = generate_moves(bp, moves);
+  CheckInfo info;
+  init_check_info(bp, &info);
+  for (int i = 0; i < count; i++) {
+    if (is_legal(bp, moves[i], &info)) return true;
+  }
+  return false;
+}
+
+void print_board(BitPosition *bp, FILE *file) {
+  print_board((PieceType (*)[8]) bp->squares, file);
+}
+
+inline void print_move(BitMove move, FILE *file) {
+  Position p1 = { square_x(move.from), square_y(move.from) };
+  Position p2 = { square_x(move.to), square_y(move.to) };
+  print_move(p1, p2, file);
+}
+
+void move_to_string(BitMove move, char out[6]) {
+  static const char promotion_chars[7] = { 0, 'p', 'r', 'b', 'n', 'k', 'q' };
+  out[0] = 'a' + square_x(move.from);
+  out[1] = '1' + square_y(move.from);
+  out[2] = 'a' + square_x(move.to);
+  out[3] = '1' + square_y(move.to);
+  out[4] = promotion_chars[promotion_piece(move)];
+  out[5] = 0;
+}
+
+// Only succeeds for a legal move. A pawn reaching the last rank without
+// a promotion letter is taken as a queen.
+bool parse_move(BitPosition *bp, const char *text, BitMove *move) {
+  if (!check_in_range_low(text[0]) || !check_in_range_num(text[1]) ||
+      !check_in_range_low(text[2]) || !check_in_range_num(text[3])) return false;
+  int from = square_of(text[0] - 'a', text[1] - '1');
+  int to   = square_of(text[2] - 'a', text[3] - '1');
+  char promotion = text[4] >= 'a' && text[4] <= 'z' ? text[4] : 'q';
+
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(bp, moves);
+  for (int i = 0; i < count; i++) {
+    if (moves[i].from != from || moves[i].to != to) continue;
+    char out[6];
+    move_to_string(moves[i], out);
+    if (is_promotion(moves[i]) && out[4] != promotion) continue;
+    *move = moves[i];
+    return true;
+  }
+  return false;
+}
+
+
+// Standard algebraic like PGN uses: e4, Nbd7, exd6, O-O, e8=Q+. Check
+// marks and annotations after the move are ignored. Only succeeds for a
+// legal move, and fails if the text could mean more than one.
+bool parse_san(BitPosition *bp, const char *text, BitMove *move) {
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(bp, moves);
+
+  if (!strncmp(text, "O-O", 3) || !strncmp(text, "0-0", 3)) {
+    bool long_castle = !strncmp(text + 3, "-O", 2) || !strncmp(text + 3, "-0", 2);
+    for (int i = 0; i < count; i++) {
+      if (!is_castle(moves[i])) continue;
+      if ((square_x(moves[i].to) == 2) != long_castle) continue;
+      *move = moves[i];
+      return true;
+    }
+    return false;
+  }
+
+  static const char piece_chars[7] = { 0, 'P', 'R', 'B', 'N', 'K', 'Q' };
+  PieceType piece = PAWN;
+  for (int type = ROOK; type <= QUEEN; type++) {
+    if (text[0] == piece_chars[type]) piece = (PieceType) type;
+  }
+  if (piece != PAWN) text++;
+
+  // Whatever is left over before the destination disambiguates
+  char squares[8];
+  int length = 0;
+  PieceType promotion = EMPTY;
+  for (; *text && !strchr("+#!? \t", *text); text++) {
+    if (*text == 'x' || *text == '-') continue;
+    if (*text == '=' || (*text >= 'A' && *text <= 'Z')) {
+      // e8=Q, or e8Q from some writers
+      char letter = *text == '=' ? text[1] : text[0];
+      for (int type = ROOK; type <= QUEEN; type++) {
+        if (letter == piece_chars[type]) promotion = (PieceType) type;
+      }
+      if (!promotion) return false;
+      break;
+    }
+    if (length == 6) return false;
+    squares[length++] = *text;
+  }
+  if (length < 2 || !check_in_range_low(squares[length - 2]) || !check_in_range_num(squares[length - 1])) {
+    return false;
+  }
+  int to = square_of(squares[length - 2] - 'a', squares[length - 1] - '1');
+  int from_x = -1, from_y = -1;
+  for (int i = 0; i < length - 2; i++) {
+    if (check_in_range_low(squares[i]))      from_x = squares[i] - 'a';
+    else if (check_in_range_num(squares[i])) from_y = squares[i] - '1';
+    else return false;
+  }
+
+  int found = 0;
+  for (int i = 0; i < count; i++) {
+    BitMove m = moves[i];
+    if (m.to != to || (bp->squares[m.from] & PMASK) != piece) continue;
+    if ((from_x >= 0 && square_x(m.from) != from_x) || (from_y >= 0 && square_y(m.from) != from_y)) continue;
+    if (is_promotion(m) != (promotion != EMPTY)) continue;
+    if (promotion && promotion_piece(m) != promotion) continue;
+    *move = m;
+    found++;
+  }
+  return found == 1;
+}
+
+#endif
@@ -0,0 +1,206 @@
+
+#ifndef _CHESS_BITBOARD_H_
+#define _CHESS_BITBOARD_H_
+
+#include <cstdint>
+
+// Bitboard representation of the game. This runs alongside ChessBoard:
+// ChessBoard is still what the interactive game uses, BitPosition is what
+// the move generator (and eventually search) uses.
+//
+// Squares are numbered y * 8 + x, so a1 == 0, h1 == 7 and h8 == 63. This
+// matches ChessBoard::board[y][x].
+
+typedef uint64_t Bitboard;
+
+#define NO_SQUARE 64
+
+#define WHITE_SIDE 0
+#define BLACK_SIDE 1
+
+// Castling rights:
+#define CASTLE_WK 0x1
+#define CASTLE_WQ 0x2
+#define CASTLE_BK 0x4
+#define CASTLE_BQ 0x8
+#define CASTLE_ALL (CASTLE_WK | CASTLE_WQ | CASTLE_BK | CASTLE_BQ)
+
+#define FILE_A  0x0101010101010101ULL
+#define FILE_H  0x8080808080808080ULL
+#define RANK_1  0x00000000000000FFULL
+#define RANK_2  0x000000000000FF00ULL
+#define RANK_4  0x00000000FF000000ULL
+#define RANK_5  0x000000FF00000000ULL
+#define RANK_7  0x00FF000000000000ULL
+#define RANK_8  0xFF00000000000000ULL
+
+#define square_bit(S) (1ULL << (S))
+#define square_of(X, Y) ((Y) * 8 + (X))
+#define square_x(S) ((S) & 7)
+#define square_y(S) ((S) >> 3)
+
+inline int popcount(Bitboard b) { return __builtin_popcountll(b); }
+
+inline int lsb(Bitboard b) {
+  assert(b);
+  return __builtin_ctzll(b);
+}
+
+inline int pop_lsb(Bitboard *b) {
+  int s = lsb(*b);
+  *b &= *b - 1;
+  return s;
+}
+
+// Move flags, 4 bits. Captures have MOVE_CAPTURE set and promotions have
+// MOVE_PROMOTION set with the piece in the low 2 bits, see promotion_flags.
+#define MOVE_QUIET       0x0
+#define MOVE_DOUBLE_PUSH 0x1
+#define MOVE_CASTLE      0x2
+#define MOVE_CAPTURE     0x4
+#define MOVE_EN_PASSANT  0x5 // MOVE_CAPTURE | 1
+#define MOVE_PROMOTION   0x8
+
+// Fits in 16 bits, the same bits the transposition table stores.
+typedef struct {
+  uint16_t from  : 6;
+  uint16_t to    : 6;
+  uint16_t flags : 4;
+} BitMove;
+
+static_assert(sizeof(BitMove) == 2, "BitMove should be 16 bits");
+
+inline bool is_capture(BitMove move)    { return move.flags & MOVE_CAPTURE; }
+inline bool is_promotion(BitMove move)  { return move.flags & MOVE_PROMOTION; }
+inline bool is_en_passant(BitMove move) { return move.flags == MOVE_EN_PASSANT; }
+inline bool is_castle(BitMove move)     { return move.flags == MOVE_CASTLE; }
+inline bool is_double_push(BitMove move) { return move.flags == MOVE_DOUBLE_PUSH; }
+
+inline uint8_t promotion_flags(PieceType promotion);
+inline PieceType promotion_piece(BitMove move); // EMPTY unless a promotion
+inline uint16_t move_bits(BitMove move);
+inline BitMove bits_move(uint16_t bits);
+
+#define MAX_MOVES 256
+
+struct EvalTable;
+
+typedef struct {
+  // pieces[side][type] where type is a PieceType, pieces[side][EMPTY] is
+  // every piece belonging to that side.
+  Bitboard pieces[2][7];
+  Bitboard occupied;
+
+  // Mailbox copy so we don't have to search the bitboards for a piece.
+  // Same encoding as ChessBoard, but PMOVED is never set.
+  PieceType squares[64];
+
+  uint8_t side;       // side to move, WHITE_SIDE or BLACK_SIDE
+  uint8_t castling;   // CASTLE_* flags
+  uint8_t en_passant; // target square of an en passant capture or NO_SQUARE
+  uint8_t static_moves;
+
+  // Zobrist hash, same keys as ChessBoard::hash but with zobrist_side
+  // already xored in when black is to move.
+  uint64_t hash;
+  int32_t eval; // material and piece-square sum, white positive, see eval.h
+  const EvalTable *eval_table; // what eval is summed from, &default_eval unless set_eval_table
+  uint16_t move_number; // FEN fullmove number, goes up after black moves
+} BitPosition;
+
+// Longest FEN position_to_fen writes, with the terminator
+#define MAX_FEN_LENGTH 96
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+// For storing lots of positions, like from game logs. Pieces are 4 bits
+// each, side << 3 | type, two to a byte in the order of the set bits of
+// occupied. Every byte is written, so packed positions can be compared
+// with memcmp or hashed as keys.
+typedef struct {
+  Bitboard occupied;
+  uint8_t pieces[16];
+  uint8_t side_castling; // side << 4 | CASTLE_* flags
+  uint8_t en_passant;    // NO_SQUARE if none
+  uint8_t static_moves;
+  uint8_t unused;        // 0
+  uint32_t move_number;
+} PackedPosition;
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition should be 32 bytes");
+
+// Everything make_move destroys that can't be recomputed from the move
+typedef struct {
+  uint64_t hash;
+  PieceType captured;
+  uint8_t castling;
+  uint8_t en_passant;
+  uint8_t static_moves;
+} UndoInfo;
+
+typedef struct {
+  Bitboard mask;
+  Bitboard magic;
+  Bitboard *attacks;
+  uint32_t shift;
+} Magic;
+
+// Computed once per node so each move's legality is a few bit operations
+// instead of make_move plus an attack test, see is_legal.
+typedef struct {
+  Bitboard checkers; // enemy pieces attacking the king of the side to move
+  Bitboard pinned;   // own pieces that can only move along the line to the king
+  int king;
+} CheckInfo;
+
+void init_bitboards();
+
+inline Bitboard rook_attacks(int sq, Bitboard occupied);
+inline Bitboard bishop_attacks(int sq, Bitboard occupied);
+inline Bitboard queen_attacks(int sq, Bitboard occupied);
+
+inline int side_of(PieceType p);
+
+void clear(BitPosition *bp);
+inline void put_piece(BitPosition *bp, int sq, PieceType p);
+inline void remove_piece(BitPosition *bp, int sq);
+
+uint8_t castling_rights(ChessBoard *cb);
+BitPosition to_bit_position(ChessBoard *cb, int player);
+ChessBoard to_chess_board(BitPosition *bp);
+
+bool parse_fen(BitPosition *bp, const char *fen);
+int position_to_fen(BitPosition *bp, char out[MAX_FEN_LENGTH]);
+bool pack_position(BitPosition *bp, PackedPosition *packed);
+bool unpack_position(PackedPosition *packed, BitPosition *bp);
+
+inline Bitboard attackers_to(BitPosition *bp, int sq, Bitboard occupied);
+inline bool is_square_attacked(BitPosition *bp, int sq, int by_side);
+inline bool in_check(BitPosition *bp);
+inline bool king_attacked(BitPosition *bp, int side);
+
+int generate_moves(BitPosition *bp, BitMove *moves);
+int generate_captures(BitPosition *bp, BitMove *moves);
+int generate_quiets(BitPosition *bp, BitMove *moves);
+bool is_pseudo_legal(BitPosition *bp, BitMove move);
+void make_move(BitPosition *bp, BitMove move, UndoInfo *undo);
+void unmake_move(BitPosition *bp, BitMove move, UndoInfo *undo);
+void make_null_move(BitPosition *bp, UndoInfo *undo);
+void unmake_null_move(BitPosition *bp, UndoInfo *undo);
+void apply_move(BitPosition *bp, BitMove move);
+inline bool left_in_check(BitPosition *bp);
+inline void init_check_info(BitPosition *bp, CheckInfo *info);
+inline bool is_legal(BitPosition *bp, BitMove move, CheckInfo *info);
+bool is_legal(BitPosition *bp, BitMove move);
+int generate_legal_moves(BitPosition *bp, BitMove *moves);
+bool has_legal_move(BitPosition *bp);
+
+void print_board(BitPosition *bp, FILE *file);
+inline void print_move(BitMove move, FILE *file);
+
+// Long algebraic like UCI uses: e2e4, e7e8q
+void move_to_string(BitMove move, char out[6]);
+bool parse_move(BitPosition *bp, const char *text, BitMove *move);
+bool parse_san(BitPosition *bp, const char *text, BitMove *move);
+
+#endif
@@ -0,0 +1,261 @@
+
+#ifndef _CHESS_BOOK_CPP_
+#define _CHESS_BOOK_CPP_
+
+#include "book.h"
+#include <algorithm>
+#include <cctype>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void init_book(OpeningBook *book) {
+  *book = {};
+}
+
+bool load_book(OpeningBook *book, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t) sizeof(BookHeader)) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  BookHeader *header = (BookHeader *) data;
+  if (memcmp(header->magic, BOOK_MAGIC, 4) ||
+      (size_t) st.st_size != sizeof(BookHeader) + header->count * sizeof(BookEntry)) {
+    munmap(data, st.st_size);
+    return false;
+  }
+  free_book(book);
+  book->data = (const uint8_t *) data;
+  book->size = st.st_size;
+  book->entries = (const BookEntry *) (book->data + sizeof(BookHeader));
+  book->count = header->count;
+  return true;
+}
+
+void free_book(OpeningBook *book) {
+  if (book->data) munmap((void *) book->data, book->size);
+  init_book(book);
+}
+
+// Legal moves from bp and their counts, most played first. A move that
+// isn't legal means the key collided or the file is bad, it is skipped.
+int book_moves(OpeningBook *book, BitPosition *bp, BitMove *moves, int *counts, int max_moves) {
+  uint64_t low = 0, high = book->count;
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    if (book->entries[middle].key < bp->hash) low = middle + 1;
+    else high = middle;
+  }
+  if (low == book->count || book->entries[low].key != bp->hash) return 0;
+
+  BitMove legal[MAX_MOVES];
+  int legal_count = generate_legal_moves(bp, legal);
+  int count = 0;
+  for (uint64_t i = low; i < book->count && book->entries[i].key == bp->hash && count < max_moves; i++) {
+    for (int j = 0; j < legal_count; j++) {
+      if (move_bits(legal[j]) != book->entries[i].move) continue;
+      // Insertion by count
+      int k = count++;
+      for (; k > 0 && counts[k - 1] < book->entries[i].count; k--) {
+        moves[k] = moves[k - 1];
+        counts[k] = counts[k - 1];
+      }
+      moves[k] = legal[j];
+      counts[k] = book->entries[i].count;
+      break;
+    }
+  }
+  return count;
+}
+
+// random 0 takes the most played move, anything else picks one with
+// odds by how often it was played.
+bool book_move(OpeningBook *book, BitPosition *bp, uint64_t random, BitMove *move) {
+  if (!book->count) return false;
+  BitMove moves[MAX_MOVES];
+  int counts[MAX_MOVES];
+  int count = book_moves(book, bp, moves, counts, MAX_MOVES);
+  if (!count) return false;
+
+  *move = moves[0];
+  if (random) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) total += counts[i];
+    uint64_t pick = random % total;
+    for (int i = 0; i < count; i++) {
+      if (pick < (uint64_t) counts[i]) {
+        *move = moves[i];
+        break;
+      }
+      pick -= counts[i];
+    }
+  }
+  return true;
+}
+
+void init_book_builder(BookBuilder *builder) {
+  *builder = {};
+}
+
+void free_book_builder(BookBuilder *builder) {
+  free(builder->entries);
+  init_book_builder(builder);
+}
+
+bool add_book_entry(BookBuilder *builder, uint64_t key, BitMove move) {
+  if (builder->count == builder->capacity) {
+    uint64_t capacity = builder->capacity ? builder->capacity * 2 : 1024;
+    BookEntry *entries = (BookEntry *) realloc(builder->entries, capacity * sizeof(BookEntry));
+    if (!entries) return false;
+    builder->entries = entries;
+    builder->capacity = capacity;
+  }
+  BookEntry *entry = builder->entries + builder->count++;
+  *entry = {};
+  entry->key = key;
+  entry->move = move_bits(move);
+  entry->count = 1;
+  return true;
+}
+
+static void reset_pgn_game(BitPosition *bp, int *plies, bool *broken, bool *in_game, int *depth) {
+  parse_fen(bp, START_FEN);
+  *plies = 0;
+  *broken = false;
+  *in_game = false;
+  *depth = 0;
+}
+
+// Adds the first max_plies moves of every game in file, returns how many
+// games were read or -1 if out of memory. Tags other than FEN, comments,
+// variations and annotations are skipped. A game stops being added at a
+// move that doesn't parse, the rest of the file is still read.
+int add_pgn_games(BookBuilder *builder, FILE *file, int max_plies) {
+  BitPosition bp;
+  int plies, depth;
+  bool broken, in_game;
+  reset_pgn_game(&bp, &plies, &broken, &in_game, &depth);
+
+  int games = 0;
+  char token[256];
+  int c;
+  while ((c = getc(file)) != EOF) {
+    if (isspace(c)) continue;
+    if (c == '{') {
+      while ((c = getc(file)) != EOF && c != '}') {}
+      continue;
+    }
+    if (c == ';') {
+      while ((c = getc(file)) != EOF && c != '\n') {}
+      continue;
+    }
+    if (c == '(') {
+      depth++;
+      continue;
+    }
+    if (c == ')') {
+      if (depth) depth--;
+      continue;
+    }
+
+    if (c == '[') {
+      // Tags start the next game if a result was missing
+      int length = 0;
+      while ((c = getc(file)) != EOF && c != ']' && c != '\n') {
+        if (length < (int) sizeof(token) - 1) token[length++] = (char) c;
+      }
+      token[length] = 0;
+      if (in_game) {
+        games++;
+        reset_pgn_game(&bp, &plies, &broken, &in_game, &depth);
+      }
+      if (!strncmp(token, "FEN ", 4)) {
+        char *fen = strchr(token, '"');
+        char *end = fen ? strchr(fen + 1, '"') : NULL;
+        if (end) *end = 0;
+        broken = !end || !parse_fen(&bp, fen + 1);
+      }
+      continue;
+    }
+
+    int length = 0;
+    token[length++] = (char) c;
+    while ((c = getc(file)) != EOF && !isspace(c) && !strchr("{}();[", c)) {
+      if (length < (int) sizeof(token) - 1) token[length++] = (char) c;
+    }
+    token[length] = 0;
+    if (c != EOF && !isspace(c)) ungetc(c, file);
+    if (depth || token[0] == '$') continue;
+
+    if (!strcmp(token, "1-0") || !strcmp(token, "0-1") || !strcmp(token, "1/2-1/2") || !strcmp(token, "*")) {
+      games++;
+      reset_pgn_game(&bp, &plies, &broken, &in_game, &depth);
+      continue;
+    }
+
+    // Move numbers, 12. or 12... and sometimes 12.e4
+    const char *text = token;
+    while (isdigit(*text)) text++;
+    if (*text == '.') {
+      while (*text == '.') text++;
+    } else {
+      text = token;
+    }
+    if (!*text) continue;
+
+    in_game = true;
+    if (broken || plies >= max_plies) continue;
+    BitMove move;
+    if (!parse_san(&bp, text, &move)) {
+      broken = true;
+      continue;
+    }
+    if (!add_book_entry(builder, bp.hash, move)) return -1;
+    apply_move(&bp, move);
+    plies++;
+  }
+  if (in_game) games++;
+  return games;
+}
+
+inline bool book_entry_less(const BookEntry &a, const BookEntry &b) {
+  return a.key < b.key || (a.key == b.key && a.move < b.move);
+}
+
+// Sorts, merges the same move from the same position, and drops moves
+// played fewer than min_count times.
+bool write_book(BookBuilder *builder, const char *path, int min_count) {
+  std::sort(builder->entries, builder->entries + builder->count, book_entry_less);
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < builder->count;) {
+    BookEntry entry = builder->entries[i];
+    uint32_t total = 0;
+    for (; i < builder->count && builder->entries[i].key == entry.key &&
+           builder->entries[i].move == entry.move; i++) {
+      total += builder->entries[i].count;
+    }
+    if (total < (uint32_t) min_count) continue;
+    entry.count = (uint16_t) (total < UINT16_MAX ? total : UINT16_MAX);
+    builder->entries[count++] = entry;
+  }
+  builder->count = count;
+
+  FILE *file = fopen(path, "wb");
+  if (!file) return false;
+  BookHeader header = {};
+  memcpy(header.magic, BOOK_MAGIC, 4);
+  header.count = count;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(builder->entries, sizeof(BookEntry), count, file) == count;
+  return !fclose(file) && ok;
+}
+
+#endif
@@ -0,0 +1,65 @@
+
+#ifndef _CHESS_BOOK_H_
+#define _CHESS_BOOK_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// Opening book: the moves played from every position in the first plies
+// of a set of games, and how many times each was played. Built from PGN
+// by bookgen (see bookgen.cpp), and checked before searching so a known
+// opening position costs one binary search instead of a search.
+//
+// The file is a header then BookEntry's sorted by key then move. Keys
+// are BitPosition::hash, so a book only works with the Zobrist keys it
+// was built with. Files are mmap'd read only, like the tablebases.
+
+#define BOOK_MAGIC "CBK1"
+#define BOOK_MAX_PLIES 24 // default, positions after this many plies aren't added
+
+typedef struct {
+  char magic[4];
+  uint32_t unused;
+  uint64_t count;
+} BookHeader;
+
+typedef struct {
+  uint64_t key;
+  uint16_t move;  // move_bits
+  uint16_t count; // games that played it, saturates
+  uint32_t unused;
+} BookEntry;
+
+static_assert(sizeof(BookHeader) == 16, "BookHeader should be 16 bytes");
+static_assert(sizeof(BookEntry) == 16, "BookEntry should be 16 bytes");
+
+typedef struct {
+  // Mapped file
+  const uint8_t *data;
+  size_t size;
+  const BookEntry *entries;
+  uint64_t count;
+} OpeningBook;
+
+// Entries while a book is being built, in the order they were added
+typedef struct {
+  BookEntry *entries;
+  uint64_t count;
+  uint64_t capacity;
+} BookBuilder;
+
+void init_book(OpeningBook *book);
+bool load_book(OpeningBook *book, const char *path);
+void free_book(OpeningBook *book);
+
+int book_moves(OpeningBook *book, BitPosition *bp, BitMove *moves, int *counts, int max_moves);
+bool book_move(OpeningBook *book, BitPosition *bp, uint64_t random, BitMove *move);
+
+void init_book_builder(BookBuilder *builder);
+void free_book_builder(BookBuilder *builder);
+bool add_book_entry(BookBuilder *builder, uint64_t key, BitMove move);
+int add_pgn_games(BookBuilder *builder, FILE *file, int max_plies);
+bool write_book(BookBuilder *builder, const char *path, int min_count);
+
+#endif
@@ -0,0 +1,61 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+// Builds an opening book from PGN files, see book.h.
+//
+// Usage :
+//   bookgen <book file> <pgn file> ... [-plies <count>] [-min <count>]
+//     -plies  positions from the first this many plies of each game, default BOOK_MAX_PLIES
+//     -min    leave out moves played fewer times than this, default 1
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Usage : bookgen <book file> <pgn file> ... [-plies <count>] [-min <count>]\n");
+    return EXIT_FAILURE;
+  }
+  init_bitboards();
+  init_zobrist();
+
+  int max_plies = BOOK_MAX_PLIES;
+  int min_count = 1;
+  for (int i = 2; i + 1 < argc; i++) {
+    if (!strcmp(argv[i], "-plies"))    max_plies = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-min")) min_count = atoi(argv[++i]);
+  }
+
+  uint64_t start = read_os_timer();
+  BookBuilder builder;
+  init_book_builder(&builder);
+  int games = 0;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-plies") || !strcmp(argv[i], "-min")) {
+      i++;
+      continue;
+    }
+    FILE *file = fopen(argv[i], "r");
+    if (!file) {
+      printf("Could not open %s\n", argv[i]);
+      free_book_builder(&builder);
+      return EXIT_FAILURE;
+    }
+    int added = add_pgn_games(&builder, file, max_plies);
+    fclose(file);
+    if (added < 0) {
+      printf("Out of memory reading %s\n", argv[i]);
+      free_book_builder(&builder);
+      return EXIT_FAILURE;
+    }
+    games += added;
+  }
+
+  uint64_t moves = builder.count;
+  if (!write_book(&builder, argv[1], min_count)) {
+    printf("Could not write %s\n", argv[1]);
+    free_book_builder(&builder);
+    return EXIT_FAILURE;
+  }
+  printf("%d games, %llu moves, %llu entries, %.3f s\n", games, (unsigned long long) moves,
+         (unsigned long long) builder.count, (read_os_timer() - start) / 1000000.0);
+  free_book_builder(&builder);
+  return EXIT_SUCCESS;
+}
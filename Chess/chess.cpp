@@ -5,6 +5,14 @@
 #include <cstring>
 #include <climits>
 #include "chess.h"
+#include "history.cpp"
+#include "bitboard.cpp"
+#include "transposition.cpp"
+#include "eval.cpp"
+#include "tablebase.cpp"
+#include "book.cpp"
+#include "trace.cpp"
+#include "search.cpp"
 
 #define KNRM  "\x1B[0m"
 #define KBLK  "\x1B[30m"
@@ -25,13 +33,8 @@
 #define KBGCYN  "\x1B[46m"
 #define KBGWHT  "\x1B[47m"
 
-#define DEBUG_FILE 1
-
-FILE *output_file;
 bool dev_mode = false;
 int com_player = -1;
-int global_player = 1;
-int traversal_count = 0;
 
 // TODO factor existing code:
 inline int get_other_player(int player) {
@@ -57,12 +60,17 @@ inline PieceType get_piece(ChessBoard *cb, Position p) {
   return cb->board[p.y][p.x];
 }
 
+// Keeps cb->hash up to date for the pieces, castling rights and en
+// passant are handled in apply_move.
 inline PieceType set_piece(ChessBoard *cb, int x, int y, PieceType p) {
+  int sq = square_of(x, y);
+  cb->hash ^= zobrist_piece(cb->board[y][x], sq) ^ zobrist_piece(p, sq);
+  cb->eval += eval_piece(p, sq) - eval_piece(cb->board[y][x], sq);
   return cb->board[y][x] = p;
 }
 
 inline PieceType set_piece(ChessBoard *cb, Position pos, PieceType p) {
-  return cb->board[pos.y][pos.x] = p;
+  return set_piece(cb, pos.x, pos.y, p);
 }
 
 inline bool equal(Position p1, Position p2) {
@@ -273,6 +281,7 @@ inline bool king_move(ChessBoard *cb, Position p1, Position p2) {
         PieceType rook = get_piece(cb, 0, 0);
         if (rook & PMOVED) return false;
         if ((rook & PMASK) != ROOK) return false;
+        if (get_piece(cb, 1, 0)) return false;
 
         Position in_between = { 3, 0 };
         CheckStatus status = test_for_checks(cb, p1, in_between);
@@ -305,6 +314,7 @@ inline bool king_move(ChessBoard *cb, Position p1, Position p2) {
         PieceType rook = get_piece(cb, 0, 7);
         if (rook & PMOVED) return false;
         if ((rook & PMASK) != ROOK) return false;
+        if (get_piece(cb, 1, 7)) return false;
 
         Position in_between = { 3, 7 };
         CheckStatus status = test_for_checks(cb, p1, in_between);
@@ -428,6 +438,11 @@ PieceType get_promotion_input(int player) {
 // passant.
 void apply_move(ChessBoard *cb, Position p1, Position p2) {
   cb->static_moves++;
+  // En passant is only available for the move right after the double step
+  Position en_passant = cb->en_passant;
+  cb->en_passant = { -1, -1 };
+  if (en_passant.x >= 0) cb->hash ^= zobrist_en_passant[en_passant.x];
+  uint8_t castling = castling_rights(cb);
   if (get_piece(cb, p2) != EMPTY) cb->static_moves = 0;
 
   PieceType pt = get_piece(cb, p1);
@@ -493,7 +508,7 @@ void apply_move(ChessBoard *cb, Position p1, Position p2) {
         // first move, 2 spaces
         cb->en_passant = { p2.x, 2 };
 
-      } else if (equal(p2, cb->en_passant)) {
+      } else if (equal(p2, en_passant)) {
         // move is en_passant, need to capture
 
         set_piece(cb, p2.x, 4, EMPTY);
@@ -511,7 +526,7 @@ void apply_move(ChessBoard *cb, Position p1, Position p2) {
         // first move, 2 spaces
         cb->en_passant = { p2.x, 5 };
 
-      } else if (equal(p2, cb->en_passant)) {
+      } else if (equal(p2, en_passant)) {
         // move is en_passant, need to capture
 
         set_piece(cb, p2.x, 3, EMPTY);
@@ -523,6 +538,9 @@ void apply_move(ChessBoard *cb, Position p1, Position p2) {
       }
     }
   }
+
+  if (cb->en_passant.x >= 0) cb->hash ^= zobrist_en_passant[cb->en_passant.x];
+  cb->hash ^= zobrist_castling[castling] ^ zobrist_castling[castling_rights(cb)];
 }
 
 // Pushes a move to the stack
@@ -531,8 +549,9 @@ inline void push_move(ChessStack *stack, Position p1, Position p2) {
   // Update ChessStack:
   int size = stack->size;
   assert(size);
-  ChessFrame *current = top_frame(stack);
+  // Can move the frames, so current is found after
   ChessFrame *next    = alloc_frame(stack);
+  ChessFrame *current = next - 1;
   next->game = current->game;
   next->move = { p1, p2 };
   ChessBoard *cb = &next->game;
@@ -559,7 +578,7 @@ inline void push_move(ChessStack *stack, Position p1, Position p2) {
     }
   }
 
-  update_count(stack);
+  update_count(stack, get_other_player(p_color));
 
   // TODO move/remove this
   printf("Static moves : %d\n", cb->static_moves);
@@ -648,55 +667,42 @@ bool is_legal_move(ChessBoard *cb, Position p1, Position p2) {
   return false;
 }
 
-#if 0
-void update_threat_grid(ChessBoard *cb) {
-
-  for (int y1 = 0; y1 < 8; y1++) {
-    for (int x1 = 0; x1 < 8; x1++) {
-
-      Position p1 = { x1, y1 };
-
-      for (int y2 = 0; y2 < 8; y2++) {
-        for (int x2 = 0; x2 < 8; x2++) {
-
-          Position p2 = { x2, y2 };
-          if (is_legal_move(cb, p1, p2)) {
-            uint8_t mask = 1 << (7 - x2);
-            cb->threat_grid[y2] |= mask;
-          }
-
-        }
-      }
-    }
-  }
-}
-#endif
-
 // TODO consider renaming all this garbage...
 // Tests for checks, return the correct status
 inline CheckStatus test_for_checks(ChessBoard *cb, int acting_player) {
-  // TODO check only necessary squres relative to king
-  CheckStatus result = NO_CHECK;
-
-  for (int y = 0; y < 8; y++) {
-    for (int x = 0; x < 8; x++) {
-
-      Position p = { x, y };
-      int color = piece_color(get_piece(cb, x, y));
-
-      if (color == 2 && is_legal_move(cb, p, cb->king_1_pos)) {
-        if (acting_player == 1) return CHECK_ON_1;
-        else result = CHECK_ON_1;
-      }
+  // The attack maps answer this directly, no need to try every piece
+  BitPosition bp = to_bit_position(cb, acting_player);
+  bool check_on_1 = king_attacked(&bp, WHITE_SIDE);
+  bool check_on_2 = king_attacked(&bp, BLACK_SIDE);
+
+  if (acting_player == 1 && check_on_1) return CHECK_ON_1;
+  if (acting_player == 2 && check_on_2) return CHECK_ON_2;
+  if (check_on_1) return CHECK_ON_1;
+  if (check_on_2) return CHECK_ON_2;
+  return NO_CHECK;
+}
 
-      if (color == 1 && is_legal_move(cb, p, cb->king_2_pos)) {
-        if (acting_player == 2) return CHECK_ON_2;
-        else result = CHECK_ON_2;
-      }
-    }
+// Everything about cb after player moved, from a single conversion to
+// bitboards. Returns false if player left their own king in check,
+// otherwise sets status for the other player, who is to move.
+bool status_after_move(ChessBoard *cb, int player, CheckStatus *status) {
+  int other_player = get_other_player(player);
+  BitPosition bp = to_bit_position(cb, other_player);
+  if (king_attacked(&bp, bp.side ^ 1)) return false;
+
+  bool check = king_attacked(&bp, bp.side);
+  if (cb->static_moves >= FIFTY_MOVE_PLIES) {
+    *status = STALEMATE;
+  } else if (!has_legal_move(&bp)) {
+    if (!check)                 *status = STALEMATE;
+    else if (other_player == 1) *status = CHECKMATE_ON_1;
+    else                        *status = CHECKMATE_ON_2;
+  } else if (check) {
+    *status = other_player == 1 ? CHECK_ON_1 : CHECK_ON_2;
+  } else {
+    *status = NO_CHECK;
   }
-
-  return result;
+  return true;
 }
 
 inline void print_move(Position p1, Position p2, FILE *file) {
@@ -711,53 +717,8 @@ bool is_in_checkmate(ChessBoard *cb, int player) {
   assert(player == 1 || player == 2);
   // if player is in check, looks for checkmate
   // otherwise, looks for stalemate
-
-  // iterate through every move by piece with player color
-  int other_player = get_other_player(player);
-  assert(other_player != player);
-  assert(other_player == 1 || other_player == 2);
-
-  // TODO make these loops simpler maybe
-  // TODO test early for check by threatening piece
-
-  // Iterate through starting pos
-  for (int y1 = 0; y1 < 8; y1++) {
-    for (int x1 = 0; x1 < 8; x1++) {
-      // start pos must be player's color
-      Position p1 = { x1, y1 };
-      if (piece_color(get_piece(cb, p1)) != player) continue;
-
-      // Iterate through target pos
-      for (int y2 = 0; y2 < 8; y2++) {
-        for (int x2 = 0; x2 < 8; x2++) {
-          Position p2 = { x2, y2 };
-          if (is_legal_move(cb, p1, p2)) {
-
-            // apply this move to a copy
-            ChessBoard temp = *cb;
-            apply_move(&temp, p1, p2);
-
-            CheckStatus status = test_for_checks(&temp, player);
-
-            if ((player == 1 && status == CHECK_ON_1) || 
-                (player == 2 && status == CHECK_ON_2)) {
-              // Still in check, this move fails
-            } else {
-              // They are no longer in check
-              // this is not checkmate or stalemate
-              return false;
-            } 
-
-          }
-        }
-      }
-
-    }
-  }
-
-  // We have tried all possible moves for this player and none were valid
-  // player is in checkmate or stalemate
-  return true;
+  BitPosition bp = to_bit_position(cb, player);
+  return !has_legal_move(&bp);
 }
 
 // Creates a temp, tests for CHECKS ONLY
@@ -783,18 +744,12 @@ CheckStatus update_check_status(ChessBoard *cb, Position p1, Position p2) {
   apply_move(&temp, p1, p2);
   int current_color = piece_color(get_piece(&temp, p2));
   assert(current_color != 0);
-  int other_color = get_other_player(current_color);
-
-  if (temp.static_moves == 50) return STALEMATE;
 
-  CheckStatus result = test_for_checks(&temp, current_color);
- 
-  if (is_in_checkmate(&temp, other_color)) {
-    if (result == CHECK_ON_1)      result = CHECKMATE_ON_1;
-    else if (result == CHECK_ON_2) result = CHECKMATE_ON_2;
-    else                           result = STALEMATE;
+  CheckStatus result;
+  if (!status_after_move(&temp, current_color, &result)) {
+    // Callers only pass legal moves
+    result = current_color == 1 ? CHECK_ON_1 : CHECK_ON_2;
   }
-
   return result;
 }
 
@@ -860,7 +815,7 @@ void handle_4_chars(ChessStack *stack, char *line) {
 
   ChessBoard *cb = &top_frame(stack)->game;
 
-  if (global_player == 0) { 
+  if (stack->player == 0) { 
     printf("The game has ended. Use res to restart.\n");
     return;
   }
@@ -891,7 +846,7 @@ void handle_4_chars(ChessStack *stack, char *line) {
   }
 
   int p1_color = piece_color(get_piece(cb, p1));
-  if (p1_color != global_player && !dev_mode) {
+  if (p1_color != stack->player && !dev_mode) {
     if (p1_color == 1) printf("Illegal Move, it's black's turn : %s\n", line);
     else               printf("Illegal Move, it's white's turn : %s\n", line);
     return;
@@ -929,24 +884,27 @@ void handle_4_chars(ChessStack *stack, char *line) {
   
   // Game is over:
   if (check == CHECKMATE_ON_1 || check == CHECKMATE_ON_2 || check == STALEMATE) {
-    global_player = 0;
+    stack->player = 0;
   } else {
-    assert(global_player);
-    global_player = get_other_player(global_player);
+    assert(stack->player);
+    stack->player = get_other_player(stack->player);
   }
   
   return;
 }
 
-void handle_3_chars(ChessBoard *cb, char *line) {
+void handle_3_chars(ChessStack *stack, char *line) {
+  ChessBoard *cb = &top_frame(stack)->game;
   if (!strcmp(line, "dev\n")) {
     dev_mode = !dev_mode;
     return;
   } 
   if (!strcmp(line, "res\n")) {
     ChessBoard temp;
+    init_hash(&temp);
+    init_eval(&temp);
     *cb = temp;
-    global_player = 1;
+    stack->player = 1;
     print_board(cb->board);
     return;
   } 
@@ -968,6 +926,8 @@ void handle_3_chars(ChessBoard *cb, char *line) {
     pos.y = line[2] - '1';
 
     cb->board[pos.y][pos.x] = EMPTY;
+    init_hash(cb);
+    init_eval(cb);
   }
   printf("Not valid : %s\n", line);
 } 
@@ -996,7 +956,18 @@ void handle_2_chars(ChessBoard *cb, char *line) {
 
 // AI STUFF STARTS HERE
 
-#define evaluate better_eval
+#define evaluate incremental_eval
+
+// O(1), cb->eval is kept up to date by set_piece. The check status still
+// has to be looked at for mates.
+int incremental_eval(ChessBoard *cb) {
+  switch (cb->check_status) {
+    case CHECKMATE_ON_1 : return INT_MIN;
+    case CHECKMATE_ON_2 : return INT_MAX;
+    case STALEMATE      : return 0;
+    default             : return cb->eval;
+  }
+}
 
 int simple_eval(ChessBoard *cb) {
 
@@ -1155,10 +1126,10 @@ void generate_children(int node_idx, ComAllocator *allocator, int player) {
   assert(node->children > node_idx);
   node->num_children = 0;
 
-  // out of memory, might want to handle this in parent:
+  // out of memory, get_best_move reports it once the search is done
   if (allocator->num_nodes == MAX_NODES) {
-    printf("Com Player Error: out of memory\n");
-    return; 
+    allocator->out_of_nodes = true;
+    return;
   }
 
   ChessBoard *cb = allocator->games + node_idx;
@@ -1187,30 +1158,12 @@ void generate_children(int node_idx, ComAllocator *allocator, int player) {
             *game = *cb;
             apply_move(game, p1, p2);
 
-            CheckStatus status = test_for_checks(game, player);
-
-
-            if ((player == 1 && status == CHECK_ON_1) || 
-                (player == 2 && status == CHECK_ON_2)) {
+            CheckStatus status;
+            if (!status_after_move(game, player, &status)) {
               // In check, this move fails
-            
+
             } else {
               // This move is valid
-
-              // Copy and paste from update_check_status:
-
-              if (game->static_moves == 50) {
-                status = STALEMATE;
-              } else {
-                assert(player);
-                if (is_in_checkmate(game, get_other_player(player))) {
-                  if (status == CHECK_ON_1)      status = CHECKMATE_ON_1;
-                  else if (status == CHECK_ON_2) status = CHECKMATE_ON_2;
-                  else                           status = STALEMATE;
-                }
-              }
-
-
               game->check_status = status;
               child->value = evaluate(game);
               node->value = DEBUG_VAL; // TODO this may not be needed
@@ -1225,7 +1178,7 @@ void generate_children(int node_idx, ComAllocator *allocator, int player) {
               assert(node->num_children <= 256);
               allocator->num_nodes++;
               if (allocator->num_nodes == MAX_NODES) {
-                printf("Com Player Error: out of memory\n");
+                allocator->out_of_nodes = true;
                 return;
               }
             }
@@ -1335,9 +1288,35 @@ inline void sort_children(ComAllocator *allocator, int node_idx) {
 #endif
 }
 
+// Moves the child that plays move to where alpha_beta will look first,
+// keeping the rest of the order as it was.
+void search_first(ComAllocator *allocator, int node_idx, uint16_t move, int player) {
+  ChessNode *node     = allocator->nodes + node_idx;
+  ChessNode *children = allocator->nodes + node->children;
+  int       *order    = allocator->order + node->children;
+  int len = node->num_children;
+
+  for (int i = 0; i < len; i++) {
+    ChessMove m = children[order[i]].move;
+    if (table_move(square_of(m.start.x, m.start.y), square_of(m.dest.x, m.dest.y)) != move) continue;
+
+    int found = order[i];
+    if (player == 1) {
+      // Maximizing searches from the front
+      for (int j = i; j > 0; j--) order[j] = order[j - 1];
+      order[0] = found;
+    } else {
+      // Minimizing searches from the back
+      for (int j = i; j < len - 1; j++) order[j] = order[j + 1];
+      order[len - 1] = found;
+    }
+    return;
+  }
+}
+
 // TODO check to see if this is actually generating moves properly
 int alpha_beta(ComAllocator *allocator, int node_idx, int depth, int alpha, int beta, int player) {
-  traversal_count++;
+  allocator->traversal_count++;
   ChessNode *node = allocator->nodes + node_idx;
   ChessBoard *game = allocator->games + node_idx;
 
@@ -1350,6 +1329,29 @@ int alpha_beta(ComAllocator *allocator, int node_idx, int depth, int alpha, int
     return v;
   }
 
+#if USE_TRANSPOSITION_TABLE
+  // The board doesn't know whose turn it is, so the key has to
+  uint64_t key = game->hash ^ (player == 2 ? zobrist_side : 0);
+  uint16_t table_best = NO_TABLE_MOVE;
+  TableEntry entry;
+  if (probe(&allocator->table, key, &entry)) {
+    table_best = entry.move;
+
+    // The root always searches so get_best_move has children to choose from
+    if (node_idx != 0 && entry.depth >= depth) {
+      int score = entry.score;
+      if (entry.bound == BOUND_EXACT ||
+          (entry.bound == BOUND_LOWER && score >= beta) ||
+          (entry.bound == BOUND_UPPER && score <= alpha)) {
+        node->value = score;
+        return score;
+      }
+    }
+  }
+  int original_alpha = alpha;
+  int original_beta  = beta;
+#endif
+
   if (depth == 1 || node->num_children == -1) {
     generate_children(node_idx, allocator, player);
   }
@@ -1364,36 +1366,56 @@ int alpha_beta(ComAllocator *allocator, int node_idx, int depth, int alpha, int
     return v;
   }
 
+#if USE_TRANSPOSITION_TABLE
+  if (table_best != NO_TABLE_MOVE) search_first(allocator, node_idx, table_best, player);
+#endif
+
   int *sorted_order = allocator->order + node->children;
   //assert(is_sorted(allocator->nodes + node->children, sorted_order, node->num_children));
 
+  int v;
+  int best_idx = -1;
+
   if (player == 1) {
     // Maximizing
 
-    int v = INT_MIN;
+    v = INT_MIN;
     for (int i = 0; i < node->num_children; i++) {
       int sorted_idx = sorted_order[i];
-      v = max(v, alpha_beta(allocator, node->children + sorted_idx, depth - 1, alpha, beta, 2));
+      int child_v = alpha_beta(allocator, node->children + sorted_idx, depth - 1, alpha, beta, 2);
+      if (best_idx < 0 || child_v > v) best_idx = sorted_idx;
+      v = max(v, child_v);
       alpha = max(alpha, v);
       if (beta <= alpha) break;
     }
-    node->value = v;
-    return v;
 
   } else {
     // Minimizing
     assert(player == 2);
 
-    int v = INT_MAX;
+    v = INT_MAX;
     for (int i = 0; i < node->num_children; i++) {
       int sorted_idx = sorted_order[node->num_children - 1 - i];
-      v = min(v, alpha_beta(allocator, node->children + sorted_idx, depth - 1, alpha, beta, 1));
+      int child_v = alpha_beta(allocator, node->children + sorted_idx, depth - 1, alpha, beta, 1);
+      if (best_idx < 0 || child_v < v) best_idx = sorted_idx;
+      v = min(v, child_v);
       beta = min(beta, v);
       if (beta <= alpha) break;
     }
-    node->value = v;
-    return v;
   }
+  node->value = v;
+
+#if USE_TRANSPOSITION_TABLE
+  int bound = BOUND_EXACT;
+  if (v <= original_alpha)     bound = BOUND_UPPER;
+  else if (v >= original_beta) bound = BOUND_LOWER;
+
+  ChessMove best = allocator->nodes[node->children + best_idx].move;
+  store(&allocator->table, key, depth, bound, v,
+        table_move(square_of(best.start.x, best.start.y), square_of(best.dest.x, best.dest.y)));
+#endif
+
+  return v;
 }
 
 void print_int_array(int *arr, int len, FILE *file) {
@@ -1409,24 +1431,24 @@ inline void print_int_array(int *arr, int len) {
   print_int_array(arr, len, stdout);
 }
 
-void print_move_tree(ComAllocator *allocator, int node_idx, int current_player, int depth) {
+void print_move_tree(ComAllocator *allocator, int node_idx, int current_player, int depth, FILE *file) {
   ChessNode *root = allocator->nodes + node_idx;
   ChessBoard *game = allocator->games + node_idx;
 
-  fprintf(output_file, " ------ Printing Node %d at depth %d -------- \n", node_idx, depth);
-  fprintf(output_file, "Current player : %d\n", current_player);
-  fprintf(output_file, "Move was : "); print_move(root->move.start, root->move.dest, output_file);
-  print_check_status(game->check_status, output_file);
-  fprintf(output_file, "Num children : %d\n", root->num_children);
-  fprintf(output_file, "Sort order : "); print_int_array(allocator->order + root->children, root->num_children, output_file);
-  fprintf(output_file, "Value : %d\n", root->value);
+  fprintf(file, " ------ Printing Node %d at depth %d -------- \n", node_idx, depth);
+  fprintf(file, "Current player : %d\n", current_player);
+  fprintf(file, "Move was : "); print_move(root->move.start, root->move.dest, file);
+  print_check_status(game->check_status, file);
+  fprintf(file, "Num children : %d\n", root->num_children);
+  fprintf(file, "Sort order : "); print_int_array(allocator->order + root->children, root->num_children, file);
+  fprintf(file, "Value : %d\n", root->value);
   // TODO check that children values are sane
   
-  print_board(game->board, output_file);
-  fprintf(output_file, "\n\n");
+  print_board(game->board, file);
+  fprintf(file, "\n\n");
 
   for (int i = 0; i < root->num_children; i++) {
-    print_move_tree(allocator, root->children + i, get_other_player(current_player), depth + 1);
+    print_move_tree(allocator, root->children + i, get_other_player(current_player), depth + 1, file);
   }
 }
 
@@ -1436,6 +1458,11 @@ ChessMove get_best_move(ComAllocator *allocator, int current_player) {
 
   ChessNode *root = allocator->nodes;
 
+#if USE_TRANSPOSITION_TABLE
+  new_search(&allocator->table);
+#endif
+  allocator->traversal_count = 0;
+  allocator->out_of_nodes = false;
   
   for (int i = 1; i <= MAX_DEPTH; i++) {
     alpha_beta(allocator, 0, i, INT_MIN, INT_MAX, current_player);
@@ -1479,19 +1506,33 @@ ChessMove get_best_move(ComAllocator *allocator, int current_player) {
   best_val  = sorted_child_val;
 
 
-  printf("Total traversed : %d\n", traversal_count);
+  printf("Total traversed : %llu\n", (unsigned long long) allocator->traversal_count);
   printf("Value : %d\n", best_val);
 
-#if DEBUG_FILE
-  fprintf(output_file, "\n\nNum nodes was %d.\n", allocator->num_nodes);
-  // print_move_tree(allocator, 0, current_player, 0);
-  print_predicted_boards(allocator, output_file);
-  fflush(output_file);
-#endif
+  if (allocator->out_of_nodes) printf("Com Player Error: out of nodes, the search was cut short\n");
 
   return best_move;
 }
 
+// Same as above, but with the make/unmake search, so there is no tree to set up
+ChessMove get_best_move(SearchThreads *threads, SearchLimits limits, ChessBoard *cb, int current_player) {
+  BitPosition bp = to_bit_position(cb, current_player);
+  BitMove move = parallel_search(threads, &bp, limits);
+  SearchState *state = threads->states;
+
+  // Scores are for the side to move, Value is printed like the tree search's
+  int value = current_player == 1 ? state->best_score : -state->best_score;
+  uint64_t elapsed = threads->elapsed_us ? threads->elapsed_us : 1;
+  printf("Total traversed : %llu\n", (unsigned long long) threads->nodes);
+  printf("Nodes per second : %llu (%d threads)\n",
+         (unsigned long long) (threads->nodes * 1000000 / elapsed), threads->num_threads);
+  printf("Depth : %d\n", state->completed_depth);
+  printf("Value : %d\n", value);
+
+  if (IS_NULL_MOVE(move)) return {{ -1, -1 }, { -1, -1 }};
+  return {{ square_x(move.from), square_y(move.from) }, { square_x(move.to), square_y(move.to) }};
+}
+
 
 // Only compares piece types and colors
 bool equal(ChessBoard *cb1, ChessBoard *cb2) {
@@ -1507,11 +1548,34 @@ bool equal(ChessBoard *cb1, ChessBoard *cb2) {
   return true;
 }
 
+bool init_stack(ChessStack *stack, ChessBoard *start) {
+  stack->capacity = 256;
+  stack->frames = (ChessFrame *) malloc(stack->capacity * sizeof(ChessFrame));
+  if (!stack->frames || !init_history(&stack->history, stack->capacity)) return false;
+  stack->frames[0] = ChessFrame();
+  stack->frames[0].game = *start;
+  stack->size = 1;
+  stack->player = 1;
+  update_count(stack, 1);
+  return true;
+}
+
+void free_stack(ChessStack *stack) {
+  free(stack->frames);
+  free_history(&stack->history);
+  stack->frames = NULL;
+  stack->size = stack->capacity = 0;
+}
+
 inline ChessFrame *alloc_frame(ChessStack *stack) {
+  if (stack->size == stack->capacity) {
+    stack->capacity *= 2;
+    stack->frames = (ChessFrame *) realloc(stack->frames, stack->capacity * sizeof(ChessFrame));
+    assert(stack->frames);
+  }
   stack->size++;
   auto top = top_frame(stack);
   top->count = 1;
-  assert(stack->size < NUM_FRAMES);
   return top;
 }
 
@@ -1519,52 +1583,15 @@ inline ChessFrame *top_frame(ChessStack *stack) {
   return stack->frames + stack->size - 1;
 }
 
-// TODO it is not correctly updating the board count for black
-void update_count(ChessStack *stack) {
+// Adds the top frame to the history, player is the one to move in it.
+// Positions only repeat with the same player to move.
+void update_count(ChessStack *stack, int player) {
   ChessFrame *latest = top_frame(stack);
-  ChessFrame *current = latest - 2; // first current should be -4
-
-  // TODO eventually remove debug code
-  int loop_count = 0;
-  // TODO maybe switch to using static moves
-  while (true) {
-    loop_count++;
-    assert(loop_count <= 25);
-
-    // TODO possibly need to handle promotion in the future
-    current = current - 2; // skip other players turn
-
-    // We hit the end of the stack:
-    if (current < stack->frames) break;
-
-    if (current != stack->frames) {
-      // break if a pawn moved or a piece was taken
-      Position dest = current->move.dest;
-      PieceType moved_piece = get_piece(&current->game, dest) & PMASK;
-      if (moved_piece == PAWN) break;
-
-      ChessFrame *prev = current - 1;
-      // TODO make sure this is correct, may be old/new value for en_passant
-      if (equal(dest, prev->game.en_passant)) break;
-
-      PieceType taken_piece = get_piece(&prev->game, dest);
-      if (taken_piece != EMPTY) break;  
-    }
-
-    // TODO check the last moved piece first
-    // TODO maybe make further improvments
-
-    // TODO check that this doesn't miss anything or compare incorrectly
-    if (equal(&current->game, &latest->game)) {
-      latest->count = current->count + 1;
-
-      printf("loop_count : %d\n", loop_count);
-      printf("board count : %d\n", latest->count);
-      return;
-    }
-  }
-  latest->count = 1;
-  printf("loop_count : %d\n", loop_count);
+  uint64_t key = latest->game.hash ^ (player == 2 ? zobrist_side : 0);
+  bool pushed = push_position(&stack->history, key);
+  assert(pushed);
+  (void) pushed;
+  latest->count = repetitions(&stack->history, key);
 }
 
 
@@ -1585,7 +1612,8 @@ MalformedTreeError tree_is_malformed(ComAllocator *allocator) {
       if (value != INT_MAX && value != INT_MIN && value != 0) return NO_CHILDREN_FOR_NON_MATE;
       continue;
     } else if (num_children == -1) {
-      if (value != evaluate(allocator->games + i)) return INCORRECT_TERMINAL_VALUE;
+      // Nodes cut off by the transposition table keep the table's value
+      if (!USE_TRANSPOSITION_TABLE && value != evaluate(allocator->games + i)) return INCORRECT_TERMINAL_VALUE;
       continue;
     } else if (num_children < -1) {
       return MALFORMED_NUM_CHILDREN;
@@ -1740,11 +1768,21 @@ void print_predicted_boards(ComAllocator *allocator, FILE *file) {
   }
 }
 
+// FEN with the side to move, so positions can be pulled out of the log
+void print_fen(ChessBoard *cb, int player, int move_number, FILE *file) {
+  BitPosition bp = to_bit_position(cb, player);
+  bp.move_number = move_number;
+  char fen[MAX_FEN_LENGTH];
+  position_to_fen(&bp, fen);
+  fprintf(file, "FEN : %s\n", fen);
+}
+
 // TODO flesh this out more?
 void print_stack(ChessStack *stack, FILE *file) {
   bool white_player = true;
   fprintf(file, "%d board stack :\n", stack->size);
   print_board(stack->frames[0].game.board, file);
+  print_fen(&stack->frames[0].game, 1, 1, file);
   for (int i = 1; i < stack->size; i++) {
     ChessFrame *current = stack->frames + i;
 
@@ -1758,6 +1796,7 @@ void print_stack(ChessStack *stack, FILE *file) {
     fprintf(file, "\n");
     print_board(current->game.board, file);
     white_player = !white_player;
+    print_fen(&current->game, white_player ? 1 : 2, i / 2 + 1, file);
   }
 }
 
@@ -1784,25 +1823,107 @@ void print_stack(ChessStack *stack, FILE *file) {
 // * alpha-beta pruning and simple evaluation function
 //
 
-int main() {
+#ifndef CHESS_NO_MAIN
+// Usage : chess [-threads <count>] [-depth <plies>] [-nodes <count>] [-movetime <ms>]
+//               [-eval <weights file>] [-tb <tablebase directory>] [-book <book file>]
+//               [-trace <file>]
+// -trace needs a build with SEARCH_TRACE, see trace.h.
+// The limits are for com's search, with more than one whichever runs out first.
+int main(int argc, char **argv) {
+  int num_threads = SEARCH_THREADS;
+  SearchLimits limits = { SEARCH_DEPTH, 0, 0 };
+  const char *eval_file = EVAL_WEIGHTS_FILE;
+  const char *tb_directory = NULL;
+  const char *book_file = NULL;
+  const char *trace_file = NULL;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (!strcmp(argv[i], "-threads"))       num_threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-eval"))     eval_file = argv[++i];
+    else if (!strcmp(argv[i], "-tb"))       tb_directory = argv[++i];
+    else if (!strcmp(argv[i], "-book"))     book_file = argv[++i];
+    else if (!strcmp(argv[i], "-trace"))    trace_file = argv[++i];
+    else if (!strcmp(argv[i], "-depth"))    limits.depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nodes"))    limits.nodes = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "-movetime")) limits.time_us = strtoull(argv[++i], NULL, 10) * 1000;
+  }
 
-#if DEBUG_FILE
-  output_file = fopen("predicted_boards.txt", "w");
-#endif
   FILE *stack_file = fopen("game_log.txt", "w");
 
   // TODO this stuff should maybe not be done if there is no computer
+#if USE_TREE_SEARCH
   ComAllocator *com_allocator = (ComAllocator *) malloc(sizeof(ComAllocator));
   // TODO remove this when done debugging:
   for (int i = 0; i < MAX_NODES; i++) {
     com_allocator->nodes[i].value = DEBUG_VAL;
   }
+  com_allocator->traversal_count = 0;
+  TranspositionTable *table = &com_allocator->table;
+  (void) num_threads; // the tree search is single threaded, with MAX_DEPTH
+  (void) limits;
+  (void) tb_directory;
+  (void) book_file;
+  (void) trace_file;
+#else
+  TranspositionTable table_memory;
+  TranspositionTable *table = &table_memory;
+  SearchThreads search_threads;
+  if (!init_search_threads(&search_threads, table, num_threads)) {
+    printf("Com Player Error: could not allocate search threads\n");
+    return 1;
+  }
+  Tablebases tablebases;
+  init_tablebases(&tablebases);
+  if (tb_directory) {
+    printf("Loaded %d tablebases from %s\n", load_tablebases(&tablebases, tb_directory), tb_directory);
+    search_threads.tablebases = &tablebases;
+  }
+  OpeningBook book;
+  init_book(&book);
+  if (book_file) {
+    if (load_book(&book, book_file)) search_threads.book = &book;
+    else printf("Could not load the opening book %s\n", book_file);
+  }
+  SearchTrace *trace = NULL;
+  if (trace_file) {
+#if SEARCH_TRACE
+    trace = (SearchTrace *) malloc(sizeof(SearchTrace));
+    if (trace && open_trace(trace, trace_file)) {
+      search_threads.trace = trace;
+    } else {
+      printf("Could not open the trace file %s\n", trace_file);
+    }
+#else
+    printf("Tracing isn't compiled in, build with -DSEARCH_TRACE=1\n");
+#endif
+  }
+#endif
+
+  // Before any boards are made, see eval.h
+  EvalWeights weights = eval_weights;
+  if (!load_eval_weights(&weights, eval_file)) {
+    printf("Could not load eval weights from %s, using material only\n", eval_file);
+  }
+  set_eval_weights(&weights);
+
+  init_bitboards();
+  init_zobrist();
+  if (!init_table(table, DEFAULT_TABLE_MB)) {
+    printf("Com Player Error: could not allocate transposition table\n");
+    return 1;
+  }
 
   ChessBoard start;
-  ChessStack *stack = (ChessStack *) malloc(sizeof(ChessStack));
-  stack->frames[0].game = start;
-  stack->size = 1;
+  init_hash(&start);
+  init_eval(&start);
+  ChessStack *stack = new ChessStack();
+  if (!init_stack(stack, &start)) {
+    printf("Could not allocate the game stack\n");
+    return 1;
+  }
   ChessBoard *cb = &top_frame(stack)->game;
+#if !USE_TREE_SEARCH
+  search_threads.game = &stack->history;
+#endif
 
   print_board(cb->board);
 
@@ -1810,13 +1931,22 @@ int main() {
 
     // TODO probably do this elsewhere
     ChessBoard *cb = &top_frame(stack)->game;
+    if (top_frame(stack)->count >= 3) {
+      printf("Draw by threefold repetition.\n");
+      break;
+    }
+    if (cb->static_moves >= FIFTY_MOVE_PLIES) {
+      printf("Draw by the fifty move rule.\n");
+      break;
+    }
     int current_val = evaluate(cb);
     printf("Current value : %d\n", current_val);
 
     char line[6];
 
-    if (global_player == com_player) {
-      assert(global_player);
+    if (stack->player == com_player) {
+      assert(stack->player);
+#if USE_TREE_SEARCH
       // update allocator :
       com_allocator->games[0] = *cb;
       com_allocator->nodes[0].num_children = 0;
@@ -1826,7 +1956,10 @@ int main() {
 
       // have ai pick move:
 
-      ChessMove move = get_best_move(com_allocator, global_player);
+      ChessMove move = get_best_move(com_allocator, stack->player);
+#else
+      ChessMove move = get_best_move(&search_threads, limits, cb, stack->player);
+#endif
       if (move.start.x == -1) {
         printf("No legal moves found.\n");
         break;
@@ -1842,8 +1975,8 @@ int main() {
       cb = &top_frame(stack)->game;
 
       // switch current player
-      global_player = get_other_player(global_player);
-      assert(global_player != com_player);
+      stack->player = get_other_player(stack->player);
+      assert(stack->player != com_player);
       print_move(move.start, move.dest);
       print_board(cb->board);
       print_check_status(cb->check_status);
@@ -1860,7 +1993,7 @@ int main() {
         case 2 :
           handle_2_chars(cb, line); break;
         case 3 :
-          handle_3_chars(cb, line); break;
+          handle_3_chars(stack, line); break;
         case 4 :
           handle_4_chars(stack, line); 
           break;
@@ -1869,9 +2002,17 @@ int main() {
     }
   }
 
+#if !USE_TREE_SEARCH
+  if (trace) {
+    close_trace(trace);
+    free(trace);
+  }
+#endif
   print_stack(stack, stack_file);
+  free_stack(stack);
+  delete stack;
   // TODO close files?
   return 0;
 }
-
+#endif // CHESS_NO_MAIN
 
@@ -1,3 +1,5 @@
+#include <cstdint>
+#include "history.h"
 
 typedef enum : int8_t {
   EMPTY  = 0,
@@ -37,10 +39,6 @@ inline PieceType& operator&= (PieceType &_a, PieceType _b) {
 // used for rooks/king:
 #define PMOVED  ((PieceType) 0x40)
 
-// TODO use these somehow:
-#define PTHREAT ((PieceType) 0x20)
-#define PGUARD  ((PieceType) 0x10)
-
 // masks to type and color
 #define FULL_MASK (PMASK | PBLACK)
 
@@ -96,7 +94,6 @@ typedef struct {
 // Might not need en_passant if we store previous moves
 // Make check_status smaller
 // *Make PieceType into just 7 values with sign bit == color
-// Add flags to board for threat grid and "already moved"
 // Make static moves smaller
 typedef struct {
   // int current_player = 1; // TODO maybe add this as part of status
@@ -105,6 +102,8 @@ typedef struct {
   Position en_passant = { -1, -1 };
   CheckStatus check_status = NO_CHECK;
   int static_moves = 0;
+  uint64_t hash = 0; // Zobrist hash, see init_hash
+  int eval = 0;      // material and piece-square sum, see init_eval
   PieceType board[8][8] = {
     back_row(PWHITE),
     pawn_row(PWHITE),
@@ -115,7 +114,6 @@ typedef struct {
     pawn_row(PBLACK),
     back_row(PBLACK)
   };
-  // uint8_t threat_grid[8];
 } ChessBoard;
 
 
@@ -133,25 +131,28 @@ inline PieceType set_piece(ChessBoard *cb, Position pos, PieceType p);
 
 
 typedef struct {
-  int count = 0;
+  int count = 0; // times this position has been reached, see update_count
   ChessMove  move = {{-1,-1}, {-1,-1}};
   ChessBoard game;
 } ChessFrame;
 
-#define NUM_FRAMES 6000
-
-// TODO adjust memory
+// Grows as the game goes on
 typedef struct {
   int size = 0;
-  ChessFrame frames[NUM_FRAMES];
+  int capacity = 0;
+  ChessFrame *frames = NULL;
+  PositionHistory history; // one key per frame
+  int player = 1;          // to move, 0 once the game is over
 } ChessStack;
 
 bool equal(ChessBoard *f1, ChessBoard *f2);
 
+bool init_stack(ChessStack *stack, ChessBoard *start);
+void free_stack(ChessStack *stack);
 inline ChessFrame *alloc_frame(ChessStack *stack);
 inline ChessFrame *top_frame(ChessStack *stack);
 
-void update_count(ChessStack *stack);
+void update_count(ChessStack *stack, int player);
 
 
 
@@ -188,6 +189,7 @@ inline CheckStatus test_for_checks(ChessBoard *cb, int acting_player);
 inline CheckStatus test_for_checks(ChessBoard *cb, Position p1, Position p2);
 
 bool is_in_checkmate(ChessBoard *cb, int player);
+bool status_after_move(ChessBoard *cb, int player, CheckStatus *status);
 
 CheckStatus update_check_status(ChessBoard *cb, Position p1, Position p2);
 
@@ -224,6 +226,14 @@ int simple_eval(ChessBoard *cb);
 int better_eval(ChessBoard *cb);
 
 
+#include "bitboard.h"
+#include "transposition.h"
+#include "eval.h"
+#include "tablebase.h"
+#include "book.h"
+#include "trace.h"
+#include "search.h"
+
 // TODO think a bit harder about memory
 // NOTE: game is associated by index
 
@@ -237,13 +247,28 @@ typedef struct {
 } ChessNode;
 
 #define MAX_NODES (65536*128*2)
+#ifndef MAX_DEPTH
 #define MAX_DEPTH 6
+#endif
+
+#ifndef USE_TRANSPOSITION_TABLE
+#define USE_TRANSPOSITION_TABLE 1
+#endif
+
+// 1 to have com use the ComAllocator node tree, 0 for the make/unmake
+// search in search.cpp which doesn't need the MAX_NODES arrays.
+#ifndef USE_TREE_SEARCH
+#define USE_TREE_SEARCH 0
+#endif
 
 typedef struct {
   ChessNode  nodes[MAX_NODES];
   ChessBoard games[MAX_NODES];
   int        order[MAX_NODES];
   int num_nodes;
+  TranspositionTable table;
+  uint64_t traversal_count; // nodes visited by the last get_best_move
+  bool out_of_nodes;        // generate_children hit MAX_NODES during the last get_best_move
 } ComAllocator;
 
 inline int max(int a, int b) {
@@ -273,10 +298,12 @@ bool is_heap(ChessNode *children, int *order, int idx, int len);
  
 inline void sort_children(ComAllocator *allocator, int node_idx);
 
+void search_first(ComAllocator *allocator, int node_idx, uint16_t move, int player);
+
 int alpha_beta(ComAllocator *allocator, int node_idx, int depth, int alpha, int beta, int player);
 
 
-void print_move_tree(ComAllocator *allocator, int node_idx, int current_player, int depth);
+void print_move_tree(ComAllocator *allocator, int node_idx, int current_player, int depth, FILE *file);
 void print_predicted_boards(ComAllocator *allocator, FILE *file);
 
 typedef enum {
@@ -295,6 +322,7 @@ MalformedTreeError tree_is_malformed(ComAllocator *allocator);
 void print_error(MalformedTreeError error);
 
 ChessMove get_best_move(ComAllocator *allocator, int current_player);
+ChessMove get_best_move(SearchThreads *threads, SearchLimits limits, ChessBoard *cb, int current_player);
 
 
 
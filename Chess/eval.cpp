@@ -0,0 +1,130 @@
+
+#ifndef _CHESS_EVAL_CPP_
+#define _CHESS_EVAL_CPP_
+
+#include "eval.h"
+
+// Material only, indexed by PieceType
+EvalWeights eval_weights = {{ 0, 100, 500, 330, 320, 0, 900 }};
+
+EvalTable default_eval;
+
+static const char *eval_piece_names[7] = {
+  NULL, "pawn", "rook", "bishop", "knight", "king", "queen"
+};
+
+static PieceType eval_piece_type(const char *name) {
+  for (int type = PAWN; type <= QUEEN; type++) {
+    if (!strcmp(name, eval_piece_names[type])) return (PieceType) type;
+  }
+  return EMPTY;
+}
+
+// Reads the next number or keyword, skipping # comments
+static bool eval_token(FILE *file, char token[64]) {
+  while (true) {
+    if (fscanf(file, "%63s", token) != 1) return false;
+    if (token[0] != '#') return true;
+    if (fscanf(file, "%*[^\n]") < 0) return false;
+  }
+}
+
+// Leaves weights alone if the file can't be read or is malformed
+bool load_eval_weights(EvalWeights *weights, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) return false;
+
+  EvalWeights result = *weights;
+  bool ok = true;
+  char token[64];
+  while (ok && eval_token(file, token)) {
+    bool is_value = !strcmp(token, "value");
+    if (!is_value && strcmp(token, "table")) {
+      ok = false;
+      break;
+    }
+
+    PieceType type = eval_token(file, token) ? eval_piece_type(token) : EMPTY;
+    if (type == EMPTY) {
+      ok = false;
+      break;
+    }
+
+    if (is_value) {
+      ok = eval_token(file, token) && sscanf(token, "%d", &result.values[type]) == 1;
+      continue;
+    }
+
+    // Rank 8 first, like the board is printed
+    for (int i = 0; ok && i < 64; i++) {
+      int sq = square_of(i % 8, 7 - i / 8);
+      ok = eval_token(file, token) && sscanf(token, "%d", &result.tables[type][sq]) == 1;
+    }
+  }
+  fclose(file);
+
+  if (ok) *weights = result;
+  return ok;
+}
+
+// Black uses the tables mirrored top to bottom
+void build_eval_table(EvalTable *table, EvalWeights *weights) {
+  memset(table, 0, sizeof(EvalTable));
+  for (int type = PAWN; type <= QUEEN; type++) {
+    for (int sq = 0; sq < 64; sq++) {
+      table->pieces[WHITE_SIDE][type][sq] = weights->values[type] + weights->tables[type][sq];
+      table->pieces[BLACK_SIDE][type][sq] = -weights->values[type] - weights->tables[type][sq ^ 56];
+    }
+  }
+}
+
+void set_eval_weights(EvalWeights *weights) {
+  eval_weights = *weights;
+  build_eval_table(&default_eval, weights);
+}
+
+// White positive
+inline int eval_piece(const EvalTable *table, PieceType p, int sq) {
+  p &= FULL_MASK;
+  return table->pieces[side_of(p)][p & PMASK][sq];
+}
+
+inline int eval_piece(PieceType p, int sq) {
+  return eval_piece(&default_eval, p, sq);
+}
+
+// Full recompute, set_piece and put_piece keep the sum up to date after this.
+int compute_eval(ChessBoard *cb) {
+  int result = 0;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      result += eval_piece(cb->board[y][x], square_of(x, y));
+    }
+  }
+  return result;
+}
+
+int compute_eval(BitPosition *bp) {
+  int result = 0;
+  for (int sq = 0; sq < 64; sq++) result += eval_piece(bp->eval_table, bp->squares[sq], sq);
+  return result;
+}
+
+// Positions made from bp by make_move keep using table
+void set_eval_table(BitPosition *bp, const EvalTable *table) {
+  bp->eval_table = table;
+  bp->eval = compute_eval(bp);
+}
+
+// NOTE : Same as init_hash, needed on any board that wasn't made by
+// copying or applying moves.
+inline void init_eval(ChessBoard *cb) {
+  cb->eval = compute_eval(cb);
+}
+
+// For the side to move
+inline int evaluate_position(BitPosition *bp) {
+  return bp->side == WHITE_SIDE ? bp->eval : -bp->eval;
+}
+
+#endif
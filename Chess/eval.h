@@ -0,0 +1,50 @@
+
+#ifndef _CHESS_EVAL_H_
+#define _CHESS_EVAL_H_
+
+// Material and piece-square evaluation. Each piece on a square is worth a
+// fixed amount, so the total is kept up to date by set_piece/put_piece and
+// evaluating a leaf is just reading ChessBoard::eval or BitPosition::eval.
+//
+// The weights come from a text file (see eval_weights.txt) so they can be
+// tuned without recompiling, eval_weights starts out as material only.
+// NOTE : set_eval_weights has to be called before making any boards, even
+// without a file. Boards that already exist keep the sum from the old
+// weights until init_eval.
+
+#ifndef EVAL_WEIGHTS_FILE
+#define EVAL_WEIGHTS_FILE "eval_weights.txt"
+#endif
+
+typedef struct {
+  int values[7];     // indexed by PieceType, centipawns
+  int tables[7][64]; // indexed by PieceType then square, white's point of view
+} EvalWeights;
+
+extern EvalWeights eval_weights;
+
+// Signed value + table per [side][type][square], black already mirrored
+// and negated, [side][EMPTY] is 0.
+typedef struct EvalTable {
+  int pieces[2][7][64];
+} EvalTable;
+
+// What ChessBoard and new BitPositions use, rebuilt by set_eval_weights.
+// A BitPosition can be moved to another table with set_eval_table, so
+// engines with different weights can play in the same process.
+extern EvalTable default_eval;
+
+bool load_eval_weights(EvalWeights *weights, const char *path);
+void build_eval_table(EvalTable *table, EvalWeights *weights);
+void set_eval_weights(EvalWeights *weights);
+
+inline int eval_piece(const EvalTable *table, PieceType p, int sq);
+inline int eval_piece(PieceType p, int sq);
+int compute_eval(ChessBoard *cb);
+int compute_eval(BitPosition *bp);
+inline void init_eval(ChessBoard *cb);
+void set_eval_table(BitPosition *bp, const EvalTable *table);
+
+inline int evaluate_position(BitPosition *bp);
+
+#endif
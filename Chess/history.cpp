@@ -0,0 +1,130 @@
+
+#ifndef _CHESS_HISTORY_CPP_
+#define _CHESS_HISTORY_CPP_
+
+#include "history.h"
+
+static bool alloc_history_slots(PositionHistory *history, uint32_t count) {
+  history->slots = (HistorySlot *) calloc(count, sizeof(HistorySlot));
+  history->slot_mask = count - 1;
+  history->used = 0;
+  return history->slots != NULL;
+}
+
+bool init_history(PositionHistory *history, int capacity) {
+  if (capacity < 16) capacity = 16;
+  uint32_t slots = 32;
+  while (slots < (uint32_t) capacity * 2) slots *= 2;
+
+  history->keys = (uint64_t *) malloc(capacity * sizeof(uint64_t));
+  history->size = 0;
+  history->capacity = capacity;
+  if (!alloc_history_slots(history, slots) || !history->keys) {
+    free_history(history);
+    return false;
+  }
+  return true;
+}
+
+void free_history(PositionHistory *history) {
+  free(history->keys);
+  free(history->slots);
+  *history = {};
+}
+
+void clear_history(PositionHistory *history) {
+  memset(history->slots, 0, (history->slot_mask + 1) * sizeof(HistorySlot));
+  history->size = 0;
+  history->used = 0;
+}
+
+inline HistorySlot *find_slot(PositionHistory *history, uint64_t key) {
+  uint32_t i = (uint32_t) key & history->slot_mask;
+  while (history->slots[i].count && history->slots[i].key != key) i = (i + 1) & history->slot_mask;
+  return history->slots + i;
+}
+
+// Twice the slots, every key is put back where it belongs in the new table
+static bool grow_history_slots(PositionHistory *history) {
+  HistorySlot *old = history->slots;
+  uint32_t old_count = history->slot_mask + 1;
+  if (!alloc_history_slots(history, old_count * 2)) {
+    history->slots = old;
+    history->slot_mask = old_count - 1;
+    return false;
+  }
+
+  int used = 0;
+  for (uint32_t i = 0; i < old_count; i++) {
+    if (!old[i].count) continue;
+    *find_slot(history, old[i].key) = old[i];
+    used++;
+  }
+  history->used = used;
+  free(old);
+  return true;
+}
+
+// False if out of memory, the history is left as it was
+bool push_position(PositionHistory *history, uint64_t key) {
+  if (history->size == history->capacity) {
+    uint64_t *keys = (uint64_t *) realloc(history->keys, history->capacity * 2 * sizeof(uint64_t));
+    if (!keys) return false;
+    history->keys = keys;
+    history->capacity *= 2;
+  }
+  if ((uint32_t) (history->used + 1) * 2 > history->slot_mask + 1 && !grow_history_slots(history)) {
+    return false;
+  }
+
+  HistorySlot *slot = find_slot(history, key);
+  if (!slot->count) {
+    slot->key = key;
+    history->used++;
+  }
+  slot->count++;
+  history->keys[history->size++] = key;
+  return true;
+}
+
+// Removing a key shifts the ones after it back, so lookups never have to
+// skip over deleted slots.
+void pop_position(PositionHistory *history) {
+  assert(history->size > 0);
+  uint64_t key = history->keys[--history->size];
+  HistorySlot *slot = find_slot(history, key);
+  assert(slot->count);
+  if (--slot->count) return;
+
+  history->used--;
+  uint32_t mask = history->slot_mask;
+  uint32_t hole = slot - history->slots;
+  uint32_t i = hole;
+  while (true) {
+    i = (i + 1) & mask;
+    HistorySlot *next = history->slots + i;
+    if (!next->count) break;
+    // Keys whose home is cyclically in (hole, i] are still reachable
+    uint32_t home = (uint32_t) next->key & mask;
+    if (((i - home) & mask) < ((i - hole) & mask)) continue;
+    history->slots[hole] = *next;
+    next->count = 0;
+    hole = i;
+  }
+}
+
+// Times key has been pushed and not popped
+inline int repetitions(PositionHistory *history, uint64_t key) {
+  return find_slot(history, key)->count;
+}
+
+// The current position happened before
+inline bool is_repetition(PositionHistory *history) {
+  return history->size && repetitions(history, history->keys[history->size - 1]) >= 2;
+}
+
+inline bool is_threefold(PositionHistory *history) {
+  return history->size && repetitions(history, history->keys[history->size - 1]) >= 3;
+}
+
+#endif
@@ -0,0 +1,46 @@
+
+#ifndef _CHESS_HISTORY_H_
+#define _CHESS_HISTORY_H_
+
+#include <cstdint>
+
+// Positions a game has been through, as Zobrist keys with the side to
+// move included (BitPosition::hash). Keys are pushed and popped in move
+// order, and a hash table keeps how many times each key is in the stack,
+// so repetitions are a single lookup instead of comparing boards.
+//
+// Both the game (ChessStack) and the search use it. The search pushes a
+// key for every move it makes, so nothing here allocates unless the
+// stack or the table has to grow.
+
+// Plies without a capture or a pawn move before the game is drawn
+#define FIFTY_MOVE_PLIES 100
+
+typedef struct {
+  uint64_t key;
+  uint32_t count; // 0 for an empty slot
+} HistorySlot;
+
+typedef struct {
+  uint64_t *keys; // in the order they were pushed, the last is the current position
+  int size;
+  int capacity;
+
+  // Linear probing, the slot count is a power of 2 and kept at least
+  // twice the number of different keys.
+  HistorySlot *slots;
+  uint32_t slot_mask;
+  int used;
+} PositionHistory;
+
+bool init_history(PositionHistory *history, int capacity);
+void free_history(PositionHistory *history);
+void clear_history(PositionHistory *history);
+
+bool push_position(PositionHistory *history, uint64_t key);
+void pop_position(PositionHistory *history);
+inline int repetitions(PositionHistory *history, uint64_t key);
+inline bool is_repetition(PositionHistory *history);
+inline bool is_threefold(PositionHistory *history);
+
+#endif
@@ -0,0 +1,229 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+// Counts leaf nodes of the move tree to a fixed depth. The counts for the
+// positions below are well known, so any difference is a move generation
+// bug. The timings are what to watch when optimizing the board code.
+//
+// Usage :
+//   perft                      runs the suite
+//   perft <depth>              runs the suite, capped at depth
+//   perft <depth> <fen>        runs a single position
+//   perft -legacy ...          uses ChessBoard/is_legal_move instead
+//   perft -search <threads> [depth] [features]
+//                              searches the suite positions instead, for
+//                              search nps and thread scaling. features is
+//                              like null,lmr or none, see parse_search_features
+
+typedef struct {
+  const char *name;
+  const char *fen;
+  int max_depth; // depth the suite runs to by default
+  uint64_t nodes[7]; // nodes[d] is the count at depth d
+} PerftPosition;
+
+PerftPosition perft_positions[] = {
+  { "start",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5,
+    { 1, 20, 400, 8902, 197281, 4865609, 119060324 }},
+  // Castling, en passant and promotions all over the place
+  { "kiwipete",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4,
+    { 1, 48, 2039, 97862, 4085603, 193690690, 8031647685ULL }},
+  // En passant discovered checks along the rank
+  { "endgame",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5,
+    { 1, 14, 191, 2812, 43238, 674624, 11030083 }},
+  // Promotions with capture, castling into check
+  { "promotion",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4,
+    { 1, 6, 264, 9467, 422333, 15833292, 706045033 }},
+  { "pinned",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4,
+    { 1, 44, 1486, 62379, 2103487, 89941194, 0 }},
+  { "middlegame",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4,
+    { 1, 46, 2079, 89890, 3894594, 164075551, 6923051137ULL }},
+};
+
+uint64_t perft(BitPosition *bp, int depth) {
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(bp, moves);
+  // Bulk count, the leaves don't need to be made
+  if (depth == 1) return count;
+
+  uint64_t nodes = 0;
+  UndoInfo undo;
+  for (int i = 0; i < count; i++) {
+    make_move(bp, moves[i], &undo);
+    nodes += perft(bp, depth - 1);
+    unmake_move(bp, moves[i], &undo);
+  }
+  return nodes;
+}
+
+// Same walk using the original representation. This is slow, keep the
+// depths small.
+uint64_t legacy_perft(ChessBoard *cb, int player, int depth) {
+  if (depth == 0) return 1;
+
+  // king_move reads check_status to refuse castling out of check
+  cb->check_status = test_for_checks(cb, player);
+  int other_player = get_other_player(player);
+  uint64_t nodes = 0;
+
+  for (int y1 = 0; y1 < 8; y1++) {
+    for (int x1 = 0; x1 < 8; x1++) {
+      Position p1 = { x1, y1 };
+      PieceType p = get_piece(cb, p1);
+      if (piece_color(p) != player) continue;
+
+      for (int y2 = 0; y2 < 8; y2++) {
+        for (int x2 = 0; x2 < 8; x2++) {
+          Position p2 = { x2, y2 };
+          if (!is_legal_move(cb, p1, p2)) continue;
+
+          ChessBoard temp = *cb;
+          apply_move(&temp, p1, p2);
+          CheckStatus status = test_for_checks(&temp, player);
+          if ((player == 1 && status == CHECK_ON_1) ||
+              (player == 2 && status == CHECK_ON_2)) continue;
+
+          if ((p & PMASK) == PAWN && (y2 == 0 || y2 == 7)) {
+            // Same as push_move, once for each choice
+            PieceType promotions[] = { QUEEN, ROOK, BISHOP, KNIGHT };
+            for (int i = 0; i < 4; i++) {
+              ChessBoard promoted = temp;
+              set_piece(&promoted, p2, promotions[i] | PMOVED | (p & PBLACK));
+              nodes += legacy_perft(&promoted, other_player, depth - 1);
+            }
+          } else {
+            nodes += legacy_perft(&temp, other_player, depth - 1);
+          }
+        }
+      }
+    }
+  }
+  return nodes;
+}
+
+// Returns the node count, and checks it against expected if it isn't 0.
+uint64_t run_perft(const char *name, const char *fen, int depth, uint64_t expected, bool legacy) {
+  BitPosition bp;
+  if (!parse_fen(&bp, fen)) {
+    printf("Invalid fen : %s\n", fen);
+    return 0;
+  }
+
+  uint64_t start = read_os_timer();
+  uint64_t nodes;
+  if (legacy) {
+    ChessBoard cb = to_chess_board(&bp);
+    nodes = legacy_perft(&cb, bp.side + 1, depth);
+  } else {
+    nodes = perft(&bp, depth);
+  }
+  uint64_t elapsed = read_os_timer() - start;
+  if (!elapsed) elapsed = 1;
+
+  printf("%-12s depth %d : %12llu nodes %8.3f s %12llu nps",
+         name, depth, (unsigned long long) nodes, elapsed / 1000000.0,
+         (unsigned long long) (nodes * 1000000 / elapsed));
+  if (expected && nodes != expected) {
+    printf("  FAILED, expected %llu", (unsigned long long) expected);
+  }
+  printf("\n");
+  return nodes;
+}
+
+int run_search_bench(int num_threads, int depth, int features) {
+  TranspositionTable table;
+  SearchThreads threads;
+  if (!init_table(&table, DEFAULT_TABLE_MB) || !init_search_threads(&threads, &table, num_threads)) {
+    printf("Could not allocate the search\n");
+    return EXIT_FAILURE;
+  }
+  threads.features = features;
+
+  uint64_t total_nodes = 0;
+  uint64_t total_elapsed = 0;
+  for (int i = 0; i < (int) (sizeof(perft_positions) / sizeof(*perft_positions)); i++) {
+    PerftPosition *pp = perft_positions + i;
+    BitPosition bp;
+    parse_fen(&bp, pp->fen);
+    // Every position starts cold
+    clear(&table);
+    SearchLimits limits = { depth, 0, 0 };
+    BitMove move = parallel_search(&threads, &bp, limits);
+
+    uint64_t elapsed = threads.elapsed_us ? threads.elapsed_us : 1;
+    printf("%-12s depth %d : %12llu nodes %8.3f s %12llu nps  ", pp->name, depth,
+           (unsigned long long) threads.nodes, elapsed / 1000000.0,
+           (unsigned long long) (threads.nodes * 1000000 / elapsed));
+    print_move(move, stdout);
+    total_nodes += threads.nodes;
+    total_elapsed += elapsed;
+  }
+  printf("Total : %llu nodes, %.3f s, %llu nps, %d threads\n", (unsigned long long) total_nodes,
+         total_elapsed / 1000000.0, (unsigned long long) (total_nodes * 1000000 / total_elapsed),
+         threads.num_threads);
+
+  free_search_threads(&threads);
+  free_table(&table);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  init_bitboards();
+
+  if (argc > 2 && !strcmp(argv[1], "-search")) {
+    init_zobrist();
+    EvalWeights weights = eval_weights;
+    load_eval_weights(&weights, EVAL_WEIGHTS_FILE);
+    set_eval_weights(&weights);
+    int depth = argc > 3 ? atoi(argv[3]) : SEARCH_DEPTH;
+    int features = argc > 4 ? parse_search_features(argv[4]) : SEARCH_FEATURES;
+    if (features < 0) {
+      printf("Unknown search features %s\n", argv[4]);
+      return EXIT_FAILURE;
+    }
+    return run_search_bench(atoi(argv[2]), depth < 1 ? 1 : depth, features);
+  }
+
+  bool legacy = false;
+  int arg = 1;
+  if (arg < argc && !strcmp(argv[arg], "-legacy")) {
+    legacy = true;
+    arg++;
+  }
+
+  int depth = 0;
+  if (arg < argc) depth = atoi(argv[arg++]);
+
+  if (arg < argc) {
+    if (depth < 1) depth = 1;
+    return run_perft("fen", argv[arg], depth, 0, legacy) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  int failures = 0;
+  uint64_t total_nodes = 0;
+  uint64_t start = read_os_timer();
+  for (int i = 0; i < (int) (sizeof(perft_positions) / sizeof(*perft_positions)); i++) {
+    PerftPosition *pp = perft_positions + i;
+    int d = pp->max_depth;
+    if (legacy) d -= 1;
+    if (depth && depth < d) d = depth;
+    if (d < 1) d = 1;
+
+    uint64_t nodes = run_perft(pp->name, pp->fen, d, pp->nodes[d], legacy);
+    if (nodes != pp->nodes[d]) failures++;
+    total_nodes += nodes;
+  }
+  uint64_t elapsed = read_os_timer() - start;
+  if (!elapsed) elapsed = 1;
+
+  printf("Total : %llu nodes, %.3f s, %llu nps\n", (unsigned long long) total_nodes,
+         elapsed / 1000000.0, (unsigned long long) (total_nodes * 1000000 / elapsed));
+  if (failures) printf("%d positions FAILED\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,623 @@
+
+#ifndef _CHESS_SEARCH_CPP_
+#define _CHESS_SEARCH_CPP_
+
+#include "search.h"
+#include <ctime>
+
+// Microseconds, for nps
+inline uint64_t read_os_timer() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+// Mate and tablebase scores count plies from the root, the table needs
+// them counted from the node so they stay correct when reached through
+// another path. Tablebase wins are the lowest of them.
+inline int score_to_table(int score, int ply) {
+  if (score > TB_WIN_SCORE - MAX_PLY)  return score + ply;
+  if (score < -TB_WIN_SCORE + MAX_PLY) return score - ply;
+  return score;
+}
+
+inline int score_from_table(int score, int ply) {
+  if (score > TB_WIN_SCORE - MAX_PLY)  return score - ply;
+  if (score < -TB_WIN_SCORE + MAX_PLY) return score + ply;
+  return score;
+}
+
+#define MAX_HISTORY (1 << 20) // halved past this
+
+// By value, PieceType order isn't
+static const int mvv_lva_rank[7] = { 0, 1, 4, 3, 2, 6, 5 };
+
+// Most valuable victim first, least valuable attacker to break ties
+inline int mvv_lva(BitPosition *bp, BitMove move) {
+  int victim = is_en_passant(move) ? PAWN : bp->squares[move.to] & PMASK;
+  int attacker = bp->squares[move.from] & PMASK;
+  return (mvv_lva_rank[victim] + mvv_lva_rank[promotion_piece(move)]) * 8 - mvv_lva_rank[attacker];
+}
+
+inline bool same_move(BitMove a, BitMove b) {
+  return move_bits(a) == move_bits(b);
+}
+
+inline bool is_quiet(BitMove move) {
+  return !is_capture(move) && !is_promotion(move);
+}
+
+void init_move_picker(MovePicker *picker, SearchState *state, BitMove table_best, bool captures_only) {
+  BitMove *killers = state->killers[state->ply];
+  picker->stage = STAGE_TABLE_MOVE;
+  picker->table_move = table_best;
+  picker->killers[0] = captures_only ? NULL_MOVE : killers[0];
+  picker->killers[1] = captures_only ? NULL_MOVE : killers[1];
+  picker->captures_only = captures_only;
+  picker->count = 0;
+  picker->index = 0;
+}
+
+// Moves the best of moves[i..count) to i. Most nodes cut off after a
+// move or two, so this is cheaper than sorting them all.
+inline BitMove pick_move(BitMove *moves, int *scores, int count, int i) {
+  int best = i;
+  for (int j = i + 1; j < count; j++) {
+    if (scores[j] > scores[best]) best = j;
+  }
+  BitMove move = moves[best];
+  moves[best] = moves[i];
+  moves[i] = move;
+  int score = scores[best];
+  scores[best] = scores[i];
+  scores[i] = score;
+  return move;
+}
+
+// Pseudo-legal moves best first, NULL_MOVE once there are none left.
+// Each stage is only generated when the one before it didn't cut off.
+BitMove next_move(MovePicker *picker, SearchState *state) {
+  BitPosition *bp = &state->position;
+  switch (picker->stage) {
+    case STAGE_TABLE_MOVE:
+      picker->stage = STAGE_GENERATE_CAPTURES;
+      // Could be from another position with the same bucket bits
+      if (!IS_NULL_MOVE(picker->table_move) && is_pseudo_legal(bp, picker->table_move)) {
+        return picker->table_move;
+      }
+      picker->table_move = NULL_MOVE;
+      // fallthrough
+
+    case STAGE_GENERATE_CAPTURES:
+      picker->count = generate_captures(bp, picker->moves);
+      for (int i = 0; i < picker->count; i++) picker->scores[i] = mvv_lva(bp, picker->moves[i]);
+      picker->index = 0;
+      picker->stage = STAGE_CAPTURES;
+      // fallthrough
+
+    case STAGE_CAPTURES:
+      while (picker->index < picker->count) {
+        BitMove move = pick_move(picker->moves, picker->scores, picker->count, picker->index++);
+        if (!same_move(move, picker->table_move)) return move;
+      }
+      if (picker->captures_only) {
+        picker->stage = STAGE_DONE;
+        return NULL_MOVE;
+      }
+      picker->index = 0;
+      picker->stage = STAGE_KILLERS;
+      // fallthrough
+
+    case STAGE_KILLERS:
+      // Quiet moves that cut off at this ply in a sibling, they may not
+      // even be possible here
+      while (picker->index < 2) {
+        BitMove move = picker->killers[picker->index++];
+        if (!IS_NULL_MOVE(move) && !same_move(move, picker->table_move) && is_pseudo_legal(bp, move)) {
+          return move;
+        }
+      }
+      picker->stage = STAGE_GENERATE_QUIETS;
+      // fallthrough
+
+    case STAGE_GENERATE_QUIETS: {
+      picker->count = generate_quiets(bp, picker->moves);
+      int *history = &state->history[bp->side][0][0];
+      for (int i = 0; i < picker->count; i++) {
+        BitMove move = picker->moves[i];
+        picker->scores[i] = history[move.from * 64 + move.to];
+      }
+      picker->index = 0;
+      picker->stage = STAGE_QUIETS;
+    }
+      // fallthrough
+
+    case STAGE_QUIETS:
+      while (picker->index < picker->count) {
+        BitMove move = pick_move(picker->moves, picker->scores, picker->count, picker->index++);
+        if (!same_move(move, picker->table_move) && !same_move(move, picker->killers[0]) &&
+            !same_move(move, picker->killers[1])) return move;
+      }
+      picker->stage = STAGE_DONE;
+      // fallthrough
+
+    case STAGE_DONE:
+    default:
+      return NULL_MOVE;
+  }
+}
+
+void update_quiet_cutoff(SearchState *state, BitMove move, int depth) {
+  BitMove *killers = state->killers[state->ply];
+  if (!same_move(move, killers[0])) {
+    killers[1] = killers[0];
+    killers[0] = move;
+  }
+
+  int side = state->position.side;
+  int *entry = &state->history[side][move.from][move.to];
+  *entry += depth * depth;
+  if (*entry > MAX_HISTORY) {
+    for (int from = 0; from < 64; from++) {
+      for (int to = 0; to < 64; to++) state->history[side][from][to] /= 2;
+    }
+  }
+}
+
+// Comma separated: null, lmr, futility, or all or none. -1 if a name
+// isn't known.
+int parse_search_features(const char *text) {
+  static const char *names[3] = { "null", "lmr", "futility" };
+  int features = 0;
+  while (*text) {
+    int length = (int) strcspn(text, ",");
+    int feature = -1;
+    if (length == 3 && !strncmp(text, "all", 3))  feature = ALL_FEATURES;
+    if (length == 4 && !strncmp(text, "none", 4)) feature = 0;
+    for (int i = 0; i < 3; i++) {
+      if ((int) strlen(names[i]) == length && !strncmp(text, names[i], length)) feature = 1 << i;
+    }
+    if (feature < 0) return -1;
+    features |= feature;
+    text += length;
+    if (*text) text++;
+  }
+  return features;
+}
+
+void init_search(SearchState *state, TranspositionTable *table, BitPosition *bp) {
+  state->position = *bp;
+  state->table = table;
+  state->tablebases = NULL;
+  state->trace = NULL;
+  state->features = SEARCH_FEATURES;
+  state->stop = NULL;
+  state->stopped = false;
+  state->ply = 0;
+  state->node_limit = 0;
+  state->deadline = 0;
+  state->nodes = 0;
+  state->tb_hits = 0;
+  state->best_move = NULL_MOVE;
+  state->best_score = 0;
+  state->completed_depth = 0;
+  memset(state->killers, 0, sizeof(state->killers));
+  memset(state->history, 0, sizeof(state->history));
+  state->report = NULL;
+  state->report_data = NULL;
+  set_search_history(state, NULL);
+}
+
+// Only positions since the last capture or pawn move can come up again,
+// the rest of game is left out. state->positions has to be initialized.
+void set_search_history(SearchState *state, PositionHistory *game) {
+  BitPosition *bp = &state->position;
+  PositionHistory *history = &state->positions;
+  clear_history(history);
+  if (game) {
+    int count = min(game->size, bp->static_moves + 1);
+    for (int i = game->size - count; i < game->size; i++) push_position(history, game->keys[i]);
+  }
+  if (!history->size || history->keys[history->size - 1] != bp->hash) push_position(history, bp->hash);
+}
+
+// Running out of budget stops the helpers as well
+inline void check_limits(SearchState *state) {
+  bool out_of_budget = (state->node_limit && state->nodes >= state->node_limit) ||
+    (state->deadline && !(state->nodes & 1023) && read_os_timer() >= state->deadline);
+  if (out_of_budget) {
+    state->stopped = true;
+    if (state->stop) state->stop->store(true, std::memory_order_relaxed);
+  }
+}
+
+// The first iteration always finishes so there is a move to return
+inline bool should_stop(SearchState *state) {
+  if (!state->completed_depth) return false;
+  // Only look at the shared flag now and then, it's on another thread's cache line
+  if (state->stop && !(state->nodes & 1023) && state->stop->load(std::memory_order_relaxed)) {
+    state->stopped = true;
+  }
+  check_limits(state);
+  return state->stopped;
+}
+
+// Records the node in the trace if there is one, then returns
+#define QUIESCENCE_RETURN(SCORE, MOVE, REASON) \
+  TRACE_RETURN(state->trace, bp->hash, state->ply, 0, original_alpha, beta, SCORE, move_bits(MOVE), REASON, TRACE_QUIESCENCE)
+#define SEARCH_RETURN(SCORE, MOVE, REASON) \
+  TRACE_RETURN(state->trace, bp->hash, state->ply, depth, original_alpha, beta, SCORE, move_bits(MOVE), REASON, 0)
+
+// Captures only, so the eval isn't taken in the middle of an exchange.
+// The side to move can stand pat on the eval, except in check where
+// every evasion is searched instead.
+int quiescence(SearchState *state, int alpha, int beta) {
+  BitPosition *bp = &state->position;
+  int original_alpha = alpha;
+  state->nodes++;
+  if (should_stop(state)) QUIESCENCE_RETURN(0, NULL_MOVE, TRACE_STOPPED);
+  if (state->ply >= MAX_PLY - 1) QUIESCENCE_RETURN(evaluate_position(bp), NULL_MOVE, TRACE_MAX_PLY);
+
+  CheckInfo info;
+  init_check_info(bp, &info);
+  bool check = info.checkers != 0;
+  int best_score = -INFINITE_SCORE;
+  if (!check) {
+    best_score = evaluate_position(bp);
+    if (best_score >= beta) QUIESCENCE_RETURN(best_score, NULL_MOVE, TRACE_STAND_PAT);
+    if (best_score > alpha) alpha = best_score;
+  }
+
+  // In check every evasion is searched, not just captures
+  MovePicker picker;
+  init_move_picker(&picker, state, NULL_MOVE, !check);
+
+  int legal_moves = 0;
+  BitMove best_move = NULL_MOVE;
+  UndoInfo *undo = state->undo + state->ply;
+  while (true) {
+    BitMove move = next_move(&picker, state);
+    if (IS_NULL_MOVE(move)) break;
+    if (!is_legal(bp, move, &info)) continue;
+    legal_moves++;
+    make_move(bp, move, undo);
+
+    state->ply++;
+    int score = -quiescence(state, -beta, -alpha);
+    state->ply--;
+    unmake_move(bp, move, undo);
+    if (state->stopped) QUIESCENCE_RETURN(0, NULL_MOVE, TRACE_STOPPED);
+
+    if (score > best_score) {
+      best_score = score;
+      best_move = move;
+      if (score > alpha) alpha = score;
+      if (alpha >= beta) QUIESCENCE_RETURN(best_score, best_move, TRACE_BETA_CUTOFF);
+    }
+  }
+
+  if (check && !legal_moves) QUIESCENCE_RETURN(-MATE_SCORE + state->ply, NULL_MOVE, TRACE_MATE);
+  QUIESCENCE_RETURN(best_score, best_move, best_score > original_alpha ? TRACE_EXACT : TRACE_FAIL_LOW);
+}
+
+int search(SearchState *state, int depth, int alpha, int beta) {
+  if (depth <= 0) return quiescence(state, alpha, beta);
+
+  BitPosition *bp = &state->position;
+  int original_alpha = alpha;
+  state->nodes++;
+  if (should_stop(state)) SEARCH_RETURN(0, NULL_MOVE, TRACE_STOPPED);
+
+  if (state->ply >= MAX_PLY - 1) SEARCH_RETURN(evaluate_position(bp), NULL_MOVE, TRACE_MAX_PLY);
+  bool root = state->ply == 0;
+  // Draws, a repetition counts the first time it happens in the search
+  if (!root && (bp->static_moves >= FIFTY_MOVE_PLIES || is_repetition(&state->positions))) {
+    SEARCH_RETURN(0, NULL_MOVE, TRACE_DRAW);
+  }
+
+  int wdl;
+  if (!root && state->tablebases && popcount(bp->occupied) <= state->tablebases->max_pieces &&
+      probe_wdl(state->tablebases, bp, &wdl)) {
+    state->tb_hits++;
+    int score = wdl == TB_DRAW ? 0 : wdl == TB_WIN ? TB_WIN_SCORE - state->ply : -TB_WIN_SCORE + state->ply;
+    SEARCH_RETURN(score, NULL_MOVE, TRACE_TABLEBASE);
+  }
+
+  BitMove table_best = NULL_MOVE;
+  TableEntry entry;
+  if (probe(state->table, bp->hash, &entry)) {
+    table_best = bits_move(entry.move);
+
+    // The root always searches so there is a move to return
+    if (!root && entry.depth >= depth) {
+      int score = score_from_table(entry.score, state->ply);
+      if (entry.bound == BOUND_EXACT ||
+          (entry.bound == BOUND_LOWER && score >= beta) ||
+          (entry.bound == BOUND_UPPER && score <= alpha)) {
+        SEARCH_RETURN(score, table_best, TRACE_TABLE_CUTOFF);
+      }
+    }
+  }
+
+  CheckInfo info;
+  init_check_info(bp, &info);
+  bool check = info.checkers != 0;
+  bool pv_node = beta - alpha > 1;
+  int static_eval = evaluate_position(bp);
+  UndoInfo *undo = state->undo + state->ply;
+
+  // If passing still fails high a real move would too. Not twice in a
+  // row, and not with only pawns left where zugzwang is common.
+  Bitboard pieces = bp->pieces[bp->side][EMPTY] & ~(bp->pieces[bp->side][PAWN] | bp->pieces[bp->side][KING]);
+  if ((state->features & FEATURE_NULL_MOVE) && !pv_node && !check && depth >= NULL_MOVE_DEPTH &&
+      static_eval >= beta && pieces && !root && !state->null_move[state->ply - 1]) {
+    int reduction = NULL_MOVE_REDUCTION + (depth > 6);
+    make_null_move(bp, undo);
+    push_position(&state->positions, bp->hash);
+    state->null_move[state->ply] = true;
+    state->ply++;
+    int score = -search(state, depth - 1 - reduction, -beta, -beta + 1);
+    state->ply--;
+    pop_position(&state->positions);
+    unmake_null_move(bp, undo);
+    if (state->stopped) SEARCH_RETURN(0, NULL_MOVE, TRACE_STOPPED);
+    // A mate found after passing isn't proven
+    if (score >= beta) SEARCH_RETURN(IS_MATE_SCORE(score) ? beta : score, NULL_MOVE, TRACE_NULL_MOVE);
+  }
+  state->null_move[state->ply] = false;
+
+  // Quiet moves that can't bring the eval up to alpha aren't searched
+  bool futile = (state->features & FEATURE_FUTILITY) && !pv_node && !check && depth <= FUTILITY_DEPTH &&
+    !IS_MATE_SCORE(alpha) && static_eval + FUTILITY_MARGIN * depth <= alpha;
+
+  MovePicker picker;
+  init_move_picker(&picker, state, table_best, false);
+
+  int best_score = -INFINITE_SCORE;
+  BitMove best_move = NULL_MOVE;
+  int legal_moves = 0;
+
+  while (true) {
+    BitMove move = next_move(&picker, state);
+    if (IS_NULL_MOVE(move)) break;
+    if (!is_legal(bp, move, &info)) continue;
+    legal_moves++;
+    make_move(bp, move, undo);
+    bool quiet = is_quiet(move) && !in_check(bp);
+    if (futile && quiet && legal_moves > 1) {
+      unmake_move(bp, move, undo);
+      if (static_eval + FUTILITY_MARGIN * depth > best_score) best_score = static_eval + FUTILITY_MARGIN * depth;
+      continue;
+    }
+    push_position(&state->positions, bp->hash);
+
+    state->ply++;
+    int score;
+    // Late quiet moves get a shallower null window search first, and
+    // the full one only if that beats alpha.
+    bool reduce = (state->features & FEATURE_LMR) && depth >= LMR_DEPTH && legal_moves > LMR_MOVES &&
+      quiet && !check && !same_move(move, picker.killers[0]) && !same_move(move, picker.killers[1]);
+    if (reduce) {
+      int reduction = 1 + (depth >= 6 && legal_moves > 2 * LMR_MOVES);
+      score = -search(state, depth - 1 - reduction, -alpha - 1, -alpha);
+      if (score > alpha && !state->stopped) score = -search(state, depth - 1, -beta, -alpha);
+    } else {
+      score = -search(state, depth - 1, -beta, -alpha);
+    }
+    state->ply--;
+    pop_position(&state->positions);
+    unmake_move(bp, move, undo);
+    if (state->stopped) SEARCH_RETURN(0, NULL_MOVE, TRACE_STOPPED);
+
+    if (score > best_score) {
+      best_score = score;
+      best_move = move;
+      if (score > alpha) alpha = score;
+      if (alpha >= beta) {
+        if (is_quiet(move)) update_quiet_cutoff(state, move, depth);
+        break;
+      }
+    }
+  }
+
+  if (!legal_moves) {
+    // Checkmate or stalemate
+    best_score = info.checkers ? -MATE_SCORE + state->ply : 0;
+    if (root) state->best_score = best_score;
+    SEARCH_RETURN(best_score, NULL_MOVE, info.checkers ? TRACE_MATE : TRACE_STALEMATE);
+  }
+
+  int bound = BOUND_EXACT;
+  if (best_score <= original_alpha) bound = BOUND_UPPER;
+  else if (best_score >= beta)      bound = BOUND_LOWER;
+  store(state->table, bp->hash, depth, bound, score_to_table(best_score, state->ply), table_move(best_move));
+
+  // A root result outside the window is only a bound, iterate() searches again
+  if (root && bound == BOUND_EXACT) {
+    state->best_move = best_move;
+    state->best_score = best_score;
+  }
+  SEARCH_RETURN(best_score, best_move, bound == BOUND_EXACT ? TRACE_EXACT :
+                bound == BOUND_UPPER ? TRACE_FAIL_LOW : TRACE_BETA_CUTOFF);
+}
+
+// Starts with a narrow window around the last iteration's score and
+// widens the side that failed until the score is exact.
+int aspiration_search(SearchState *state, int depth) {
+  int alpha = -INFINITE_SCORE;
+  int beta = INFINITE_SCORE;
+  int delta = ASPIRATION_WINDOW;
+  if (depth >= ASPIRATION_DEPTH && !IS_MATE_SCORE(state->best_score)) {
+    alpha = state->best_score - delta;
+    beta = state->best_score + delta;
+  }
+
+  while (true) {
+    int score = search(state, depth, alpha, beta);
+    if (state->stopped) return score;
+
+    delta *= 2;
+    if (score <= alpha)     alpha = max(score - delta, -INFINITE_SCORE);
+    else if (score >= beta) beta = min(score + delta, INFINITE_SCORE);
+    else return score;
+  }
+}
+
+// Results of an iteration that was stopped are dropped, best_move stays
+// what the last full iteration found.
+void iterative_deepening(SearchState *state, int first_depth, int max_depth) {
+  uint64_t start = read_os_timer();
+  for (int depth = first_depth; depth <= max_depth; depth++) {
+    aspiration_search(state, depth);
+    if (state->stopped || IS_NULL_MOVE(state->best_move)) break;
+    state->completed_depth = depth;
+    if (state->report) state->report(state, state->report_data);
+
+    // The next iteration takes several times as long as all of the ones
+    // so far, don't start one that can't finish.
+    if (state->deadline && read_os_timer() - start >= (state->deadline - start) / 2) break;
+  }
+}
+
+// Iterative deepening, returns NULL_MOVE if there are no legal moves
+BitMove search_best_move(SearchState *state, int max_depth) {
+  assert(state->ply == 0);
+  new_search(state->table);
+  iterative_deepening(state, 1, max_depth);
+  return state->best_move;
+}
+
+// Follows the table moves from bp. Entries can be overwritten, so each
+// move is checked to be legal and the line stops at a repeated position.
+int principal_variation(TranspositionTable *table, BitPosition *bp, BitMove *pv, int max_length) {
+  BitPosition position = *bp;
+  uint64_t seen[MAX_PLY];
+  int length = 0;
+  while (length < max_length && length < MAX_PLY) {
+    TableEntry entry;
+    if (!probe(table, position.hash, &entry) || entry.move == NO_TABLE_MOVE) break;
+    for (int i = 0; i < length; i++) {
+      if (seen[i] == position.hash) return length;
+    }
+
+    BitMove moves[MAX_MOVES];
+    int count = generate_legal_moves(&position, moves);
+    int i = 0;
+    while (i < count && table_move(moves[i]) != entry.move) i++;
+    if (i == count) break;
+
+    seen[length] = position.hash;
+    pv[length++] = moves[i];
+    apply_move(&position, moves[i]);
+  }
+  return length;
+}
+
+bool init_search_threads(SearchThreads *threads, TranspositionTable *table, int num_threads) {
+  if (num_threads < 1) num_threads = 1;
+  if (num_threads > MAX_SEARCH_THREADS) num_threads = MAX_SEARCH_THREADS;
+  threads->table = table;
+  threads->num_threads = num_threads;
+  threads->states = (SearchState *) malloc(num_threads * sizeof(SearchState));
+  threads->game = NULL;
+  threads->tablebases = NULL;
+  threads->book = NULL;
+  threads->eval = NULL;
+  threads->trace = NULL;
+  threads->features = SEARCH_FEATURES;
+  threads->stop = false;
+  threads->nodes = 0;
+  threads->tb_hits = 0;
+  threads->elapsed_us = 0;
+  threads->report = NULL;
+  threads->report_data = NULL;
+  if (!threads->states) return false;
+
+  // Room for the longest line the fifty move rule allows plus the search
+  bool ok = true;
+  for (int i = 0; i < num_threads; i++) {
+    ok &= init_history(&threads->states[i].positions, FIFTY_MOVE_PLIES + MAX_PLY);
+  }
+  if (!ok) free_search_threads(threads);
+  return ok;
+}
+
+void free_search_threads(SearchThreads *threads) {
+  for (int i = 0; threads->states && i < threads->num_threads; i++) free_history(&threads->states[i].positions);
+  free(threads->states);
+  threads->states = NULL;
+  threads->num_threads = 0;
+}
+
+// Helpers go past max_depth and only end when the main thread is done.
+// Every other helper starts one ply deeper so they don't all search the
+// same tree in lockstep.
+void helper_search(SearchState *state, int id) {
+  iterative_deepening(state, 1 + (id & 1), MAX_PLY - 1);
+}
+
+// Main thread result, the helpers only contribute through the table.
+// Setting threads->stop from another thread ends the search early. stop
+// is cleared when the search starts, so a stop that came in after the
+// last search had finished doesn't cut the next one short.
+BitMove parallel_search(SearchThreads *threads, BitPosition *bp, SearchLimits limits) {
+  uint64_t start = read_os_timer();
+  threads->stop = false;
+  new_search(threads->table);
+
+  for (int i = 0; i < threads->num_threads; i++) {
+    init_search(threads->states + i, threads->table, bp);
+    set_search_history(threads->states + i, threads->game);
+    threads->states[i].tablebases = threads->tablebases;
+    threads->states[i].features = threads->features;
+    if (threads->eval) set_eval_table(&threads->states[i].position, threads->eval);
+    threads->states[i].stop = &threads->stop;
+  }
+  SearchState *main_state = threads->states;
+  main_state->trace = threads->trace;
+  threads->nodes = 0;
+  threads->tb_hits = 0;
+
+  // Nothing to search when the book or the tables know the answer
+  BitMove book_best;
+  if (threads->book && book_move(threads->book, bp, 0, &book_best)) {
+    main_state->best_move = book_best;
+    threads->elapsed_us = read_os_timer() - start;
+    return book_best;
+  }
+  int wdl;
+  BitMove tb_move;
+  if (threads->tablebases && probe_root(threads->tablebases, bp, &tb_move, &wdl)) {
+    main_state->best_move = tb_move;
+    main_state->best_score = wdl == TB_WIN ? TB_WIN_SCORE : wdl == TB_LOSS ? -TB_WIN_SCORE : 0;
+    threads->tb_hits = 1;
+    threads->elapsed_us = read_os_timer() - start;
+    return tb_move;
+  }
+
+  main_state->report = threads->report;
+  main_state->report_data = threads->report_data;
+  main_state->node_limit = limits.nodes;
+  if (limits.time_us) main_state->deadline = start + limits.time_us;
+  int max_depth = limits.depth ? min(limits.depth, MAX_PLY - 1) : MAX_PLY - 1;
+
+  std::thread helpers[MAX_SEARCH_THREADS];
+  for (int i = 1; i < threads->num_threads; i++) {
+    helpers[i] = std::thread(helper_search, threads->states + i, i);
+  }
+
+  iterative_deepening(main_state, 1, max_depth);
+
+  threads->stop = true;
+  for (int i = 1; i < threads->num_threads; i++) helpers[i].join();
+  threads->stop = false;
+
+  for (int i = 0; i < threads->num_threads; i++) {
+    threads->nodes += threads->states[i].nodes;
+    threads->tb_hits += threads->states[i].tb_hits;
+  }
+  threads->elapsed_us = read_os_timer() - start;
+  return main_state->best_move;
+}
+
+#endif
@@ -0,0 +1,181 @@
+
+#ifndef _CHESS_SEARCH_H_
+#define _CHESS_SEARCH_H_
+
+// Alpha-beta search on a single BitPosition that is changed in place with
+// make_move/unmake_move. Unlike the ComAllocator search, no boards are
+// stored per node, so memory is the undo stack (O(depth)) plus the
+// transposition table.
+//
+// Scores are negamax: from the point of view of the side to move. Leaves
+// go through a captures only quiescence search. Moves are tried table
+// move first, then captures by MVV-LVA, killers, and quiets by history.
+// Each group is only generated once the ones before it failed to cut off.
+//
+// SearchThreads runs the same search on several threads (Lazy SMP). The
+// threads only share the transposition table and a stop flag, helpers
+// fill the table so the main thread's iterations get more cutoffs. With
+// one thread no helpers are started and results are deterministic.
+//
+// With a book, a root it has is played from it without searching.
+// With tablebases, positions they have are scored without searching,
+// and a root they have is played straight from them by DTZ.
+//
+// SearchLimits bounds a search by depth, nodes or time. Each iteration
+// after the first uses an aspiration window around the last score, and
+// an iteration that runs out of budget is dropped, so the move returned
+// is always from a fully searched depth.
+
+#include <atomic>
+#include <thread>
+
+#define MAX_PLY 64
+
+#define MATE_SCORE     30000
+#define INFINITE_SCORE 32000
+
+// Mate scores are stored relative to the node instead of the root
+#define IS_MATE_SCORE(S) ((S) > MATE_SCORE - MAX_PLY || (S) < -MATE_SCORE + MAX_PLY)
+
+// Won by the tablebases, below any mate the search can find
+#define TB_WIN_SCORE (MATE_SCORE - 2 * MAX_PLY)
+
+// from == to never happens for a real move
+#define NULL_MOVE (BitMove {})
+#define IS_NULL_MOVE(M) ((M).from == (M).to)
+
+#ifndef SEARCH_DEPTH
+#define SEARCH_DEPTH 7
+#endif
+
+#ifndef SEARCH_THREADS
+#define SEARCH_THREADS 1
+#endif
+
+#define MAX_SEARCH_THREADS 256
+
+// Selective search, each can be turned off to measure it. Null move
+// pruning skips a node when passing still fails high, late move
+// reductions search quiet moves late in the order less deep, and
+// futility pruning skips quiet moves next to the leaves that can't get
+// near alpha.
+#define FEATURE_NULL_MOVE 1
+#define FEATURE_LMR       2
+#define FEATURE_FUTILITY  4
+#define ALL_FEATURES      (FEATURE_NULL_MOVE | FEATURE_LMR | FEATURE_FUTILITY)
+
+#ifndef SEARCH_FEATURES
+#define SEARCH_FEATURES ALL_FEATURES
+#endif
+
+#define NULL_MOVE_DEPTH     3 // shallowest depth to try a null move at
+#define NULL_MOVE_REDUCTION 2 // one more past depth 6
+#define LMR_DEPTH           3
+#define LMR_MOVES           3 // searched at full depth before reducing
+#define FUTILITY_DEPTH      2
+#define FUTILITY_MARGIN     150 // per ply of depth left
+
+// Half width of the first aspiration window, doubled on each fail
+#define ASPIRATION_WINDOW 50
+#define ASPIRATION_DEPTH  4 // shallower iterations use the full window
+
+// 0 means no limit
+typedef struct {
+  int depth;
+  uint64_t nodes;   // main thread only, so one thread stays deterministic
+  uint64_t time_us;
+} SearchLimits;
+
+// Named so report can take it
+typedef struct SearchState {
+  BitPosition position;
+  UndoInfo undo[MAX_PLY];
+  TranspositionTable *table;
+  PositionHistory positions; // game positions then the ones on the current line, for repetitions
+  Tablebases *tablebases;    // NULL for none
+  SearchTrace *trace;        // NULL for none, see trace.h
+  int features;              // FEATURE_* flags
+  bool null_move[MAX_PLY];   // the move into ply + 1 was a null move
+  std::atomic<bool> *stop; // NULL if nothing else can stop the search
+  bool stopped;            // saw stop, the current iteration is thrown away
+  int ply;
+
+  // Only the main thread has these, helpers run until stop
+  uint64_t node_limit; // 0 for none
+  uint64_t deadline;   // read_os_timer time, 0 for none
+
+  // Move ordering, see next_move
+  BitMove killers[MAX_PLY][2]; // quiet moves that caused a cutoff at each ply
+  int history[2][64][64];      // [side][from][to], bumped on quiet cutoffs
+
+  uint64_t nodes;
+  uint64_t tb_hits;
+  BitMove best_move; // best move at the root from the last finished iteration
+  int best_score;
+  int completed_depth;
+
+  // Called after each finished iteration, main thread only. NULL for none
+  void (*report)(SearchState *state, void *data);
+  void *report_data;
+} SearchState;
+
+// Stages of MovePicker, in order
+#define STAGE_TABLE_MOVE        0
+#define STAGE_GENERATE_CAPTURES 1
+#define STAGE_CAPTURES          2 // and promotions, by MVV-LVA
+#define STAGE_KILLERS           3
+#define STAGE_GENERATE_QUIETS   4
+#define STAGE_QUIETS            5 // by history
+#define STAGE_DONE              6
+
+// Hands out moves one at a time, see next_move
+typedef struct {
+  int stage;
+  bool captures_only; // quiescence, stops after the captures
+  BitMove table_move;
+  BitMove killers[2];
+  BitMove moves[MAX_MOVES]; // the current stage's
+  int scores[MAX_MOVES];
+  int count;
+  int index;
+} MovePicker;
+
+typedef struct {
+  TranspositionTable *table;
+  PositionHistory *game; // positions before the search, ending with the root. NULL for none
+  Tablebases *tablebases; // NULL for none
+  OpeningBook *book;      // same
+  const EvalTable *eval;  // NULL for default_eval
+  SearchTrace *trace;     // main thread only, NULL for none
+  int features;           // FEATURE_* flags for every thread, SEARCH_FEATURES by default
+  std::atomic<bool> stop;
+  int num_threads;
+  SearchState *states; // num_threads of them, states[0] is the main thread
+
+  uint64_t nodes;      // all threads, last search
+  uint64_t tb_hits;    // same
+  uint64_t elapsed_us; // last search
+
+  // Passed on to the main thread's SearchState
+  void (*report)(SearchState *state, void *data);
+  void *report_data;
+} SearchThreads;
+
+int parse_search_features(const char *text);
+void init_search(SearchState *state, TranspositionTable *table, BitPosition *bp);
+void set_search_history(SearchState *state, PositionHistory *game);
+void init_move_picker(MovePicker *picker, SearchState *state, BitMove table_best, bool captures_only);
+BitMove next_move(MovePicker *picker, SearchState *state);
+int quiescence(SearchState *state, int alpha, int beta);
+int search(SearchState *state, int depth, int alpha, int beta);
+BitMove search_best_move(SearchState *state, int max_depth);
+
+int principal_variation(TranspositionTable *table, BitPosition *bp, BitMove *pv, int max_length);
+
+bool init_search_threads(SearchThreads *threads, TranspositionTable *table, int num_threads);
+void free_search_threads(SearchThreads *threads);
+BitMove parallel_search(SearchThreads *threads, BitPosition *bp, SearchLimits limits);
+
+inline uint64_t read_os_timer();
+
+#endif
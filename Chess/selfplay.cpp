@@ -0,0 +1,376 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+#include <cmath>
+#include <mutex>
+
+// Plays two configurations of the engine against each other, several
+// games at a time, to see whether a change makes it stronger or faster.
+// Every game has its own tables and search threads, nothing is shared
+// between games but the read only book and tablebases.
+//
+// Games come in pairs from the same opening with the colors swapped.
+// Openings are read from a file, one FEN per line, or made by playing a
+// few random moves from the start position, the same ones every run.
+//
+// Usage :
+//   selfplay [-games <count>] [-concurrency <count>] [-openings <fen file>]
+//            [-random <plies>] [-maxplies <plies>] [-tb <directory>]
+//            [engine options] [-a <engine option>] [-b <engine option>]
+//
+// Engine options apply to both engines, or to one after -a or -b:
+//   -eval <weights file> -depth <plies> -nodes <count> -movetime <ms>
+//   -threads <count> -hash <MB> -features <list, see parse_search_features>
+// The depth is 5 unless given, or unlimited when there is a node or time
+// budget without -depth, like uci -batch.
+//
+// Like: selfplay -games 200 -depth 6 -b -eval tuned.txt
+
+#define SELFPLAY_RANDOM_PLIES 6
+#define SELFPLAY_MAX_PLIES    400 // drawn after this many, so a game can't go on forever
+
+typedef struct {
+  const char *eval_file; // NULL for the material only defaults
+  EvalWeights weights;
+  EvalTable eval;
+  SearchLimits limits;
+  bool depth_given; // -depth was on the command line
+  int threads;
+  uint32_t table_mb;
+  int features;
+} EngineConfig;
+
+// One side of a game
+typedef struct {
+  EngineConfig *config;
+  TranspositionTable table;
+  SearchThreads threads;
+  uint64_t nodes;
+  uint64_t elapsed_us;
+} Engine;
+
+#define RESULT_WHITE_WINS 0
+#define RESULT_DRAW       1
+#define RESULT_BLACK_WINS 2
+
+typedef struct {
+  EngineConfig configs[2]; // a then b
+  Tablebases *tablebases;  // NULL for none
+
+  char (*openings)[MAX_FEN_LENGTH];
+  int num_openings;
+  int random_plies;
+  int max_plies;
+
+  int num_games;
+  std::atomic<int> next;
+
+  // For a, all games so far
+  std::mutex mutex;
+  int wins, draws, losses;
+  uint64_t nodes[2];
+  uint64_t elapsed_us[2];
+} Tournament;
+
+static bool init_engine(Engine *engine, EngineConfig *config, Tablebases *tablebases) {
+  engine->config = config;
+  engine->nodes = 0;
+  engine->elapsed_us = 0;
+  if (!init_table(&engine->table, config->table_mb)) return false;
+  if (!init_search_threads(&engine->threads, &engine->table, config->threads)) {
+    free_table(&engine->table);
+    return false;
+  }
+  engine->threads.eval = &config->eval;
+  engine->threads.features = config->features;
+  engine->threads.tablebases = tablebases;
+  return true;
+}
+
+static void free_engine(Engine *engine) {
+  free_search_threads(&engine->threads);
+  free_table(&engine->table);
+}
+
+// Kings only, or a single bishop or knight left
+static bool insufficient_material(BitPosition *bp) {
+  int count = popcount(bp->occupied);
+  if (count == 2) return true;
+  if (count != 3) return false;
+  Bitboard minors = bp->pieces[0][BISHOP] | bp->pieces[0][KNIGHT] | bp->pieces[1][BISHOP] | bp->pieces[1][KNIGHT];
+  return minors != 0;
+}
+
+inline uint64_t selfplay_random(uint64_t *seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  return *seed;
+}
+
+// Opening for a pair of games, false if the random moves ended the game
+static bool opening_position(Tournament *tournament, int pair, BitPosition *bp) {
+  if (tournament->num_openings) return parse_fen(bp, tournament->openings[pair % tournament->num_openings]);
+
+  parse_fen(bp, START_FEN);
+  uint64_t seed = 0x9E3779B97F4A7C15ULL * (pair + 1);
+  BitMove moves[MAX_MOVES];
+  for (int ply = 0; ply < tournament->random_plies; ply++) {
+    int count = generate_legal_moves(bp, moves);
+    if (!count) return false;
+    apply_move(bp, moves[selfplay_random(&seed) % count]);
+  }
+  return has_legal_move(bp);
+}
+
+// Returns one of RESULT_*, and why in reason
+static int play_game(Tournament *tournament, BitPosition *start, Engine *white, Engine *black,
+                     PositionHistory *history, int *plies, const char **reason) {
+  BitPosition bp = *start;
+  clear(&white->table);
+  clear(&black->table);
+  clear_history(history);
+  push_position(history, bp.hash);
+
+  for (*plies = 0; ; (*plies)++) {
+    BitMove moves[MAX_MOVES];
+    if (!generate_legal_moves(&bp, moves)) {
+      if (!in_check(&bp)) {
+        *reason = "stalemate";
+        return RESULT_DRAW;
+      }
+      *reason = "checkmate";
+      return bp.side == WHITE_SIDE ? RESULT_BLACK_WINS : RESULT_WHITE_WINS;
+    }
+    if (is_threefold(history)) {
+      *reason = "repetition";
+      return RESULT_DRAW;
+    }
+    if (bp.static_moves >= FIFTY_MOVE_PLIES) {
+      *reason = "fifty moves";
+      return RESULT_DRAW;
+    }
+    if (insufficient_material(&bp)) {
+      *reason = "material";
+      return RESULT_DRAW;
+    }
+    if (*plies >= tournament->max_plies) {
+      *reason = "too long";
+      return RESULT_DRAW;
+    }
+
+    Engine *engine = bp.side == WHITE_SIDE ? white : black;
+    engine->threads.game = history;
+    BitMove move = parallel_search(&engine->threads, &bp, engine->config->limits);
+    engine->nodes += engine->threads.nodes;
+    engine->elapsed_us += engine->threads.elapsed_us;
+    assert(!IS_NULL_MOVE(move) && is_legal(&bp, move));
+    apply_move(&bp, move);
+    push_position(history, bp.hash);
+  }
+}
+
+static void selfplay_worker(Tournament *tournament) {
+  Engine engines[2];
+  PositionHistory history;
+  bool ok = init_history(&history, SELFPLAY_MAX_PLIES);
+  ok = ok && init_engine(engines + 0, tournament->configs + 0, tournament->tablebases);
+  ok = ok && init_engine(engines + 1, tournament->configs + 1, tournament->tablebases);
+  if (!ok) {
+    printf("Could not allocate the engines\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int game;
+  while ((game = tournament->next++) < tournament->num_games) {
+    BitPosition start;
+    if (!opening_position(tournament, game / 2, &start)) {
+      // Nothing to play, count it as a draw so pairs stay even
+      std::lock_guard<std::mutex> lock(tournament->mutex);
+      tournament->draws++;
+      continue;
+    }
+
+    // a is white in even games
+    bool a_white = !(game & 1);
+    engines[0].nodes = engines[1].nodes = 0;
+    engines[0].elapsed_us = engines[1].elapsed_us = 0;
+    int plies;
+    const char *reason;
+    int result = play_game(tournament, &start, engines + (a_white ? 0 : 1), engines + (a_white ? 1 : 0),
+                           &history, &plies, &reason);
+
+    std::lock_guard<std::mutex> lock(tournament->mutex);
+    if (result == RESULT_DRAW)                         tournament->draws++;
+    else if ((result == RESULT_WHITE_WINS) == a_white) tournament->wins++;
+    else                                               tournament->losses++;
+    for (int i = 0; i < 2; i++) {
+      tournament->nodes[i] += engines[i].nodes;
+      tournament->elapsed_us[i] += engines[i].elapsed_us;
+    }
+    static const char *result_text[3] = { "1-0", "1/2-1/2", "0-1" };
+    printf("Game %4d : %s vs %s  %-7s  %-11s %3d plies  +%d =%d -%d\n", game + 1, a_white ? "a" : "b",
+           a_white ? "b" : "a", result_text[result], reason, plies,
+           tournament->wins, tournament->draws, tournament->losses);
+    fflush(stdout);
+  }
+
+  free_engine(engines + 0);
+  free_engine(engines + 1);
+  free_history(&history);
+}
+
+inline double elo_from_score(double score) {
+  return -400.0 * log10(1.0 / score - 1.0);
+}
+
+// Elo of a over b with a 95% interval, from the mean and spread of the
+// per game scores.
+static void print_elo(int wins, int draws, int losses) {
+  int games = wins + draws + losses;
+  if (!games) return;
+  double score = (wins + 0.5 * draws) / games;
+  double variance = (wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score) +
+                     losses * score * score) / games;
+  double margin = 1.96 * sqrt(variance / games);
+
+  printf("Score of a vs b : %d - %d - %d  [%.3f] %d games\n", wins, losses, draws, score, games);
+  if (score <= 0 || score >= 1) {
+    printf("Elo difference : %s\n", score <= 0 ? "-inf" : "+inf");
+    return;
+  }
+  double low = score - margin > 0 ? elo_from_score(score - margin) : -INFINITY;
+  double high = score + margin < 1 ? elo_from_score(score + margin) : INFINITY;
+  double elo = elo_from_score(score);
+  if (std::isinf(low) || std::isinf(high)) printf("Elo difference : %+.1f  (95%% %+.1f to %+.1f)\n", elo, low, high);
+  else printf("Elo difference : %+.1f +/- %.1f  (95%% %+.1f to %+.1f)\n", elo, (high - low) / 2, low, high);
+}
+
+static bool read_openings(Tournament *tournament, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) return false;
+  int capacity = 64;
+  tournament->openings = (char (*)[MAX_FEN_LENGTH]) malloc(capacity * MAX_FEN_LENGTH);
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = 0;
+    const char *fen = line + strspn(line, " \t");
+    BitPosition bp;
+    if (!*fen || *fen == '#' || !parse_fen(&bp, fen)) continue;
+    if (tournament->num_openings == capacity) {
+      capacity *= 2;
+      tournament->openings = (char (*)[MAX_FEN_LENGTH]) realloc(tournament->openings, capacity * MAX_FEN_LENGTH);
+    }
+    position_to_fen(&bp, tournament->openings[tournament->num_openings++]);
+  }
+  fclose(file);
+  return tournament->num_openings > 0;
+}
+
+// Applies one engine option to configs, returns how many arguments it took
+static int parse_engine_option(EngineConfig **configs, int count, int argc, char **argv, int i) {
+  if (i + 1 >= argc) return 0;
+  const char *value = argv[i + 1];
+  for (int c = 0; c < count; c++) {
+    EngineConfig *config = configs[c];
+    if (!strcmp(argv[i], "-eval"))          config->eval_file = value;
+    else if (!strcmp(argv[i], "-depth"))    config->limits.depth = atoi(value), config->depth_given = true;
+    else if (!strcmp(argv[i], "-nodes"))    config->limits.nodes = strtoull(value, NULL, 10);
+    else if (!strcmp(argv[i], "-movetime")) config->limits.time_us = strtoull(value, NULL, 10) * 1000;
+    else if (!strcmp(argv[i], "-threads"))  config->threads = atoi(value);
+    else if (!strcmp(argv[i], "-hash"))     config->table_mb = atoi(value);
+    else if (!strcmp(argv[i], "-features") && parse_search_features(value) >= 0) {
+      config->features = parse_search_features(value);
+    }
+    else return 0;
+  }
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  init_bitboards();
+  init_zobrist();
+
+  Tournament *tournament = new Tournament();
+  tournament->num_games = 100;
+  tournament->random_plies = SELFPLAY_RANDOM_PLIES;
+  tournament->max_plies = SELFPLAY_MAX_PLIES;
+  for (int i = 0; i < 2; i++) {
+    EngineConfig *config = tournament->configs + i;
+    config->eval_file = EVAL_WEIGHTS_FILE;
+    config->limits = { 5, 0, 0 };
+    config->depth_given = false;
+    config->threads = 1;
+    config->table_mb = 16;
+    config->features = SEARCH_FEATURES;
+  }
+  int concurrency = (int) std::thread::hardware_concurrency();
+  Tablebases tablebases;
+  init_tablebases(&tablebases);
+
+  for (int i = 1; i < argc; i++) {
+    EngineConfig *both[2] = { tournament->configs + 0, tournament->configs + 1 };
+    int taken = 0;
+    if (i + 1 < argc) {
+      if (!strcmp(argv[i], "-games"))            taken = 2, tournament->num_games = atoi(argv[i + 1]);
+      else if (!strcmp(argv[i], "-concurrency")) taken = 2, concurrency = atoi(argv[i + 1]);
+      else if (!strcmp(argv[i], "-random"))      taken = 2, tournament->random_plies = atoi(argv[i + 1]);
+      else if (!strcmp(argv[i], "-maxplies"))    taken = 2, tournament->max_plies = atoi(argv[i + 1]);
+      else if (!strcmp(argv[i], "-tb"))          taken = 2, load_tablebases(&tablebases, argv[i + 1]);
+      else if (!strcmp(argv[i], "-openings")) {
+        taken = 2;
+        if (!read_openings(tournament, argv[i + 1])) {
+          printf("No openings in %s\n", argv[i + 1]);
+          return EXIT_FAILURE;
+        }
+      } else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "-b")) {
+        EngineConfig *one = tournament->configs + (argv[i][1] == 'b');
+        taken = 1 + parse_engine_option(&one, 1, argc, argv, i + 1);
+        if (taken == 1) taken = 0;
+      } else {
+        taken = parse_engine_option(both, 2, argc, argv, i);
+      }
+    }
+    if (!taken) {
+      printf("Unknown option %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+    i += taken - 1;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    EngineConfig *config = tournament->configs + i;
+    // A budget on its own shouldn't also be capped by the default depth
+    if ((config->limits.nodes || config->limits.time_us) && !config->depth_given) config->limits.depth = 0;
+    config->weights = eval_weights;
+    if (config->eval_file && !load_eval_weights(&config->weights, config->eval_file)) {
+      printf("Could not load eval weights from %s, using material only\n", config->eval_file);
+    }
+    build_eval_table(&config->eval, &config->weights);
+  }
+  set_eval_weights(&tournament->configs[0].weights);
+  tournament->tablebases = tablebases.count ? &tablebases : NULL;
+
+  if (concurrency < 1) concurrency = 1;
+  if (concurrency > MAX_SEARCH_THREADS) concurrency = MAX_SEARCH_THREADS;
+  tournament->next = 0;
+  uint64_t start = read_os_timer();
+  std::thread workers[MAX_SEARCH_THREADS];
+  for (int i = 0; i < concurrency; i++) workers[i] = std::thread(selfplay_worker, tournament);
+  for (int i = 0; i < concurrency; i++) workers[i].join();
+
+  printf("\n");
+  print_elo(tournament->wins, tournament->draws, tournament->losses);
+  for (int i = 0; i < 2; i++) {
+    uint64_t elapsed = tournament->elapsed_us[i] ? tournament->elapsed_us[i] : 1;
+    printf("Engine %c : %llu nodes, %llu nps\n", 'a' + i, (unsigned long long) tournament->nodes[i],
+           (unsigned long long) (tournament->nodes[i] * 1000000 / elapsed));
+  }
+  printf("%d games, %d at a time, %.3f s\n", tournament->num_games, concurrency,
+         (read_os_timer() - start) / 1000000.0);
+
+  free(tournament->openings);
+  free_tablebases(&tablebases);
+  delete tournament;
+  return EXIT_SUCCESS;
+}
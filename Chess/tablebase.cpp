@@ -0,0 +1,394 @@
+
+#ifndef _CHESS_TABLEBASE_CPP_
+#define _CHESS_TABLEBASE_CPP_
+
+#include "tablebase.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Name order, strongest first
+static const PieceType tb_piece_order[5] = { KING, QUEEN, ROOK, BISHOP, KNIGHT };
+static const char tb_piece_chars[7] = { 0, 'P', 'R', 'B', 'N', 'K', 'Q' };
+
+void init_tablebases(Tablebases *tbs) {
+  tbs->count = 0;
+  tbs->max_pieces = 0;
+}
+
+// Parses KQvK into pieces, white first. Every side needs one king.
+static int parse_tablebase_name(const char *name, PieceType pieces[TB_MAX_PIECES]) {
+  int count = 0;
+  PieceType color = PWHITE;
+  int kings[2] = { 0, 0 };
+  for (const char *c = name; *c; c++) {
+    if (*c == 'v' && color == PWHITE) {
+      color = PBLACK;
+      continue;
+    }
+    PieceType type = EMPTY;
+    for (int i = 0; i < 5; i++) {
+      if (tb_piece_chars[tb_piece_order[i]] == *c) type = tb_piece_order[i];
+    }
+    if (type == EMPTY || count == TB_MAX_PIECES) return 0;
+    if (type == KING) kings[color == PBLACK]++;
+    pieces[count++] = type | color;
+  }
+  if (color != PBLACK || kings[0] != 1 || kings[1] != 1) return 0;
+  return count;
+}
+
+static void tablebase_name(PieceType *pieces, int count, char name[16]) {
+  char *c = name;
+  for (int i = 0; i < count; i++) {
+    if (i && side_of(pieces[i]) != side_of(pieces[i - 1])) *c++ = 'v';
+    *c++ = tb_piece_chars[pieces[i] & PMASK];
+  }
+  *c = 0;
+}
+
+// Name of the material on the board, with the sides swapped if flip
+static void position_name(BitPosition *bp, bool flip, char name[16]) {
+  char *c = name;
+  for (int side = 0; side < 2; side++) {
+    if (side) *c++ = 'v';
+    for (int i = 0; i < 5; i++) {
+      int count = popcount(bp->pieces[side ^ flip][tb_piece_order[i]]);
+      while (count--) *c++ = tb_piece_chars[tb_piece_order[i]];
+    }
+  }
+  *c = 0;
+}
+
+bool load_tablebase(Tablebases *tbs, const char *path) {
+  if (tbs->count == TB_MAX_TABLES) return false;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t) sizeof(TablebaseHeader)) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  Tablebase *table = tbs->tables + tbs->count;
+  TablebaseHeader *header = (TablebaseHeader *) data;
+  table->num_pieces = header->num_pieces;
+  // The piece count has to be checked before it sizes anything
+  bool ok = !memcmp(header->magic, TB_MAGIC, 4) && table->num_pieces > 2 &&
+    table->num_pieces <= TB_MAX_PIECES;
+  if (ok) {
+    table->entries = 2ULL << (6 * table->num_pieces);
+    ok = (size_t) st.st_size == sizeof(TablebaseHeader) + table->entries / 4 + table->entries;
+  }
+  for (int i = 0; ok && i < table->num_pieces; i++) {
+    table->pieces[i] = (PieceType) header->pieces[i];
+  }
+  if (ok) {
+    tablebase_name(table->pieces, table->num_pieces, table->name);
+    PieceType check[TB_MAX_PIECES];
+    ok = parse_tablebase_name(table->name, check) == table->num_pieces;
+  }
+  if (!ok) {
+    munmap(data, st.st_size);
+    return false;
+  }
+
+  table->data = (const uint8_t *) data;
+  table->size = st.st_size;
+  table->wdl = table->data + sizeof(TablebaseHeader);
+  table->dtz = table->wdl + table->entries / 4;
+  tbs->count++;
+  if (table->num_pieces > tbs->max_pieces) tbs->max_pieces = table->num_pieces;
+  return true;
+}
+
+// Every file with the extension, returns how many loaded
+int load_tablebases(Tablebases *tbs, const char *directory) {
+  DIR *dir = opendir(directory);
+  if (!dir) return 0;
+  int loaded = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    const char *extension = strrchr(entry->d_name, '.');
+    if (!extension || strcmp(extension, TB_EXTENSION)) continue;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+    loaded += load_tablebase(tbs, path);
+  }
+  closedir(dir);
+  return loaded;
+}
+
+void free_tablebases(Tablebases *tbs) {
+  for (int i = 0; i < tbs->count; i++) munmap((void *) tbs->tables[i].data, tbs->tables[i].size);
+  init_tablebases(tbs);
+}
+
+// Side to move then each piece's square, the first piece is the most
+// significant. Pieces of the same kind go in square order. flip reads
+// the board upside down with the colors swapped.
+static uint64_t table_index(Tablebase *table, BitPosition *bp, bool flip) {
+  uint64_t index = bp->side ^ flip;
+  Bitboard taken = 0;
+  for (int i = 0; i < table->num_pieces; i++) {
+    PieceType p = table->pieces[i];
+    int sq = lsb(bp->pieces[side_of(p) ^ flip][p & PMASK] & ~taken);
+    taken |= square_bit(sq);
+    index = index * 64 + (flip ? sq ^ 56 : sq);
+  }
+  return index;
+}
+
+static Tablebase *find_table(Tablebases *tbs, BitPosition *bp, bool *flip) {
+  char name[16];
+  for (int f = 0; f < 2; f++) {
+    position_name(bp, f, name);
+    for (int i = 0; i < tbs->count; i++) {
+      if (strcmp(tbs->tables[i].name, name)) continue;
+      *flip = f;
+      return tbs->tables + i;
+    }
+  }
+  return NULL;
+}
+
+// Castling rights make it a different position than the table has.
+// There are no pawn tables, and table names leave pawns out, so a pawn
+// would find the pawnless table. Bare kings are a draw without a table.
+bool probe_dtz(Tablebases *tbs, BitPosition *bp, int *wdl, int *dtz) {
+  int pieces = popcount(bp->occupied);
+  if (bp->castling) return false;
+  if (bp->pieces[WHITE_SIDE][PAWN] | bp->pieces[BLACK_SIDE][PAWN]) return false;
+  if (pieces == 2) {
+    *wdl = TB_DRAW;
+    *dtz = 0;
+    return true;
+  }
+  if (pieces > tbs->max_pieces) return false;
+
+  bool flip;
+  Tablebase *table = find_table(tbs, bp, &flip);
+  if (!table) return false;
+  uint64_t index = table_index(table, bp, flip);
+  *wdl = (table->wdl[index >> 2] >> ((index & 3) * 2)) & 3;
+  *dtz = table->dtz[index];
+  return *wdl != TB_INVALID;
+}
+
+bool probe_wdl(Tablebases *tbs, BitPosition *bp, int *wdl) {
+  int dtz;
+  return probe_dtz(tbs, bp, wdl, &dtz);
+}
+
+// Picks the move that keeps the result and makes progress: mate, then a
+// capture, then the smallest DTZ when winning, the largest when losing.
+// Always taking the smallest DTZ can't go around in circles, so the win
+// comes without searching.
+bool probe_root(Tablebases *tbs, BitPosition *bp, BitMove *best, int *wdl) {
+  int dtz;
+  if (!probe_dtz(tbs, bp, wdl, &dtz)) return false;
+
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(bp, moves);
+  int want = TB_WIN - *wdl; // for the other side after the move
+  int best_key = INT32_MAX;
+  *best = BitMove {};
+  for (int i = 0; i < count; i++) {
+    int child_wdl, child_dtz;
+    UndoInfo undo;
+    make_move(bp, moves[i], &undo);
+    bool ok = probe_dtz(tbs, bp, &child_wdl, &child_dtz);
+    unmake_move(bp, moves[i], &undo);
+    if (!ok) return false;
+    if (child_wdl != want) continue;
+
+    int key = 0;
+    if (*wdl == TB_WIN) key = child_dtz == 0 ? -2 : is_capture(moves[i]) ? -1 : child_dtz;
+    else if (*wdl == TB_LOSS) key = -child_dtz;
+    if (key < best_key) {
+      best_key = key;
+      *best = moves[i];
+    }
+  }
+  return count > 0;
+}
+
+#define TB_UNKNOWN 4 // only while generating
+
+// False if index isn't a position that can come up in a game
+static bool decode_index(Tablebase *table, uint64_t index, BitPosition *bp) {
+  clear(bp);
+  int squares[TB_MAX_PIECES];
+  for (int i = table->num_pieces - 1; i >= 0; i--) {
+    squares[i] = index & 63;
+    index >>= 6;
+  }
+  bp->side = (uint8_t) index;
+  for (int i = 0; i < table->num_pieces; i++) {
+    if (bp->occupied & square_bit(squares[i])) return false;
+    put_piece(bp, squares[i], table->pieces[i]);
+  }
+  return !king_attacked(bp, bp->side ^ 1);
+}
+
+inline Bitboard piece_attacks(PieceType type, int sq, Bitboard occupied) {
+  switch (type & PMASK) {
+    case KNIGHT: return knight_attack_table[sq];
+    case BISHOP: return bishop_attacks(sq, occupied);
+    case ROOK:   return rook_attacks(sq, occupied);
+    case QUEEN:  return queen_attacks(sq, occupied);
+    case KING:   return king_attack_table[sq];
+    default:     return 0;
+  }
+}
+
+// Flags every position one quiet move before index, so the next round
+// only looks at positions whose results could have changed. Moves are
+// reversible without pawns, a piece can go back wherever it attacks.
+static void mark_parents(Tablebase *table, uint64_t index, uint8_t *candidates) {
+  BitPosition bp;
+  decode_index(table, index, &bp);
+  int mover = bp.side ^ 1;
+  bp.side = mover;
+  Bitboard b = bp.pieces[mover][EMPTY];
+  while (b) {
+    int sq = pop_lsb(&b);
+    PieceType p = bp.squares[sq];
+    Bitboard targets = piece_attacks(p, sq, bp.occupied) & ~bp.occupied;
+    remove_piece(&bp, sq);
+    while (targets) {
+      int from = pop_lsb(&targets);
+      put_piece(&bp, from, p);
+      candidates[table_index(table, &bp, false)] = 1;
+      remove_piece(&bp, from);
+    }
+    put_piece(&bp, sq, p);
+  }
+}
+
+// Retrograde by rounds: positions decided in a round only use results
+// from before it, so the round a position is decided in is its DTZ.
+// Captures go to smaller tables, which have to be loaded in tbs already.
+bool generate_tablebase(Tablebases *tbs, const char *name, const char *path) {
+  Tablebase table = {};
+  table.num_pieces = parse_tablebase_name(name, table.pieces);
+  if (table.num_pieces < 3) return false;
+  tablebase_name(table.pieces, table.num_pieces, table.name);
+  table.entries = 2ULL << (6 * table.num_pieces);
+
+  uint8_t *wdl = (uint8_t *) malloc(table.entries);
+  uint8_t *dtz = (uint8_t *) calloc(table.entries, 1);
+  uint8_t *next = (uint8_t *) malloc(table.entries);
+  uint8_t *candidates = (uint8_t *) malloc(table.entries);
+  if (!wdl || !dtz || !next || !candidates) {
+    free(wdl);
+    free(dtz);
+    free(next);
+    free(candidates);
+    return false;
+  }
+
+  BitPosition bp;
+  BitMove moves[MAX_MOVES];
+  for (uint64_t i = 0; i < table.entries; i++) {
+    if (!decode_index(&table, i, &bp)) {
+      wdl[i] = TB_INVALID;
+    } else if (!has_legal_move(&bp)) {
+      wdl[i] = in_check(&bp) ? TB_LOSS : TB_DRAW;
+    } else {
+      wdl[i] = TB_UNKNOWN;
+    }
+    candidates[i] = wdl[i] == TB_UNKNOWN;
+  }
+
+  bool ok = true;
+  for (int round = 1; ok && round < 256; round++) {
+    memcpy(next, wdl, table.entries);
+    bool changed = false;
+    for (uint64_t i = 0; ok && i < table.entries; i++) {
+      if (wdl[i] != TB_UNKNOWN || !candidates[i]) continue;
+      decode_index(&table, i, &bp);
+      int count = generate_legal_moves(&bp, moves);
+
+      // Win if any move leaves the other side lost, lost if every move
+      // leaves them winning.
+      int best = TB_LOSS;
+      int longest = 0;
+      for (int m = 0; m < count; m++) {
+        int child_wdl, child_dtz;
+        UndoInfo undo;
+        make_move(&bp, moves[m], &undo);
+        if (is_capture(moves[m])) {
+          // Captures reset the count, the smaller table only says who wins
+          ok = probe_dtz(tbs, &bp, &child_wdl, &child_dtz);
+          child_dtz = 0;
+        } else {
+          uint64_t child = table_index(&table, &bp, false);
+          child_wdl = wdl[child];
+          child_dtz = dtz[child];
+        }
+        unmake_move(&bp, moves[m], &undo);
+        if (!ok) break;
+
+        if (child_wdl == TB_LOSS) {
+          best = TB_WIN;
+          break;
+        }
+        if (child_wdl != TB_WIN) best = TB_DRAW;
+        else if (child_dtz + 1 > longest) longest = child_dtz + 1;
+      }
+
+      if (ok && best != TB_DRAW) {
+        assert(best == TB_WIN || longest == round);
+        next[i] = best;
+        dtz[i] = round;
+        changed = true;
+      }
+    }
+    if (!changed) break;
+
+    memset(candidates, 0, table.entries);
+    for (uint64_t i = 0; i < table.entries; i++) {
+      if (next[i] != wdl[i]) mark_parents(&table, i, candidates);
+    }
+    uint8_t *t = wdl;
+    wdl = next;
+    next = t;
+  }
+
+  // Whatever is left can't be forced either way
+  for (uint64_t i = 0; i < table.entries; i++) {
+    if (wdl[i] == TB_UNKNOWN) wdl[i] = TB_DRAW;
+  }
+
+  FILE *file = ok ? fopen(path, "wb") : NULL;
+  if (file) {
+    TablebaseHeader header = {};
+    memcpy(header.magic, TB_MAGIC, 4);
+    header.num_pieces = table.num_pieces;
+    for (int i = 0; i < table.num_pieces; i++) header.pieces[i] = table.pieces[i];
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Packed over the next array, which isn't needed anymore
+    memset(next, 0, table.entries / 4);
+    for (uint64_t i = 0; i < table.entries; i++) next[i >> 2] |= wdl[i] << ((i & 3) * 2);
+    ok = ok && fwrite(next, 1, table.entries / 4, file) == table.entries / 4;
+    ok = ok && fwrite(dtz, 1, table.entries, file) == table.entries;
+    ok = !fclose(file) && ok;
+  } else {
+    ok = false;
+  }
+
+  free(wdl);
+  free(dtz);
+  free(next);
+  free(candidates);
+  return ok;
+}
+
+#endif
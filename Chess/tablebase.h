@@ -0,0 +1,73 @@
+
+#ifndef _CHESS_TABLEBASE_H_
+#define _CHESS_TABLEBASE_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// Endgame tables with the result of every position for some material,
+// like KQvK. Files are mmap'd read only, so a probe only pages in what it
+// touches and the OS shares the pages between processes.
+//
+// The format is our own, written by generate_tablebase (see tbgen.cpp):
+// a header, then 2 bits of WDL and a byte of DTZ for every index.
+// Positions are indexed by the side to move and the square of each piece,
+// in the order of the name, so a table has 2 * 64^n entries and most of
+// a 4 piece table is impossible positions. Only pawnless material is
+// supported, every capture goes to a smaller table.
+//
+// WDL is for the side to move. DTZ is the number of plies until the
+// next capture or mate with best play, 0 for draws. There is no fifty
+// move rule, a win is a win however long it takes.
+
+#define TB_LOSS    0
+#define TB_DRAW    1
+#define TB_WIN     2
+#define TB_INVALID 3 // can't happen, like the side not to move being in check
+
+#define TB_MAX_PIECES 4
+#define TB_MAX_TABLES 64
+
+#define TB_MAGIC "CTB1"
+#define TB_EXTENSION ".ctb"
+
+typedef struct {
+  char magic[4];
+  uint8_t num_pieces;
+  uint8_t pieces[TB_MAX_PIECES]; // PieceType with PBLACK, white pieces first
+  uint8_t unused[7];
+} TablebaseHeader;
+
+static_assert(sizeof(TablebaseHeader) == 16, "TablebaseHeader should be 16 bytes");
+
+typedef struct {
+  char name[16]; // KQvK, same as the file name without the extension
+  int num_pieces;
+  PieceType pieces[TB_MAX_PIECES];
+  uint64_t entries;
+
+  // Mapped file
+  const uint8_t *data;
+  size_t size;
+  const uint8_t *wdl; // 4 entries a byte, lowest bits first
+  const uint8_t *dtz;
+} Tablebase;
+
+typedef struct {
+  Tablebase tables[TB_MAX_TABLES];
+  int count;
+  int max_pieces; // positions with more pieces are never probed
+} Tablebases;
+
+void init_tablebases(Tablebases *tbs);
+int load_tablebases(Tablebases *tbs, const char *directory);
+bool load_tablebase(Tablebases *tbs, const char *path);
+void free_tablebases(Tablebases *tbs);
+
+bool probe_wdl(Tablebases *tbs, BitPosition *bp, int *wdl);
+bool probe_dtz(Tablebases *tbs, BitPosition *bp, int *wdl, int *dtz);
+bool probe_root(Tablebases *tbs, BitPosition *bp, BitMove *best, int *wdl);
+
+bool generate_tablebase(Tablebases *tbs, const char *name, const char *path);
+
+#endif
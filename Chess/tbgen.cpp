@@ -0,0 +1,36 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+// Generates endgame tables, see tablebase.h. Captures need the smaller
+// tables, so list those first or have them in the directory already.
+//
+// Usage :
+//   tbgen <directory> <material> ...   like tbgen tables KQvK KRvK KQvKR
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Usage : tbgen <directory> <material> ...\n");
+    return EXIT_FAILURE;
+  }
+  init_bitboards();
+  init_zobrist();
+
+  Tablebases tbs;
+  init_tablebases(&tbs);
+  load_tablebases(&tbs, argv[1]);
+
+  for (int i = 2; i < argc; i++) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s%s", argv[1], argv[i], TB_EXTENSION);
+    uint64_t start = read_os_timer();
+    if (!generate_tablebase(&tbs, argv[i], path) || !load_tablebase(&tbs, path)) {
+      printf("Could not generate %s, pawns aren't supported and smaller tables have to exist\n", argv[i]);
+      free_tablebases(&tbs);
+      return EXIT_FAILURE;
+    }
+    printf("%-8s %8.3f s\n", argv[i], (read_os_timer() - start) / 1000000.0);
+  }
+
+  free_tablebases(&tbs);
+  return EXIT_SUCCESS;
+}
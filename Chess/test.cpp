@@ -1,10 +1,993 @@
-#include "chess.h"
+#define CHESS_NO_MAIN
+#define SEARCH_TRACE 1
+#include "chess.cpp"
 
-int main() {
-  // TODO Implement a more complete set of tests. For now just take the text files as input.
+// TODO Implement a more complete set of tests. The text files still need to be fed to chess by hand.
+
+// The old test_for_checks, every piece tried against both kings. Kept
+// as a reference that doesn't share any code with the bitboards.
+CheckStatus brute_force_checks(ChessBoard *cb, int acting_player) {
+  CheckStatus result = NO_CHECK;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      Position p = { x, y };
+      int color = piece_color(get_piece(cb, x, y));
+      if (color == 2 && is_legal_move(cb, p, cb->king_1_pos)) {
+        if (acting_player == 1) return CHECK_ON_1;
+        else result = CHECK_ON_1;
+      }
+      if (color == 1 && is_legal_move(cb, p, cb->king_2_pos)) {
+        if (acting_player == 2) return CHECK_ON_2;
+        else result = CHECK_ON_2;
+      }
+    }
+  }
+  return result;
+}
+
+// Collects the moves the ComAllocator search would consider, using the
+// same filter as generate_children did before it used the bitboards.
+int legacy_legal_moves(ChessBoard *cb, int player, ChessMove *moves) {
+  int count = 0;
+  for (int y1 = 0; y1 < 8; y1++) {
+    for (int x1 = 0; x1 < 8; x1++) {
+      Position p1 = { x1, y1 };
+      if (piece_color(get_piece(cb, p1)) != player) continue;
+
+      for (int y2 = 0; y2 < 8; y2++) {
+        for (int x2 = 0; x2 < 8; x2++) {
+          Position p2 = { x2, y2 };
+          if (!is_legal_move(cb, p1, p2)) continue;
+
+          ChessBoard temp = *cb;
+          apply_move(&temp, p1, p2);
+          CheckStatus status = brute_force_checks(&temp, player);
+          if ((player == 1 && status == CHECK_ON_1) ||
+              (player == 2 && status == CHECK_ON_2)) continue;
+
+          moves[count++] = { p1, p2 };
+        }
+      }
+    }
+  }
+  return count;
+}
+
+inline int move_key(int from, int to) {
+  return from * 64 + to;
+}
+
+int compare_ints(const void *a, const void *b) {
+  return *(int *) a - *(int *) b;
+}
+
+// Compares the legal moves from both representations. Promotions are
+// collapsed to a single from/to pair since ChessBoard only asks for the
+// piece after the fact.
+bool bitboard_matches_legacy(ChessBoard *cb, int player) {
+  // king_move reads check_status to refuse castling out of check
+  cb->check_status = test_for_checks(cb, player);
+
+  ChessMove legacy[MAX_MOVES];
+  int legacy_count = legacy_legal_moves(cb, player, legacy);
+  int legacy_keys[MAX_MOVES];
+  for (int i = 0; i < legacy_count; i++) {
+    legacy_keys[i] = move_key(square_of(legacy[i].start.x, legacy[i].start.y),
+                              square_of(legacy[i].dest.x, legacy[i].dest.y));
+  }
+
+  BitPosition bp = to_bit_position(cb, player);
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(&bp, moves);
+  int keys[MAX_MOVES];
+  int key_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (is_promotion(moves[i]) && promotion_piece(moves[i]) != QUEEN) continue;
+    keys[key_count++] = move_key(moves[i].from, moves[i].to);
+  }
+
+  qsort(legacy_keys, legacy_count, sizeof(int), compare_ints);
+  qsort(keys, key_count, sizeof(int), compare_ints);
+
+  bool result = legacy_count == key_count;
+  for (int i = 0; result && i < key_count; i++) {
+    result = legacy_keys[i] == keys[i];
+  }
+
+  if (!result) {
+    printf("Move generation mismatch, player %d : legacy %d, bitboard %d\n", player, legacy_count, key_count);
+    print_board(cb->board);
+    for (int i = 0; i < legacy_count; i++) {
+      printf("legacy : "); print_move(legacy[i].start, legacy[i].dest);
+    }
+    for (int i = 0; i < count; i++) {
+      printf("bitboard : "); print_move(moves[i], stdout);
+    }
+  }
+  return result;
+}
+
+bool positions_match(BitPosition *a, BitPosition *b) {
+  for (int sq = 0; sq < 64; sq++) {
+    if (a->squares[sq] != b->squares[sq]) return false;
+  }
+  for (int side = 0; side < 2; side++) {
+    for (int type = 0; type < 7; type++) {
+      if (a->pieces[side][type] != b->pieces[side][type]) return false;
+    }
+  }
+  return a->occupied == b->occupied && a->side == b->side &&
+         a->castling == b->castling && a->en_passant == b->en_passant &&
+         a->static_moves == b->static_moves && a->eval == b->eval;
+}
+
+// Plays random games on both representations at once, checking move
+// generation at every ply and that both boards stay in sync.
+void test_random_games(int num_games, int max_moves) {
+  printf("Bitboard move generation test begin.\n");
+  srand(1234);
+  int total_positions = 0;
+
+  for (int game = 0; game < num_games; game++) {
+    ChessBoard cb;
+    init_hash(&cb);
+    BitPosition bp = to_bit_position(&cb, 1);
+    int player = 1;
+
+    for (int i = 0; i < max_moves; i++) {
+      assert(bitboard_matches_legacy(&cb, player));
+      total_positions++;
+
+      BitMove moves[MAX_MOVES];
+      int count = generate_legal_moves(&bp, moves);
+      if (!count || cb.static_moves >= 50) break;
+
+      BitMove move = moves[rand() % count];
+      Position p1 = { square_x(move.from), square_y(move.from) };
+      Position p2 = { square_x(move.to), square_y(move.to) };
+
+      apply_move(&bp, move);
+      apply_move(&cb, p1, p2);
+      if (is_promotion(move)) {
+        // Same as push_move, but without asking for input
+        PieceType promo = promotion_piece(move) | PMOVED;
+        if (player == 2) promo = promo | PBLACK;
+        set_piece(&cb, p2, promo);
+      }
+      player = get_other_player(player);
+      assert(test_for_checks(&cb, player) == brute_force_checks(&cb, player));
+      assert(cb.hash == compute_hash(&cb));
+      assert(cb.eval == compute_eval(&cb) && bp.eval == compute_eval(&bp));
+
+      BitPosition converted = to_bit_position(&cb, player);
+      assert(positions_match(&bp, &converted));
+    }
+  }
+
+  printf("Checked %d positions.\n", total_positions);
+  printf("Bitboard move generation test successful.\n\n");
+}
+
+void test_attack_tables() {
+  printf("Attack table test begin.\n");
+  // a1 rook on an empty board sees the whole a file and first rank
+  assert(rook_attacks(0, 0) == ((FILE_A | RANK_1) & ~1ULL));
+  // Blocked on b1 and a2, those squares are still attacked
+  assert(rook_attacks(0, square_bit(1) | square_bit(8)) == (square_bit(1) | square_bit(8)));
+  assert(popcount(bishop_attacks(square_of(3, 3), 0)) == 13);
+  assert(popcount(queen_attacks(square_of(3, 3), 0)) == 27);
+  assert(popcount(knight_attack_table[0]) == 2);
+  assert(popcount(king_attack_table[square_of(4, 4)]) == 8);
+  assert(pawn_attack_table[WHITE_SIDE][square_of(4, 1)] == (square_bit(square_of(3, 2)) | square_bit(square_of(5, 2))));
+
+  ChessBoard start;
+  BitPosition bp = to_bit_position(&start, 1);
+  BitMove moves[MAX_MOVES];
+  assert(generate_legal_moves(&bp, moves) == 20);
+  assert(bp.castling == CASTLE_ALL);
+  printf("Attack table test successful.\n\n");
+}
+
+void test_transposition_table() {
+  printf("Transposition table test begin.\n");
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  assert(table.bucket_mask + 1 == (1 << 20) / sizeof(TableBucket));
+  assert(((uint64_t) table.buckets) % 64 == 0);
+
+  ChessBoard cb;
+  init_hash(&cb);
+  uint64_t key = cb.hash;
+  TableEntry entry;
+  assert(!probe(&table, key, &entry));
+
+  store(&table, key, 3, BOUND_LOWER, 42, table_move(12, 28));
+  assert(probe(&table, key, &entry));
+  assert(entry.key == key);
+  assert(entry.depth == 3 && entry.bound == BOUND_LOWER && entry.score == 42);
+  assert(table_move_from(entry.move) == 12 && table_move_to(entry.move) == 28);
+
+  // Same key keeps its move when the new result doesn't have one
+  store(&table, key, 4, BOUND_UPPER, -7, NO_TABLE_MOVE);
+  assert(probe(&table, key, &entry));
+  assert(entry.depth == 4 && entry.score == -7 && entry.move == table_move(12, 28));
+
+  // Fill the bucket, the shallowest entry goes first
+  uint64_t stride = table.bucket_mask + 1;
+  for (int i = 1; i <= TABLE_BUCKET_SIZE; i++) {
+    store(&table, key + i * stride, 10 + i, BOUND_EXACT, i, NO_TABLE_MOVE);
+  }
+  assert(!probe(&table, key, &entry));
+  for (int i = 1; i <= TABLE_BUCKET_SIZE; i++) assert(probe(&table, key + i * stride, &entry));
+
+  // A torn write, data from one store with the key of another, is a miss
+  TableEntry *slots = table.buckets[key & table.bucket_mask].entries;
+  for (int i = 0; i < TABLE_BUCKET_SIZE; i++) slots[i].score ^= 1;
+  for (int i = 1; i <= TABLE_BUCKET_SIZE; i++) assert(!probe(&table, key + i * stride, &entry));
+
+  // Mate and tablebase scores move with the ply they are read back at
+  assert(score_from_table(score_to_table(MATE_SCORE - 5, 3), 7) == MATE_SCORE - 9);
+  assert(score_from_table(score_to_table(TB_WIN_SCORE - 5, 3), 7) == TB_WIN_SCORE - 9);
+  assert(score_from_table(score_to_table(-TB_WIN_SCORE + 5, 3), 7) == -TB_WIN_SCORE + 9);
+  assert(score_from_table(score_to_table(250, 3), 7) == 250);
+
+  // Transposed move orders land on the same hash
+  ChessBoard a = cb, b = cb;
+  apply_move(&a, { 6, 0 }, { 5, 2 }); apply_move(&a, { 6, 7 }, { 5, 5 });
+  apply_move(&a, { 1, 0 }, { 2, 2 });
+  apply_move(&b, { 1, 0 }, { 2, 2 }); apply_move(&b, { 6, 7 }, { 5, 5 });
+  apply_move(&b, { 6, 0 }, { 5, 2 });
+  assert(a.hash == b.hash);
+  assert(a.hash == compute_hash(&a));
+
+  free_table(&table);
+  printf("Transposition table test successful.\n\n");
+}
+
+// Every make_move in a random walk is undone again, position and hash
+// have to come back exactly.
+void test_make_unmake(int num_games, int max_moves) {
+  printf("Make/unmake test begin.\n");
+  srand(4321);
+  ChessBoard start;
+  BitPosition bp = to_bit_position(&start, 1);
+
+  for (int game = 0; game < num_games; game++) {
+    BitPosition game_start = bp;
+    BitMove played[512];
+    UndoInfo undo[512];
+    int ply = 0;
+
+    for (; ply < max_moves; ply++) {
+      BitMove moves[MAX_MOVES];
+      int count = generate_legal_moves(&bp, moves);
+      if (!count) break;
+
+      // Pins and checks have to agree with actually making the move
+      BitMove pseudo[MAX_MOVES];
+      int pseudo_count = generate_moves(&bp, pseudo);
+      CheckInfo info;
+      init_check_info(&bp, &info);
+      assert((info.checkers != 0) == in_check(&bp));
+      for (int i = 0; i < pseudo_count; i++) {
+        UndoInfo u;
+        make_move(&bp, pseudo[i], &u);
+        bool legal = !left_in_check(&bp);
+        unmake_move(&bp, pseudo[i], &u);
+        assert(legal == is_legal(&bp, pseudo[i], &info));
+      }
+      assert(has_legal_move(&bp) == (count > 0));
+
+      // Captures and quiets split the moves between them, and
+      // is_pseudo_legal agrees with the generator on any 16 bits
+      BitMove split[MAX_MOVES];
+      int split_count = generate_captures(&bp, split);
+      split_count += generate_quiets(&bp, split + split_count);
+      assert(split_count == pseudo_count);
+      for (int i = 0; i < pseudo_count; i++) {
+        assert(is_pseudo_legal(&bp, pseudo[i]));
+        int j = 0;
+        while (j < split_count && move_bits(split[j]) != move_bits(pseudo[i])) j++;
+        assert(j < split_count);
+      }
+      for (int i = 0; i < 64; i++) {
+        BitMove move = bits_move((uint16_t) rand());
+        // Most random bits are nonsense, so also try ones close to real moves
+        if (i & 1) {
+          BitMove near = pseudo[rand() % pseudo_count];
+          near.flags = move.flags;
+          move = near;
+        }
+        bool found = false;
+        for (int j = 0; j < pseudo_count; j++) found |= move_bits(pseudo[j]) == move_bits(move);
+        assert(is_pseudo_legal(&bp, move) == found);
+      }
+
+      // Try each move once before picking one to keep
+      for (int i = 0; i < count; i++) {
+        BitPosition before = bp;
+        UndoInfo u;
+        make_move(&bp, moves[i], &u);
+        assert(bp.hash == compute_hash(&bp) && bp.eval == compute_eval(&bp));
+        unmake_move(&bp, moves[i], &u);
+        assert(positions_match(&bp, &before) && bp.hash == before.hash);
+      }
+
+      played[ply] = moves[rand() % count];
+      make_move(&bp, played[ply], undo + ply);
+    }
+    while (ply--) unmake_move(&bp, played[ply], undo + ply);
+    assert(positions_match(&bp, &game_start) && bp.hash == game_start.hash);
+  }
+  printf("Make/unmake test successful.\n\n");
+}
+
+void test_search() {
+  printf("Search test begin.\n");
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchState *state = (SearchState *) malloc(sizeof(SearchState));
+  assert(init_history(&state->positions, 16));
+  BitPosition bp;
+
+  // Back rank mate, Ra1-a8
+  assert(parse_fen(&bp, "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  init_search(state, &table, &bp);
+  BitMove move = search_best_move(state, 3);
+  assert(move.from == square_of(0, 0) && move.to == square_of(0, 7));
+  assert(state->best_score == MATE_SCORE - 1);
+  assert(positions_match(&state->position, &bp) && state->position.hash == bp.hash);
+
+  // Win the hanging queen
+  assert(parse_fen(&bp, "4k3/8/8/3q4/8/8/3R4/4K3 w - - 0 1"));
+  init_search(state, &table, &bp);
+  move = search_best_move(state, 4);
+  assert(move.from == square_of(3, 1) && move.to == square_of(3, 4));
+
+  // One ply, only the quiescence search sees the pawn recapture
+  assert(parse_fen(&bp, "4k3/8/4p3/3p4/8/8/8/3QK3 w - - 0 1"));
+  init_search(state, &table, &bp);
+  move = search_best_move(state, 1);
+  assert(!(move.from == square_of(3, 0) && move.to == square_of(3, 4)));
+  init_search(state, &table, &bp);
+  assert(quiescence(state, -INFINITE_SCORE, INFINITE_SCORE) == evaluate_position(&bp));
+
+  // Pawn takes queen is tried before queen takes pawn
+  assert(parse_fen(&bp, "4k3/8/8/3q4/4P3/8/8/3QK3 w - - 0 1"));
+  init_search(state, &table, &bp);
+  MovePicker picker;
+  init_move_picker(&picker, state, NULL_MOVE, true);
+  move = next_move(&picker, state);
+  assert(move.from == square_of(4, 3) && move.to == square_of(3, 4));
+  move = next_move(&picker, state);
+  assert(move.from == square_of(3, 0) && move.to == square_of(3, 4));
+  assert(IS_NULL_MOVE(next_move(&picker, state)));
+
+  // Passing only flips the side and the hash, and comes back exactly
+  assert(parse_fen(&bp, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+  BitPosition passed = bp;
+  UndoInfo undo;
+  make_null_move(&passed, &undo);
+  assert(passed.hash != bp.hash);
+  unmake_null_move(&passed, &undo);
+  assert(positions_match(&passed, &bp) && passed.hash == bp.hash);
+
+  // Pruning doesn't lose the mate, and each switch parses
+  assert(parse_search_features("all") == ALL_FEATURES && parse_search_features("none") == 0);
+  assert(parse_search_features("null,futility") == (FEATURE_NULL_MOVE | FEATURE_FUTILITY));
+  assert(parse_search_features("lmr,nope") == -1);
+  assert(parse_fen(&bp, "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  for (int features = 0; features <= ALL_FEATURES; features++) {
+    clear(&table);
+    init_search(state, &table, &bp);
+    state->features = features;
+    move = search_best_move(state, 5);
+    assert(move.from == square_of(0, 0) && move.to == square_of(0, 7));
+    assert(state->best_score == MATE_SCORE - 1);
+  }
+
+  // Stalemated, nothing to return
+  assert(parse_fen(&bp, "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1"));
+  init_search(state, &table, &bp);
+  assert(IS_NULL_MOVE(search_best_move(state, 3)));
+
+  free_history(&state->positions);
+  free(state);
+  free_table(&table);
+  printf("Search test successful.\n\n");
+}
+
+// One thread has to give the same tree every time, more threads have to
+// agree on a forced result.
+void test_parallel_search() {
+  printf("Parallel search test begin.\n");
+  TranspositionTable table;
+  assert(init_table(&table, 4));
+  SearchThreads threads;
+  BitPosition bp;
+  assert(parse_fen(&bp, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+
+  assert(init_search_threads(&threads, &table, 1));
+  BitMove first = parallel_search(&threads, &bp, { 5, 0, 0 });
+  uint64_t first_nodes = threads.nodes;
+  int first_score = threads.states[0].best_score;
+  clear(&table);
+  BitMove second = parallel_search(&threads, &bp, { 5, 0, 0 });
+  assert(first.from == second.from && first.to == second.to);
+  assert(first_nodes == threads.nodes && first_score == threads.states[0].best_score);
+  free_search_threads(&threads);
 
-  return 0;
+  assert(init_search_threads(&threads, &table, 4));
+  assert(parse_fen(&bp, "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  BitMove move = parallel_search(&threads, &bp, { 5, 0, 0 });
+  assert(move.from == square_of(0, 0) && move.to == square_of(0, 7));
+  assert(threads.states[0].best_score == MATE_SCORE - 1);
+  assert(threads.nodes >= threads.states[0].nodes);
+  free_search_threads(&threads);
+
+  free_table(&table);
+  printf("Parallel search test successful.\n\n");
+}
+
+void test_search_limits() {
+  printf("Search limits test begin.\n");
+  TranspositionTable table;
+  assert(init_table(&table, 4));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  BitPosition bp;
+  assert(parse_fen(&bp, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+
+  // Node budget stops exactly and the same way every time
+  BitMove first = parallel_search(&threads, &bp, { 0, 20000, 0 });
+  assert(threads.nodes == 20000 && !IS_NULL_MOVE(first));
+  int depth = threads.states[0].completed_depth;
+  assert(depth >= 1);
+  clear(&table);
+  BitMove second = parallel_search(&threads, &bp, { 0, 20000, 0 });
+  assert(first.from == second.from && first.to == second.to);
+  assert(depth == threads.states[0].completed_depth);
+
+  // Time budget, the unfinished iteration is dropped
+  BitMove move = parallel_search(&threads, &bp, { 0, 0, 50000 });
+  assert(!IS_NULL_MOVE(move));
+  assert(threads.elapsed_us < 50000 + 50000);
+
+  // A stop that comes after the search is over doesn't cut the next one short
+  threads.stop = true;
+  parallel_search(&threads, &bp, { 6, 0, 0 });
+  assert(threads.states[0].completed_depth == 6);
+  free_search_threads(&threads);
+
+  // Same with helpers, they stop with the main thread
+  assert(init_search_threads(&threads, &table, 3));
+  move = parallel_search(&threads, &bp, { 0, 0, 50000 });
+  assert(!IS_NULL_MOVE(move));
+  assert(threads.elapsed_us < 50000 + 50000);
+  free_search_threads(&threads);
+
+  free_table(&table);
+  printf("Search limits test successful.\n\n");
+}
+
+void test_eval_weights() {
+  printf("Eval weights test begin.\n");
+  EvalWeights weights = eval_weights;
+  assert(!load_eval_weights(&weights, "no_such_file.txt"));
+
+  // The file that ships has to load, and mirror black onto white
+  assert(load_eval_weights(&weights, EVAL_WEIGHTS_FILE));
+  assert(weights.values[PAWN] == 100 && weights.values[QUEEN] == 900);
+  assert(weights.tables[PAWN][square_of(3, 3)] == 20);   // d4
+  assert(weights.tables[KING][square_of(6, 0)] == 30);   // g1
+  assert(weights.tables[KNIGHT][square_of(0, 7)] == -50); // a8
+
+  const char *path = "test_eval_weights.tmp";
+  FILE *file = fopen(path, "w");
+  fprintf(file, "# comment\nvalue pawn 90\ntable rook 1 2 3\n");
+  fclose(file);
+  EvalWeights broken = weights;
+  assert(!load_eval_weights(&broken, path));
+  assert(broken.values[PAWN] == 100); // untouched on failure
+  remove(path);
+
+  set_eval_weights(&weights);
+  ChessBoard start;
+  init_eval(&start);
+  assert(start.eval == 0);
+  ChessBoard cb = start;
+  apply_move(&cb, { 4, 1 }, { 4, 3 }); // e4, pawn table 0 -> 20
+  assert(cb.eval == 40 && cb.eval == compute_eval(&cb));
+  BitPosition bp = to_bit_position(&cb, 2);
+  assert(bp.eval == 40 && evaluate_position(&bp) == -40);
+
+  // A position on its own table keeps it through moves, default_eval is untouched
+  EvalWeights material = {{ 0, 100, 500, 330, 320, 0, 900 }};
+  EvalTable table;
+  build_eval_table(&table, &material);
+  set_eval_table(&bp, &table);
+  assert(bp.eval == 0);
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(&bp, moves);
+  for (int i = 0; i < count; i++) {
+    UndoInfo undo;
+    make_move(&bp, moves[i], &undo);
+    assert(bp.eval == compute_eval(&bp) && bp.eval_table == &table);
+    unmake_move(&bp, moves[i], &undo);
+  }
+  BitPosition fresh = to_bit_position(&cb, 2);
+  assert(fresh.eval == 40 && fresh.eval_table == &default_eval);
+  printf("Eval weights test successful.\n\n");
+}
+
+void test_check_detection() {
+  printf("Check detection test begin.\n");
+  BitPosition bp;
+  CheckInfo info;
+
+  // Bishop pinned on the e file can't move at all, the rook can't leave it
+  assert(parse_fen(&bp, "4k3/4r3/8/8/8/8/4B3/4K3 w - - 0 1"));
+  init_check_info(&bp, &info);
+  assert(info.pinned == square_bit(square_of(4, 1)) && !info.checkers);
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(&bp, moves);
+  for (int i = 0; i < count; i++) assert(moves[i].from == info.king);
+
+  // Double check, only king moves
+  assert(parse_fen(&bp, "4k3/8/8/8/8/3n4/8/R3K2r w - - 0 1"));
+  init_check_info(&bp, &info);
+  assert(popcount(info.checkers) == 2);
+  count = generate_legal_moves(&bp, moves);
+  assert(count > 0);
+  for (int i = 0; i < count; i++) assert(moves[i].from == info.king);
+
+  // En passant that would expose the king along the rank
+  assert(parse_fen(&bp, "8/8/8/K2pP2r/8/8/8/7k w - d6 0 1"));
+  init_check_info(&bp, &info);
+  BitMove ep = { (uint16_t) square_of(4, 4), (uint16_t) square_of(3, 5), MOVE_EN_PASSANT };
+  assert(!is_legal(&bp, ep, &info));
+
+  // Fool's mate on the legacy board
+  ChessBoard cb;
+  init_hash(&cb);
+  apply_move(&cb, { 5, 1 }, { 5, 2 });
+  apply_move(&cb, { 4, 6 }, { 4, 4 });
+  apply_move(&cb, { 6, 1 }, { 6, 3 });
+  apply_move(&cb, { 3, 7 }, { 7, 3 });
+  CheckStatus status;
+  assert(status_after_move(&cb, 2, &status) && status == CHECKMATE_ON_1);
+  assert(is_in_checkmate(&cb, 1));
+  assert(test_for_checks(&cb, 1) == CHECK_ON_1);
+  printf("Check detection test successful.\n\n");
+}
+
+void test_move_text() {
+  printf("Move text test begin.\n");
+  BitPosition bp;
+  assert(parse_fen(&bp, "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+
+  // Every legal move survives a round trip
+  BitMove moves[MAX_MOVES];
+  int count = generate_legal_moves(&bp, moves);
+  for (int i = 0; i < count; i++) {
+    char text[6];
+    move_to_string(moves[i], text);
+    BitMove parsed;
+    assert(parse_move(&bp, text, &parsed));
+    assert(parsed.from == moves[i].from && parsed.to == moves[i].to && parsed.flags == moves[i].flags);
+  }
+
+  BitMove move;
+  assert(!parse_move(&bp, "e1g1", &move));
+  assert(!parse_move(&bp, "e2", &move));
+  assert(parse_fen(&bp, "8/P7/8/8/8/8/8/k6K w - - 0 1"));
+  assert(parse_move(&bp, "a7a8n", &move) && promotion_piece(move) == KNIGHT);
+  assert(parse_move(&bp, "a7a8", &move) && promotion_piece(move) == QUEEN);
+
+  // The line starts with the move the search picked and is all legal
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  assert(parse_fen(&bp, "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  BitMove best = parallel_search(&threads, &bp, { 4, 0, 0 });
+  BitMove pv[MAX_PLY];
+  int length = principal_variation(&table, &bp, pv, MAX_PLY);
+  assert(length >= 1 && pv[0].from == best.from && pv[0].to == best.to);
+  for (int i = 0; i < length; i++) {
+    assert(is_legal(&bp, pv[i]));
+    apply_move(&bp, pv[i]);
+  }
+  free_search_threads(&threads);
+  free_table(&table);
+  printf("Move text test successful.\n\n");
+}
+
+void test_fen(int num_games, int max_moves) {
+  printf("FEN test begin.\n");
+  const char *fens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 b - - 13 58",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  };
+  BitPosition bp, parsed;
+  char fen[MAX_FEN_LENGTH];
+  for (int i = 0; i < (int) (sizeof(fens) / sizeof(*fens)); i++) {
+    assert(parse_fen(&bp, fens[i]));
+    position_to_fen(&bp, fen);
+    assert(!strcmp(fen, fens[i]));
+  }
+
+  // Random games, every position has to survive both formats
+  srand(2468);
+  for (int game = 0; game < num_games; game++) {
+    assert(parse_fen(&bp, fens[0]));
+    for (int ply = 0; ply < max_moves; ply++) {
+      position_to_fen(&bp, fen);
+      assert(parse_fen(&parsed, fen));
+      assert(positions_match(&bp, &parsed) && parsed.hash == bp.hash);
+      assert(parsed.move_number == bp.move_number);
+
+      PackedPosition packed, repacked;
+      assert(pack_position(&bp, &packed));
+      assert(unpack_position(&packed, &parsed));
+      assert(positions_match(&bp, &parsed) && parsed.hash == bp.hash);
+      assert(parsed.move_number == bp.move_number);
+      assert(pack_position(&parsed, &repacked) && !memcmp(&packed, &repacked, sizeof(packed)));
+
+      BitMove moves[MAX_MOVES];
+      int count = generate_legal_moves(&bp, moves);
+      if (!count) break;
+      BitMove move = moves[rand() % count];
+      UndoInfo undo;
+      BitPosition before = bp;
+      make_move(&bp, move, &undo);
+      assert(bp.move_number == before.move_number + (before.side == BLACK_SIDE));
+      unmake_move(&bp, move, &undo);
+      assert(bp.move_number == before.move_number);
+      apply_move(&bp, move);
+    }
+  }
+
+  // Garbage doesn't unpack
+  PackedPosition packed;
+  assert(parse_fen(&bp, fens[1]));
+  assert(pack_position(&bp, &packed));
+  packed.pieces[0] = 0x77;
+  assert(!unpack_position(&packed, &bp));
+  assert(!parse_fen(&bp, "8/8/8/8/8/8/8/8 w - - 0 1"));
+  printf("FEN test successful.\n\n");
 }
 
+void test_history() {
+  printf("History test begin.\n");
+  PositionHistory history;
+  assert(init_history(&history, 0));
+
+  // Against counting by hand. Few distinct keys with the same low bits,
+  // so probing and removing have to deal with long clusters.
+  srand(97531);
+  uint64_t keys[4096];
+  int size = 0;
+  for (int i = 0; i < 20000; i++) {
+    if (size && (rand() % 3 == 0 || size == 4096)) {
+      pop_position(&history);
+      size--;
+    } else {
+      uint64_t key = ((uint64_t) (rand() % 300) << 32) | (rand() % 4 ? 7 : rand());
+      assert(push_position(&history, key));
+      keys[size++] = key;
+    }
+    assert(history.size == size);
+    uint64_t key = keys[rand() % (size ? size : 1)];
+    int count = 0;
+    for (int j = 0; j < size; j++) count += keys[j] == key;
+    assert(repetitions(&history, key) == count);
+  }
+  while (size--) pop_position(&history);
+  assert(history.used == 0);
+  free_history(&history);
 
+  // Knights out and back twice is the third time for the start position
+  ChessBoard start;
+  init_hash(&start);
+  ChessStack *stack = new ChessStack();
+  assert(init_stack(stack, &start));
+  Position moves[4][2] = {{{ 6, 0 }, { 5, 2 }}, {{ 6, 7 }, { 5, 5 }}, {{ 5, 2 }, { 6, 0 }}, {{ 5, 5 }, { 6, 7 }}};
+  for (int i = 0; i < 8; i++) {
+    push_move(stack, moves[i % 4][0], moves[i % 4][1]);
+    assert(!is_threefold(&stack->history) == (i < 7));
+  }
+  assert(top_frame(stack)->count == 3);
+  BitPosition bp = to_bit_position(&top_frame(stack)->game, 1);
+  assert(stack->history.keys[stack->history.size - 1] == bp.hash);
 
+  // Mate on the board, unless it would be a repeat of an earlier position
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  assert(parse_fen(&bp, "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  BitMove mate = parallel_search(&threads, &bp, { 3, 0, 0 });
+  assert(threads.states[0].best_score > MATE_SCORE - MAX_PLY);
+
+  // Only positions since the last pawn move or capture are looked at
+  PositionHistory game;
+  assert(init_history(&game, 0));
+  BitPosition after = bp;
+  apply_move(&after, mate);
+  bp.static_moves = 1;
+  push_position(&game, after.hash);
+  push_position(&game, bp.hash);
+  threads.game = &game;
+  clear(&table);
+  BitMove move = parallel_search(&threads, &bp, { 3, 0, 0 });
+  assert(!same_move(move, mate) && !IS_MATE_SCORE(threads.states[0].best_score));
+
+  free_history(&game);
+  free_search_threads(&threads);
+  free_table(&table);
+  free_stack(stack);
+  delete stack;
+  printf("History test successful.\n\n");
+}
+
+int max_win_dtz(Tablebase *table) {
+  int longest = 0;
+  for (uint64_t i = 0; i < table->entries; i++) {
+    int wdl = (table->wdl[i >> 2] >> ((i & 3) * 2)) & 3;
+    if (wdl == TB_WIN && table->dtz[i] > longest) longest = table->dtz[i];
+  }
+  return longest;
+}
+
+void test_tablebase() {
+  printf("Tablebase test begin.\n");
+  char directory[] = "/tmp/chess_tb_XXXXXX";
+  assert(mkdtemp(directory));
+  char kqk[64], krk[64];
+  snprintf(kqk, sizeof(kqk), "%s/KQvK%s", directory, TB_EXTENSION);
+  snprintf(krk, sizeof(krk), "%s/KRvK%s", directory, TB_EXTENSION);
+
+  Tablebases tbs;
+  init_tablebases(&tbs);
+  assert(generate_tablebase(&tbs, "KQvK", kqk));
+  assert(generate_tablebase(&tbs, "KRvK", krk));
+  assert(!generate_tablebase(&tbs, "KPvK", kqk));
+  assert(load_tablebases(&tbs, directory) == 2 && tbs.max_pieces == 3);
+
+  // Longest wins are mate in 10 and mate in 16
+  for (int i = 0; i < tbs.count; i++) {
+    int longest = max_win_dtz(tbs.tables + i);
+    if (!strcmp(tbs.tables[i].name, "KQvK")) assert(longest == 19);
+    else assert(longest == 31);
+  }
+
+  // Mated, also with the colors the other way around
+  BitPosition bp;
+  int wdl, dtz;
+  assert(parse_fen(&bp, "8/8/8/8/8/8/1q6/K1k5 w - - 0 1"));
+  assert(probe_dtz(&tbs, &bp, &wdl, &dtz) && wdl == TB_LOSS && dtz == 0);
+  assert(parse_fen(&bp, "8/8/8/8/8/8/1Q6/k1K5 b - - 0 1"));
+  assert(probe_dtz(&tbs, &bp, &wdl, &dtz) && wdl == TB_LOSS && dtz == 0);
+  // Takes the queen, and stalemate
+  assert(parse_fen(&bp, "8/8/8/8/8/8/1Q6/k6K b - - 0 1"));
+  assert(probe_wdl(&tbs, &bp, &wdl) && wdl == TB_DRAW);
+  assert(parse_fen(&bp, "k7/2Q5/1K6/8/8/8/8/8 b - - 0 1"));
+  assert(probe_wdl(&tbs, &bp, &wdl) && wdl == TB_DRAW);
+  assert(parse_fen(&bp, "8/8/8/8/8/8/2Q5/k1K5 w - - 0 1"));
+  assert(probe_wdl(&tbs, &bp, &wdl) && wdl == TB_WIN);
+  assert(parse_fen(&bp, "4k3/8/8/8/8/8/P7/R3K3 w - - 0 1"));
+  assert(!probe_wdl(&tbs, &bp, &wdl));
+  // As if a 4 piece table were loaded, a pawn must not be read as KRvK
+  tbs.max_pieces = 4;
+  assert(parse_fen(&bp, "7K/8/8/8/8/8/1pk5/R7 b - - 0 1"));
+  assert(!probe_wdl(&tbs, &bp, &wdl) && !probe_dtz(&tbs, &bp, &wdl, &dtz));
+  tbs.max_pieces = 3;
+
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  threads.tablebases = &tbs;
+
+  // Both sides playing from the tables, mate comes right when DTZ says
+  assert(parse_fen(&bp, "8/8/8/3k4/8/8/8/R6K w - - 0 1"));
+  assert(probe_dtz(&tbs, &bp, &wdl, &dtz) && wdl == TB_WIN && dtz > 10);
+  for (int ply = 0; ply < dtz; ply++) {
+    BitMove move = parallel_search(&threads, &bp, { 1, 0, 0 });
+    assert(!IS_NULL_MOVE(move) && threads.nodes == 0);
+    apply_move(&bp, move);
+  }
+  BitMove moves[MAX_MOVES];
+  assert(generate_legal_moves(&bp, moves) == 0 && in_check(&bp));
+
+  // Taking the knight goes into a table the search knows is won
+  assert(parse_fen(&bp, "8/8/8/3k4/8/8/6n1/4K1Q1 w - - 0 1"));
+  clear(&table);
+  BitMove move = parallel_search(&threads, &bp, { 2, 0, 0 });
+  char text[6];
+  move_to_string(move, text);
+  assert(!strcmp(text, "g1g2") && threads.states[0].best_score > TB_WIN_SCORE - MAX_PLY);
+  assert(threads.tb_hits > 0);
+
+  free_search_threads(&threads);
+  free_table(&table);
+  free_tablebases(&tbs);
+  unlink(kqk);
+  unlink(krk);
+  rmdir(directory);
+  printf("Tablebase test successful.\n\n");
+}
+
+void test_book() {
+  printf("Book test begin.\n");
+  // SAN against the long form
+  const char *sans[][3] = {
+    { START_FEN, "Nf3", "g1f3" },
+    { START_FEN, "e4", "e2e4" },
+    { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O-O", "e1c1" },
+    { "r3k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1", "O-O+", "e8g8" },
+    { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "Rxa8+", "a1a8" },
+    { "4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "exd6", "e5d6" },
+    { "4k3/1P6/8/8/8/8/8/4K3 w - - 0 1", "b8=N", "b7b8n" },
+    { "4k3/1P6/8/8/8/8/8/4K3 w - - 0 1", "b8Q!?", "b7b8q" },
+    { "4k3/8/8/8/8/2N3N1/8/4K3 w - - 0 1", "Nce4", "c3e4" },
+    { "4k3/8/8/8/2N5/8/2N5/4K3 w - - 0 1", "N2e3", "c2e3" },
+  };
+  BitPosition bp;
+  BitMove move;
+  char text[6];
+  for (int i = 0; i < (int) (sizeof(sans) / sizeof(*sans)); i++) {
+    assert(parse_fen(&bp, sans[i][0]));
+    assert(parse_san(&bp, sans[i][1], &move));
+    move_to_string(move, text);
+    assert(!strcmp(text, sans[i][2]));
+  }
+  // Ambiguous, illegal and garbage
+  assert(parse_fen(&bp, "4k3/8/8/8/8/2N3N1/8/4K3 w - - 0 1"));
+  assert(!parse_san(&bp, "Ne4", &move));
+  assert(!parse_san(&bp, "Qe4", &move));
+  assert(!parse_san(&bp, "x", &move));
+
+  // Three games, one with a comment, a variation and a bad move, one from a FEN
+  char pgn_path[] = "/tmp/chess_pgn_XXXXXX";
+  int fd = mkstemp(pgn_path);
+  assert(fd >= 0);
+  FILE *pgn = fdopen(fd, "w");
+  fprintf(pgn, "[Event \"a\"]\n[Result \"1-0\"]\n\n1. e4 e5 {main line} 2. Nf3 (2. f4 exf4) Nc6 3. Bb5 a6 1-0\n\n");
+  fprintf(pgn, "[Event \"b\"]\n\n1.e4 $1 c5 2. Qh8 Nf6 3. Nf3 1/2-1/2\n\n");
+  fprintf(pgn, "[Event \"c\"]\n[FEN \"4k3/8/8/8/8/8/8/R3K2R w KQ - 0 1\"]\n\n1. O-O Kd7 *\n\n");
+  fprintf(pgn, "[Event \"d\"]\n\n1. d4 d5 0-1\n");
+  fclose(pgn);
+
+  BookBuilder builder;
+  init_book_builder(&builder);
+  pgn = fopen(pgn_path, "r");
+  assert(add_pgn_games(&builder, pgn, 3) == 4);
+  fclose(pgn);
+  // 3 + 2 (stops at Qh8) + 2 + 2
+  assert(builder.count == 9);
+
+  char book_path[] = "/tmp/chess_book_XXXXXX";
+  fd = mkstemp(book_path);
+  assert(fd >= 0);
+  close(fd);
+  assert(write_book(&builder, book_path, 1));
+  assert(builder.count == 8);
+  free_book_builder(&builder);
+
+  OpeningBook book;
+  init_book(&book);
+  assert(load_book(&book, book_path) && book.count == 8);
+  BitMove moves[MAX_MOVES];
+  int counts[MAX_MOVES];
+  assert(parse_fen(&bp, START_FEN));
+  assert(book_moves(&book, &bp, moves, counts, MAX_MOVES) == 2 && counts[0] == 2 && counts[1] == 1);
+  assert(book_move(&book, &bp, 0, &move));
+  move_to_string(move, text);
+  assert(!strcmp(text, "e2e4"));
+  bool seen_d4 = false;
+  for (uint64_t random = 1; random < 10; random++) {
+    assert(book_move(&book, &bp, random, &move));
+    move_to_string(move, text);
+    seen_d4 |= !strcmp(text, "d2d4");
+  }
+  assert(seen_d4);
+  assert(parse_fen(&bp, "4k3/8/8/8/8/8/8/R3K2R w KQ - 0 1"));
+  assert(book_move(&book, &bp, 0, &move) && is_castle(move));
+
+  // Played without searching, and searched once out of the book
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  threads.book = &book;
+  assert(parse_fen(&bp, START_FEN));
+  apply_move(&bp, bits_move(move_bits(moves[0])));
+  move = parallel_search(&threads, &bp, { 3, 0, 0 });
+  move_to_string(move, text);
+  assert(threads.nodes == 0 && (!strcmp(text, "e7e5") || !strcmp(text, "c7c5")));
+  assert(parse_fen(&bp, "rnbqkbnr/pppppppp/8/8/8/7N/PPPPPPPP/RNBQKB1R b KQkq - 1 1"));
+  move = parallel_search(&threads, &bp, { 3, 0, 0 });
+  assert(!IS_NULL_MOVE(move) && threads.nodes > 0);
+
+  // Anything else isn't a book
+  assert(!load_book(&book, pgn_path));
+  free_search_threads(&threads);
+  free_table(&table);
+  free_book(&book);
+  unlink(pgn_path);
+  unlink(book_path);
+  printf("Book test successful.\n\n");
+}
+
+void test_trace() {
+  printf("Trace test begin.\n");
+  char path[] = "/tmp/chess_trace_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  TranspositionTable table;
+  assert(init_table(&table, 1));
+  SearchThreads threads;
+  assert(init_search_threads(&threads, &table, 1));
+  SearchTrace *trace = (SearchTrace *) malloc(sizeof(SearchTrace));
+  assert(open_trace(trace, path));
+  threads.trace = trace;
+  BitPosition bp;
+  assert(parse_fen(&bp, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+  BitMove move = parallel_search(&threads, &bp, { 3, 0, 0 });
+  uint64_t records = trace->records;
+  close_trace(trace);
+  free(trace);
+
+  // A record for every node, the last one is the root of the last iteration
+  assert(records == threads.nodes);
+  FILE *file = fopen(path, "rb");
+  TraceHeader header;
+  assert(fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic, TRACE_MAGIC, 4));
+  TraceRecord record, last = {};
+  uint64_t count = 0, roots = 0;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    assert(record.reason < TRACE_REASONS && record.ply < MAX_PLY);
+    assert(!(record.flags & TRACE_QUIESCENCE) || record.depth == 0);
+    roots += record.ply == 0;
+    last = record;
+    count++;
+  }
+  fclose(file);
+  assert(count == records && roots >= 3);
+  assert(last.ply == 0 && last.depth == 3 && last.move == move_bits(move));
+  assert(last.score == threads.states[0].best_score && last.key == (uint32_t) bp.hash);
+
+  free_search_threads(&threads);
+  free_table(&table);
+  unlink(path);
+  printf("Trace test successful.\n\n");
+}
+
+int main() {
+  init_bitboards();
+  init_zobrist();
+  test_eval_weights();
+  test_transposition_table();
+  test_attack_tables();
+  test_check_detection();
+  test_random_games(200, 200);
+  test_make_unmake(50, 200);
+  test_search();
+  test_parallel_search();
+  test_search_limits();
+  test_move_text();
+  test_fen(50, 200);
+  test_history();
+  test_tablebase();
+  test_book();
+  test_trace();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+
+#ifndef _CHESS_TRACE_CPP_
+#define _CHESS_TRACE_CPP_
+
+#include "trace.h"
+
+bool open_trace(SearchTrace *trace, const char *path) {
+  trace->file = fopen(path, "wb");
+  trace->records = 0;
+  trace->count = 0;
+  if (!trace->file) return false;
+  TraceHeader header = {};
+  memcpy(header.magic, TRACE_MAGIC, 4);
+  header.record_size = sizeof(TraceRecord);
+  return fwrite(&header, sizeof(header), 1, trace->file) == 1;
+}
+
+void flush_trace(SearchTrace *trace) {
+  if (trace->count) fwrite(trace->buffer, sizeof(TraceRecord), trace->count, trace->file);
+  trace->count = 0;
+}
+
+void close_trace(SearchTrace *trace) {
+  if (!trace->file) return;
+  flush_trace(trace);
+  fclose(trace->file);
+  trace->file = NULL;
+}
+
+inline int16_t trace_clamp(int value) {
+  return (int16_t) (value < INT16_MIN ? INT16_MIN : value > INT16_MAX ? INT16_MAX : value);
+}
+
+inline void trace_node(SearchTrace *trace, uint64_t key, int ply, int depth, int alpha, int beta,
+                       int score, uint16_t move, int reason, int flags) {
+  TraceRecord *record = trace->buffer + trace->count++;
+  record->key = (uint32_t) key;
+  record->alpha = trace_clamp(alpha);
+  record->beta = trace_clamp(beta);
+  record->score = trace_clamp(score);
+  record->move = move;
+  record->ply = (uint8_t) ply;
+  record->depth = (uint8_t) (depth > 0 ? depth : 0);
+  record->reason = (uint8_t) reason;
+  record->flags = (uint8_t) flags;
+  trace->records++;
+  if (trace->count == TRACE_BUFFER_RECORDS) flush_trace(trace);
+}
+
+#endif
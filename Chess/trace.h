@@ -0,0 +1,94 @@
+
+#ifndef _CHESS_TRACE_H_
+#define _CHESS_TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+
+// Binary trace of a search, one fixed size record per node as it returns,
+// for finding out why a search did what it did. tracedump (tracedump.cpp)
+// turns a trace back into text.
+//
+// Compiled in only with SEARCH_TRACE (the makefile sets it for the -O0
+// chess build), and even then only written when a SearchTrace is passed
+// in. Without it the TRACE_* macros are empty, so timed builds don't pay
+// anything. Records are buffered and written with fwrite, nothing is
+// formatted while searching.
+//
+// Records come in the order nodes return, so a node's children are the
+// records just before it with ply one higher. Each iteration ends with
+// the root's record at ply 0.
+
+#ifndef SEARCH_TRACE
+#define SEARCH_TRACE 0
+#endif
+
+#define TRACE_MAGIC "CTR1"
+
+// Why a node returned
+#define TRACE_EXACT        0 // score inside the window
+#define TRACE_FAIL_LOW     1 // no move got above alpha
+#define TRACE_BETA_CUTOFF  2
+#define TRACE_TABLE_CUTOFF 3 // transposition table entry was enough
+#define TRACE_DRAW         4 // repetition or fifty moves
+#define TRACE_TABLEBASE    5
+#define TRACE_MATE         6 // side to move is mated
+#define TRACE_STALEMATE    7
+#define TRACE_STAND_PAT    8 // quiescence, static eval was enough
+#define TRACE_MAX_PLY      9
+#define TRACE_STOPPED      10
+#define TRACE_NULL_MOVE    11 // passing failed high
+#define TRACE_REASONS      12
+
+#define TRACE_QUIESCENCE 1 // TraceRecord::flags
+
+typedef struct {
+  char magic[4];
+  uint32_t record_size;
+} TraceHeader;
+
+typedef struct {
+  uint32_t key; // low bits of the position hash
+  int16_t alpha, beta; // window the node was called with, clamped
+  int16_t score;
+  uint16_t move; // best move, move_bits, 0 if none
+  uint8_t ply;
+  uint8_t depth; // remaining depth, 0 in quiescence
+  uint8_t reason; // TRACE_*
+  uint8_t flags;
+} TraceRecord;
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord should be 16 bytes");
+
+#define TRACE_BUFFER_RECORDS 4096
+
+typedef struct {
+  FILE *file;
+  uint64_t records; // written so far, including the buffered ones
+  int count;        // in buffer
+  TraceRecord buffer[TRACE_BUFFER_RECORDS];
+} SearchTrace;
+
+bool open_trace(SearchTrace *trace, const char *path);
+void close_trace(SearchTrace *trace);
+void flush_trace(SearchTrace *trace);
+inline void trace_node(SearchTrace *trace, uint64_t key, int ply, int depth, int alpha, int beta,
+                       int score, uint16_t move, int reason, int flags);
+
+#if SEARCH_TRACE
+// TRACE if trace isn't NULL, TRACE_RETURN also returns the score
+#define TRACE(TRACE_PTR, ...) do { if (TRACE_PTR) trace_node(TRACE_PTR, __VA_ARGS__); } while (0)
+#define TRACE_RETURN(TRACE_PTR, KEY, PLY, DEPTH, ALPHA, BETA, SCORE, MOVE, REASON, FLAGS) do { \
+    int trace_score = (SCORE); \
+    if (TRACE_PTR) trace_node(TRACE_PTR, KEY, PLY, DEPTH, ALPHA, BETA, trace_score, MOVE, REASON, FLAGS); \
+    return trace_score; \
+  } while (0)
+#else
+#define TRACE(TRACE_PTR, ...) do {} while (0)
+#define TRACE_RETURN(TRACE_PTR, KEY, PLY, DEPTH, ALPHA, BETA, SCORE, MOVE, REASON, FLAGS) do { \
+    (void) (ALPHA); \
+    return (SCORE); \
+  } while (0)
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+// Prints a search trace written with SEARCH_TRACE (see trace.h) as text.
+//
+// Usage :
+//   tracedump <trace file>                  every record, indented by ply
+//   tracedump <trace file> -ply <max>       only records at most max plies deep
+//   tracedump <trace file> -summary         counts by reason and ply instead
+
+static const char *trace_reason_names[TRACE_REASONS] = {
+  "exact", "fail low", "beta cutoff", "table cutoff", "draw", "tablebase",
+  "mate", "stalemate", "stand pat", "max ply", "stopped", "null move",
+};
+
+static void print_record(TraceRecord *record) {
+  printf("%*s%2d ", record->ply * 2, "", record->ply);
+  if (record->flags & TRACE_QUIESCENCE) printf("q   ");
+  else printf("d%-2d ", record->depth);
+
+  char text[6] = "-";
+  if (record->move) move_to_string(bits_move(record->move), text);
+  const char *reason = record->reason < TRACE_REASONS ? trace_reason_names[record->reason] : "?";
+  printf("%-5s [%d, %d] %d %s %08x\n", text, record->alpha, record->beta, record->score, reason, record->key);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage : tracedump <trace file> [-ply <max>] [-summary]\n");
+    return EXIT_FAILURE;
+  }
+  int max_ply = MAX_PLY;
+  bool summary = false;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-summary")) summary = true;
+    else if (!strcmp(argv[i], "-ply") && i + 1 < argc) max_ply = atoi(argv[++i]);
+  }
+
+  FILE *file = fopen(argv[1], "rb");
+  TraceHeader header;
+  if (!file || fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) ||
+      header.record_size != sizeof(TraceRecord)) {
+    printf("%s isn't a trace\n", argv[1]);
+    if (file) fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t total = 0, quiescence = 0, iterations = 0;
+  uint64_t reasons[TRACE_REASONS + 1] = {};
+  uint64_t plies[MAX_PLY] = {};
+  TraceRecord records[1024];
+  size_t count;
+  while ((count = fread(records, sizeof(TraceRecord), 1024, file)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      TraceRecord *record = records + i;
+      total++;
+      quiescence += (record->flags & TRACE_QUIESCENCE) != 0;
+      iterations += record->ply == 0;
+      reasons[record->reason < TRACE_REASONS ? record->reason : TRACE_REASONS]++;
+      if (record->ply < MAX_PLY) plies[record->ply]++;
+      if (!summary && record->ply <= max_ply) print_record(record);
+    }
+  }
+  fclose(file);
+
+  if (summary) {
+    printf("%llu nodes, %llu in quiescence, %llu root searches\n", (unsigned long long) total,
+           (unsigned long long) quiescence, (unsigned long long) iterations);
+    for (int i = 0; i < TRACE_REASONS; i++) {
+      if (reasons[i]) printf("  %-13s %12llu\n", trace_reason_names[i], (unsigned long long) reasons[i]);
+    }
+    if (reasons[TRACE_REASONS]) printf("  %-13s %12llu\n", "unknown", (unsigned long long) reasons[TRACE_REASONS]);
+    printf("By ply :\n");
+    for (int ply = 0; ply < MAX_PLY; ply++) {
+      if (plies[ply]) printf("  %2d %12llu\n", ply, (unsigned long long) plies[ply]);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+
+#ifndef _CHESS_TRANSPOSITION_CPP_
+#define _CHESS_TRANSPOSITION_CPP_
+
+#include "transposition.h"
+
+uint64_t zobrist_pieces[2][7][64];
+uint64_t zobrist_castling[16];
+uint64_t zobrist_en_passant[8];
+uint64_t zobrist_side;
+
+static bool zobrist_initialized = false;
+
+// splitmix64, fixed seed so hashes are stable between runs
+static uint64_t zobrist_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void init_zobrist() {
+  if (zobrist_initialized) return;
+  uint64_t seed = 20180623;
+
+  for (int side = 0; side < 2; side++) {
+    for (int type = PAWN; type <= QUEEN; type++) {
+      for (int sq = 0; sq < 64; sq++) {
+        zobrist_pieces[side][type][sq] = zobrist_random(&seed);
+      }
+    }
+  }
+  // Each right gets its own key, combinations are the xor of those
+  uint64_t rights[4];
+  for (int i = 0; i < 4; i++) rights[i] = zobrist_random(&seed);
+  for (int mask = 0; mask < 16; mask++) {
+    zobrist_castling[mask] = 0;
+    for (int i = 0; i < 4; i++) {
+      if (mask & (1 << i)) zobrist_castling[mask] ^= rights[i];
+    }
+  }
+  for (int x = 0; x < 8; x++) zobrist_en_passant[x] = zobrist_random(&seed);
+  zobrist_side = zobrist_random(&seed);
+
+  zobrist_initialized = true;
+}
+
+inline uint64_t zobrist_piece(PieceType p, int sq) {
+  p &= FULL_MASK;
+  return zobrist_pieces[side_of(p)][p & PMASK][sq];
+}
+
+// Full recompute, apply_move and set_piece keep cb->hash up to date after this.
+uint64_t compute_hash(ChessBoard *cb) {
+  uint64_t result = 0;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      result ^= zobrist_piece(cb->board[y][x], square_of(x, y));
+    }
+  }
+  result ^= zobrist_castling[castling_rights(cb)];
+  if (cb->en_passant.x >= 0) result ^= zobrist_en_passant[cb->en_passant.x];
+  return result;
+}
+
+uint64_t compute_hash(BitPosition *bp) {
+  uint64_t result = 0;
+  for (int sq = 0; sq < 64; sq++) result ^= zobrist_piece(bp->squares[sq], sq);
+  result ^= zobrist_castling[bp->castling];
+  if (bp->en_passant != NO_SQUARE) result ^= zobrist_en_passant[square_x(bp->en_passant)];
+  if (bp->side == BLACK_SIDE) result ^= zobrist_side;
+  return result;
+}
+
+// NOTE : Needs to be called on any board that wasn't made by copying or
+// applying moves to a board that already had its hash.
+inline void init_hash(ChessBoard *cb) {
+  cb->hash = compute_hash(cb);
+}
+
+bool init_table(TranspositionTable *table, uint32_t megabytes) {
+  // Round down to a power of 2 so the key can be masked
+  uint64_t count = ((uint64_t) megabytes << 20) / sizeof(TableBucket);
+  if (!count) return false;
+  while (count & (count - 1)) count &= count - 1;
+
+  void *memory = NULL;
+  if (posix_memalign(&memory, alignof(TableBucket), count * sizeof(TableBucket))) {
+    *table = {};
+    return false;
+  }
+
+  table->buckets = (TableBucket *) memory;
+  table->bucket_mask = count - 1;
+  table->generation = 0;
+  clear(table);
+  return true;
+}
+
+void free_table(TranspositionTable *table) {
+  free(table->buckets);
+  *table = {};
+}
+
+void clear(TranspositionTable *table) {
+  memset(table->buckets, 0, (table->bucket_mask + 1) * sizeof(TableBucket));
+}
+
+// Ages the existing entries so they are replaced first
+inline void new_search(TranspositionTable *table) {
+  table->generation = (table->generation + 1) & 63;
+}
+
+inline TableBucket *get_bucket(TranspositionTable *table, uint64_t key) {
+  return table->buckets + (key & table->bucket_mask);
+}
+
+inline uint64_t entry_data(TableEntry *entry) {
+  uint64_t data;
+  memcpy(&data, (char *) entry + sizeof(entry->key), sizeof(data));
+  return data;
+}
+
+// Copies the entry out, so a thread writing the same slot afterwards
+// can't change it under the caller.
+inline bool probe(TranspositionTable *table, uint64_t key, TableEntry *result) {
+  TableBucket *bucket = get_bucket(table, key);
+  for (int i = 0; i < TABLE_BUCKET_SIZE; i++) {
+    TableEntry entry = bucket->entries[i];
+    if ((entry.key ^ entry_data(&entry)) == key && entry.bound != BOUND_NONE) {
+      *result = entry;
+      result->key = key;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces the entry for the same key if there is one, otherwise the
+// shallowest entry, preferring ones left over from older searches.
+inline void store(TranspositionTable *table, uint64_t key, int depth, int bound, int score, uint16_t move) {
+  TableBucket *bucket = get_bucket(table, key);
+  TableEntry *replace = bucket->entries;
+  int replace_value = INT_MAX;
+
+  for (int i = 0; i < TABLE_BUCKET_SIZE; i++) {
+    TableEntry entry = bucket->entries[i];
+    bool same_key = (entry.key ^ entry_data(&entry)) == key;
+    if (same_key || entry.bound == BOUND_NONE) {
+      replace = bucket->entries + i;
+      // Keep the old move if we don't have a better one
+      if (same_key && move == NO_TABLE_MOVE) move = entry.move;
+      break;
+    }
+    int age = (table->generation - entry.generation) & 63;
+    int value = entry.depth - 8 * age;
+    if (value < replace_value) {
+      replace_value = value;
+      replace = bucket->entries + i;
+    }
+  }
+
+  TableEntry result;
+  result.score = score;
+  result.move = move;
+  result.depth = depth;
+  result.bound = bound;
+  result.generation = table->generation;
+  result.key = key ^ entry_data(&result);
+  *replace = result;
+}
+
+// from | (to << 6), the same bits as a quiet BitMove. ChessBoard moves
+// only have squares.
+inline uint16_t table_move(int from, int to) {
+  return (uint16_t) (from | (to << 6));
+}
+
+inline uint16_t table_move(BitMove move) {
+  return move_bits(move);
+}
+
+inline int table_move_from(uint16_t move) {
+  return move & 63;
+}
+
+inline int table_move_to(uint16_t move) {
+  return (move >> 6) & 63;
+}
+
+#endif
@@ -0,0 +1,74 @@
+
+#ifndef _CHESS_TRANSPOSITION_H_
+#define _CHESS_TRANSPOSITION_H_
+
+#include <cstdint>
+
+// Zobrist keys. Pieces are indexed [side][type][square] like
+// BitPosition::pieces, with [side][EMPTY] left as 0.
+// The side to move is not part of ChessBoard, so callers xor in
+// zobrist_side themselves when black is to move.
+extern uint64_t zobrist_pieces[2][7][64];
+extern uint64_t zobrist_castling[16];
+extern uint64_t zobrist_en_passant[8];
+extern uint64_t zobrist_side;
+
+void init_zobrist();
+
+inline uint64_t zobrist_piece(PieceType p, int sq);
+uint64_t compute_hash(ChessBoard *cb);
+uint64_t compute_hash(BitPosition *bp);
+inline void init_hash(ChessBoard *cb);
+
+// Bound types, how a stored score relates to the real value:
+#define BOUND_NONE  0
+#define BOUND_UPPER 1 // failed low, real value <= score
+#define BOUND_LOWER 2 // failed high, real value >= score
+#define BOUND_EXACT 3
+
+#define NO_TABLE_MOVE 0
+
+// Entries are read and written by several search threads without locks.
+// key is stored xor'ed with the other 8 bytes, so a torn write from two
+// threads shows up as a key mismatch instead of a wrong score (Hyatt).
+typedef struct {
+  uint64_t key;        // key ^ entry_data
+  int32_t  score;
+  uint16_t move;       // see table_move, NO_TABLE_MOVE if unknown
+  uint8_t  depth;
+  uint8_t  bound : 2;
+  uint8_t  generation : 6;
+} TableEntry;
+
+#define TABLE_BUCKET_SIZE 4
+
+// One cache line per bucket, so a probe touches a single line
+typedef struct alignas(64) {
+  TableEntry entries[TABLE_BUCKET_SIZE];
+} TableBucket;
+
+static_assert(sizeof(TableEntry) == 16, "TableEntry should be 16 bytes");
+static_assert(sizeof(TableBucket) == 64, "TableBucket should be one cache line");
+
+typedef struct {
+  TableBucket *buckets;
+  uint64_t bucket_mask; // bucket count - 1, the count is a power of 2
+  uint8_t generation;
+} TranspositionTable;
+
+#define DEFAULT_TABLE_MB 16
+
+bool init_table(TranspositionTable *table, uint32_t megabytes);
+void free_table(TranspositionTable *table);
+void clear(TranspositionTable *table);
+inline void new_search(TranspositionTable *table);
+
+inline bool probe(TranspositionTable *table, uint64_t key, TableEntry *result);
+inline void store(TranspositionTable *table, uint64_t key, int depth, int bound, int score, uint16_t move);
+
+inline uint16_t table_move(int from, int to);
+inline uint16_t table_move(BitMove move);
+inline int table_move_from(uint16_t move);
+inline int table_move_to(uint16_t move);
+
+#endif
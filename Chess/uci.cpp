@@ -0,0 +1,431 @@
+#define CHESS_NO_MAIN
+#include "chess.cpp"
+
+// UCI front end for the make/unmake search, so the engine can be run
+// from a GUI or a tournament manager. Also a batch mode for searching a
+// suite of positions.
+//
+// Usage :
+//   uci                            speaks UCI on stdin/stdout
+//   uci -batch <fen file> [-threads <count>] [-hash <MB>]
+//       [-depth <plies>] [-nodes <count>] [-movetime <ms>] [-tb <directory>]
+//                                  searches every position in the file,
+//                                  one FEN per line, several at a time
+//
+// Supported commands : uci, isready, setoption (Threads, Hash, TablebasePath, BookFile),
+// ucinewgame, position [startpos | fen <fen>] [moves ...],
+// go [depth | nodes | movetime | wtime | btime | winc | binc |
+// movestogo | infinite], stop, quit
+
+typedef struct {
+  TranspositionTable table;
+  SearchThreads threads;
+  BitPosition position;
+  PositionHistory history; // ending with position, for repetitions
+  Tablebases tablebases;
+  OpeningBook book;
+
+  std::thread search_thread;
+  bool searching;
+  std::atomic<bool> search_done; // run_search has returned, not joined yet
+  uint64_t search_start;
+} UciEngine;
+
+void print_score(int score) {
+  if (!IS_MATE_SCORE(score))  printf("cp %d", score);
+  else if (score > 0)         printf("mate %d", (MATE_SCORE - score + 1) / 2);
+  else                        printf("mate %d", -(MATE_SCORE + score) / 2);
+}
+
+// Called by the search after every iteration. nodes are the main thread's,
+// the total for all threads is printed once the search is done.
+void report_iteration(SearchState *state, void *data) {
+  UciEngine *engine = (UciEngine *) data;
+  uint64_t elapsed = read_os_timer() - engine->search_start;
+  if (!elapsed) elapsed = 1;
+
+  printf("info depth %d score ", state->completed_depth);
+  print_score(state->best_score);
+  printf(" nodes %llu nps %llu time %llu pv", (unsigned long long) state->nodes,
+         (unsigned long long) (state->nodes * 1000000 / elapsed), (unsigned long long) (elapsed / 1000));
+
+  BitMove pv[MAX_PLY];
+  int length = principal_variation(state->table, &state->position, pv, state->completed_depth);
+  for (int i = 0; i < length; i++) {
+    char text[6];
+    move_to_string(pv[i], text);
+    printf(" %s", text);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+void run_search(UciEngine *engine, SearchLimits limits) {
+  BitMove move = parallel_search(&engine->threads, &engine->position, limits);
+
+  uint64_t elapsed = engine->threads.elapsed_us ? engine->threads.elapsed_us : 1;
+  printf("info nodes %llu nps %llu tbhits %llu time %llu\n", (unsigned long long) engine->threads.nodes,
+         (unsigned long long) (engine->threads.nodes * 1000000 / elapsed),
+         (unsigned long long) engine->threads.tb_hits, (unsigned long long) (elapsed / 1000));
+
+  // UCI wants a move even when there is none
+  char text[6] = "0000";
+  if (!IS_NULL_MOVE(move)) move_to_string(move, text);
+  printf("bestmove %s\n", text);
+  fflush(stdout);
+  engine->search_done = true;
+}
+
+void wait_for_search(UciEngine *engine) {
+  if (!engine->searching) return;
+  engine->search_thread.join();
+  engine->searching = false;
+}
+
+// The search clears stop when it starts, so a stop that comes right after
+// go is set again until the search is over.
+void stop_search(UciEngine *engine) {
+  while (engine->searching && !engine->search_done) {
+    engine->threads.stop = true;
+    std::this_thread::yield();
+  }
+  wait_for_search(engine);
+}
+
+// position [startpos | fen <fen>] [moves <move> ...]
+void handle_position(UciEngine *engine, char *args) {
+  const char *moves = strstr(args, "moves");
+  BitPosition bp;
+  bool ok;
+  if (!strncmp(args, "startpos", 8)) ok = parse_fen(&bp, START_FEN);
+  else if (!strncmp(args, "fen", 3)) ok = parse_fen(&bp, args + 3 + strspn(args + 3, " "));
+  else ok = false;
+  if (!ok) {
+    printf("info string invalid position\n");
+    return;
+  }
+
+  clear_history(&engine->history);
+  push_position(&engine->history, bp.hash);
+  if (moves) {
+    char *token = strtok((char *) moves + 5, " \t\n");
+    for (; token; token = strtok(NULL, " \t\n")) {
+      BitMove move;
+      if (!parse_move(&bp, token, &move)) {
+        printf("info string illegal move %s\n", token);
+        clear_history(&engine->history);
+        push_position(&engine->history, engine->position.hash);
+        return;
+      }
+      apply_move(&bp, move);
+      push_position(&engine->history, bp.hash);
+    }
+  }
+  engine->position = bp;
+}
+
+void handle_go(UciEngine *engine, char *args) {
+  SearchLimits limits = { 0, 0, 0 };
+  uint64_t time_left[2] = { 0, 0 };
+  uint64_t increment[2] = { 0, 0 };
+  uint64_t moves_to_go = 30;
+
+  char *token = strtok(args, " \t\n");
+  while (token) {
+    char *value = strtok(NULL, " \t\n");
+    uint64_t n = value ? strtoull(value, NULL, 10) : 0;
+    if (!strcmp(token, "depth"))          limits.depth = (int) n;
+    else if (!strcmp(token, "nodes"))     limits.nodes = n;
+    else if (!strcmp(token, "movetime"))  limits.time_us = n * 1000;
+    else if (!strcmp(token, "wtime"))     time_left[WHITE_SIDE] = n;
+    else if (!strcmp(token, "btime"))     time_left[BLACK_SIDE] = n;
+    else if (!strcmp(token, "winc"))      increment[WHITE_SIDE] = n;
+    else if (!strcmp(token, "binc"))      increment[BLACK_SIDE] = n;
+    else if (!strcmp(token, "movestogo")) moves_to_go = n ? n : 1;
+    else {
+      // infinite, or anything unknown. There is no value to skip.
+      token = value;
+      continue;
+    }
+    token = value ? strtok(NULL, " \t\n") : NULL;
+  }
+
+  // An even share of the clock, never more than half of it
+  int side = engine->position.side;
+  if (time_left[side] && !limits.time_us) {
+    uint64_t ms = time_left[side] / moves_to_go + increment[side] * 3 / 4;
+    if (ms > time_left[side] / 2) ms = time_left[side] / 2;
+    limits.time_us = (ms ? ms : 1) * 1000;
+  }
+
+  wait_for_search(engine);
+  engine->search_start = read_os_timer();
+  engine->searching = true;
+  engine->search_done = false;
+  engine->search_thread = std::thread(run_search, engine, limits);
+}
+
+// setoption name <name> value <value>
+void handle_setoption(UciEngine *engine, char *args) {
+  char *name = strstr(args, "name");
+  char *value = strstr(args, "value");
+  if (!name || !value) return;
+  int n = atoi(value + 5);
+
+  wait_for_search(engine);
+  if (strstr(name, "Threads") && strstr(name, "Threads") < value) {
+    int features = engine->threads.features;
+    free_search_threads(&engine->threads);
+    init_search_threads(&engine->threads, &engine->table, n);
+    engine->threads.game = &engine->history;
+    engine->threads.tablebases = &engine->tablebases;
+    engine->threads.book = &engine->book;
+    engine->threads.report = report_iteration;
+    engine->threads.report_data = engine;
+    engine->threads.features = features;
+  } else if (strstr(name, "Hash") && strstr(name, "Hash") < value) {
+    free_table(&engine->table);
+    if (!init_table(&engine->table, n > 0 ? n : 1)) init_table(&engine->table, DEFAULT_TABLE_MB);
+  } else if (strstr(name, "TablebasePath") && strstr(name, "TablebasePath") < value) {
+    // Empty or <empty> unloads them
+    char *path = value + 5;
+    path += strspn(path, " \t");
+    free_tablebases(&engine->tablebases);
+    init_tablebases(&engine->tablebases);
+    if (*path && strcmp(path, "<empty>")) {
+      int count = load_tablebases(&engine->tablebases, path);
+      printf("info string loaded %d tablebases from %s\n", count, path);
+    }
+  } else if (strstr(name, "BookFile") && strstr(name, "BookFile") < value) {
+    char *path = value + 5;
+    path += strspn(path, " \t");
+    free_book(&engine->book);
+    if (*path && strcmp(path, "<empty>") && !load_book(&engine->book, path)) {
+      printf("info string could not load the book %s\n", path);
+    }
+  } else {
+    // Pruning switches, check options
+    int feature = 0;
+    if (strstr(name, "NullMove") && strstr(name, "NullMove") < value) feature = FEATURE_NULL_MOVE;
+    else if (strstr(name, "LateMoveReductions") && strstr(name, "LateMoveReductions") < value) feature = FEATURE_LMR;
+    else if (strstr(name, "FutilityPruning") && strstr(name, "FutilityPruning") < value) feature = FEATURE_FUTILITY;
+    if (strstr(value + 5, "true")) engine->threads.features |= feature;
+    else if (strstr(value + 5, "false")) engine->threads.features &= ~feature;
+  }
+}
+
+int run_uci() {
+  UciEngine *engine = new UciEngine();
+  if (!init_table(&engine->table, DEFAULT_TABLE_MB) ||
+      !init_search_threads(&engine->threads, &engine->table, SEARCH_THREADS) ||
+      !init_history(&engine->history, 256)) {
+    printf("info string could not allocate the search\n");
+    return EXIT_FAILURE;
+  }
+  init_tablebases(&engine->tablebases);
+  init_book(&engine->book);
+  engine->threads.game = &engine->history;
+  engine->threads.tablebases = &engine->tablebases;
+  engine->threads.book = &engine->book;
+  engine->threads.report = report_iteration;
+  engine->threads.report_data = engine;
+  parse_fen(&engine->position, START_FEN);
+  push_position(&engine->history, engine->position.hash);
+
+  char line[8192];
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = 0;
+    char *command = line + strspn(line, " \t");
+    char *args = command + strcspn(command, " \t");
+    if (*args) *args++ = 0;
+    args += strspn(args, " \t");
+
+    if (!strcmp(command, "uci")) {
+      printf("id name studious-umbrella chess\n");
+      printf("id author studious-umbrella\n");
+      printf("option name Threads type spin default %d min 1 max %d\n", SEARCH_THREADS, MAX_SEARCH_THREADS);
+      printf("option name Hash type spin default %d min 1 max 65536\n", DEFAULT_TABLE_MB);
+      printf("option name TablebasePath type string default <empty>\n");
+      printf("option name BookFile type string default <empty>\n");
+      printf("option name NullMove type check default %s\n", SEARCH_FEATURES & FEATURE_NULL_MOVE ? "true" : "false");
+      printf("option name LateMoveReductions type check default %s\n", SEARCH_FEATURES & FEATURE_LMR ? "true" : "false");
+      printf("option name FutilityPruning type check default %s\n", SEARCH_FEATURES & FEATURE_FUTILITY ? "true" : "false");
+      printf("uciok\n");
+    } else if (!strcmp(command, "isready")) {
+      printf("readyok\n");
+    } else if (!strcmp(command, "setoption")) {
+      handle_setoption(engine, args);
+    } else if (!strcmp(command, "ucinewgame")) {
+      wait_for_search(engine);
+      clear(&engine->table);
+    } else if (!strcmp(command, "position")) {
+      wait_for_search(engine);
+      handle_position(engine, args);
+    } else if (!strcmp(command, "go")) {
+      handle_go(engine, args);
+    } else if (!strcmp(command, "stop")) {
+      stop_search(engine);
+    } else if (!strcmp(command, "quit")) {
+      break;
+    } else if (*command) {
+      printf("info string unknown command %s\n", command);
+    }
+    fflush(stdout);
+  }
+
+  stop_search(engine);
+  free_search_threads(&engine->threads);
+  free_table(&engine->table);
+  free_history(&engine->history);
+  free_tablebases(&engine->tablebases);
+  free_book(&engine->book);
+  delete engine;
+  return EXIT_SUCCESS;
+}
+
+typedef struct {
+  char fen[256];
+  bool valid;
+  BitMove move;
+  int score;
+  int depth;
+  uint64_t nodes;
+  uint64_t elapsed_us;
+} BatchResult;
+
+typedef struct {
+  BatchResult *results;
+  int count;
+  std::atomic<int> next;
+  SearchLimits limits;
+  uint32_t table_mb;
+  Tablebases *tablebases; // shared, probes only read them
+} BatchQueue;
+
+// Each worker searches whole positions with its own table, cleared for
+// every position, so results don't depend on how positions get split up.
+void batch_worker(BatchQueue *queue) {
+  TranspositionTable table;
+  SearchThreads threads;
+  if (!init_table(&table, queue->table_mb)) return;
+  init_search_threads(&threads, &table, 1);
+  threads.tablebases = queue->tablebases;
+
+  int i;
+  while ((i = queue->next++) < queue->count) {
+    BatchResult *result = queue->results + i;
+    BitPosition bp;
+    result->valid = parse_fen(&bp, result->fen);
+    if (!result->valid) continue;
+
+    clear(&table);
+    result->move = parallel_search(&threads, &bp, queue->limits);
+    result->score = threads.states[0].best_score;
+    result->depth = threads.states[0].completed_depth;
+    result->nodes = threads.nodes;
+    result->elapsed_us = threads.elapsed_us;
+  }
+
+  free_search_threads(&threads);
+  free_table(&table);
+}
+
+int run_batch(const char *path, int num_threads, uint32_t table_mb, SearchLimits limits, Tablebases *tablebases) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("Could not open %s\n", path);
+    return EXIT_FAILURE;
+  }
+
+  BatchQueue queue;
+  int capacity = 64;
+  queue.results = (BatchResult *) malloc(capacity * sizeof(BatchResult));
+  queue.count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = 0;
+    const char *fen = line + strspn(line, " \t");
+    if (!*fen || *fen == '#') continue;
+    if (queue.count == capacity) {
+      capacity *= 2;
+      queue.results = (BatchResult *) realloc(queue.results, capacity * sizeof(BatchResult));
+    }
+    BatchResult *result = queue.results + queue.count++;
+    memset(result, 0, sizeof(BatchResult));
+    strcpy(result->fen, fen);
+  }
+  fclose(file);
+
+  queue.next = 0;
+  queue.limits = limits;
+  queue.table_mb = table_mb;
+  queue.tablebases = tablebases;
+  if (num_threads < 1) num_threads = 1;
+  if (num_threads > MAX_SEARCH_THREADS) num_threads = MAX_SEARCH_THREADS;
+
+  uint64_t start = read_os_timer();
+  std::thread workers[MAX_SEARCH_THREADS];
+  for (int i = 0; i < num_threads; i++) workers[i] = std::thread(batch_worker, &queue);
+  for (int i = 0; i < num_threads; i++) workers[i].join();
+  uint64_t elapsed = read_os_timer() - start;
+  if (!elapsed) elapsed = 1;
+
+  uint64_t total_nodes = 0;
+  int failures = 0;
+  for (int i = 0; i < queue.count; i++) {
+    BatchResult *result = queue.results + i;
+    if (!result->valid) {
+      printf("invalid fen %s\n", result->fen);
+      failures++;
+      continue;
+    }
+    char text[6] = "0000";
+    if (!IS_NULL_MOVE(result->move)) move_to_string(result->move, text);
+    printf("bestmove %-5s score ", text);
+    print_score(result->score);
+    printf(" depth %d nodes %llu time %llu fen %s\n", result->depth, (unsigned long long) result->nodes,
+           (unsigned long long) (result->elapsed_us / 1000), result->fen);
+    total_nodes += result->nodes;
+  }
+  printf("Total : %d positions, %llu nodes, %.3f s, %llu nps, %d threads\n", queue.count,
+         (unsigned long long) total_nodes, elapsed / 1000000.0,
+         (unsigned long long) (total_nodes * 1000000 / elapsed), num_threads);
+
+  free(queue.results);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  init_bitboards();
+  init_zobrist();
+  EvalWeights weights = eval_weights;
+  load_eval_weights(&weights, EVAL_WEIGHTS_FILE);
+  set_eval_weights(&weights);
+
+  if (argc > 2 && !strcmp(argv[1], "-batch")) {
+    int num_threads = (int) std::thread::hardware_concurrency();
+    uint32_t table_mb = DEFAULT_TABLE_MB;
+    SearchLimits limits = { SEARCH_DEPTH, 0, 0 };
+    Tablebases tablebases;
+    init_tablebases(&tablebases);
+    for (int i = 3; i + 1 < argc; i++) {
+      if (!strcmp(argv[i], "-threads"))       num_threads = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-hash"))     table_mb = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-depth"))    limits.depth = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-nodes"))    limits.nodes = strtoull(argv[++i], NULL, 10);
+      else if (!strcmp(argv[i], "-movetime")) limits.time_us = strtoull(argv[++i], NULL, 10) * 1000;
+      else if (!strcmp(argv[i], "-tb"))       load_tablebases(&tablebases, argv[++i]);
+    }
+    // A budget on its own shouldn't also be capped by the default depth
+    if (limits.nodes || limits.time_us) {
+      bool depth_given = false;
+      for (int i = 3; i < argc; i++) depth_given |= !strcmp(argv[i], "-depth");
+      if (!depth_given) limits.depth = 0;
+    }
+    int result = run_batch(argv[2], num_threads, table_mb, limits, tablebases.count ? &tablebases : NULL);
+    free_tablebases(&tablebases);
+    return result;
+  }
+
+  return run_uci();
+}
@@ -0,0 +1,134 @@
+#ifndef _NAR_ATOMICS_H_
+#define _NAR_ATOMICS_H_
+
+// NOTE : Same interface as the SDL versions in GameEngine/sdl_thread.cpp, for code that
+// doesn't link SDL (tests, tools). Like SDL_AtomicAdd, += returns the old value.
+// Uses the gcc/clang __atomic builtins, all sequentially consistent.
+
+//
+// atomic_int ---
+//
+
+struct atomic_int {
+  int i;
+
+  inline int operator=(int val) {
+    __atomic_store_n(&i, val, __ATOMIC_SEQ_CST);
+    return val;
+  }
+
+  inline operator int() {
+    return __atomic_load_n(&i, __ATOMIC_SEQ_CST);
+  }
+
+  inline int operator+=(int b) {
+    return __atomic_fetch_add(&i, b, __ATOMIC_SEQ_CST);
+  }
+
+  inline int operator++() {
+    return __atomic_fetch_add(&i, 1, __ATOMIC_SEQ_CST);
+  }
+
+  inline int operator++(int) {
+    return __atomic_fetch_add(&i, 1, __ATOMIC_SEQ_CST) + 1;
+  }
+
+  inline int operator-=(int b) {
+    return *this += -b;
+  }
+
+  inline int operator--() {
+    return __atomic_fetch_add(&i, -1, __ATOMIC_SEQ_CST);
+  }
+
+  inline int operator--(int) {
+    return __atomic_fetch_add(&i, -1, __ATOMIC_SEQ_CST) - 1;
+  }
+};
+
+static inline
+bool atomic_compare_exchange(atomic_int *a, int expected_val, int new_val) {
+  return __atomic_compare_exchange_n(&a->i, &expected_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+//
+// atomic_uint ---
+//
+
+struct atomic_uint {
+  u32 u;
+
+  inline u32 operator=(u32 val) {
+    __atomic_store_n(&u, val, __ATOMIC_SEQ_CST);
+    return val;
+  }
+
+  inline operator u32() {
+    return __atomic_load_n(&u, __ATOMIC_SEQ_CST);
+  }
+
+  inline u32 operator+=(u32 b) {
+    return __atomic_fetch_add(&u, b, __ATOMIC_SEQ_CST);
+  }
+
+  inline u32 operator++() {
+    return __atomic_fetch_add(&u, 1, __ATOMIC_SEQ_CST);
+  }
+
+  inline u32 operator++(int) {
+    return __atomic_fetch_add(&u, 1, __ATOMIC_SEQ_CST) + 1;
+  }
+
+  inline u32 operator-=(u32 b) {
+    return *this += -b;
+  }
+
+  inline u32 operator--() {
+    return __atomic_fetch_add(&u, (u32) -1, __ATOMIC_SEQ_CST);
+  }
+
+  inline u32 operator--(int) {
+    return __atomic_fetch_add(&u, (u32) -1, __ATOMIC_SEQ_CST) - 1;
+  }
+};
+
+static inline
+bool atomic_compare_exchange(atomic_uint *a, u32 expected_val, u32 new_val) {
+  return __atomic_compare_exchange_n(&a->u, &expected_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+//
+// atomic_u64 ---
+//
+
+struct atomic_u64 {
+  u64 u;
+
+  inline u64 operator=(u64 val) {
+    __atomic_store_n(&u, val, __ATOMIC_SEQ_CST);
+    return val;
+  }
+
+  inline operator u64() {
+    return __atomic_load_n(&u, __ATOMIC_SEQ_CST);
+  }
+
+  inline u64 operator+=(u64 b) {
+    return __atomic_fetch_add(&u, b, __ATOMIC_SEQ_CST);
+  }
+};
+
+static inline
+bool atomic_compare_exchange(atomic_u64 *a, u64 expected_val, u64 new_val) {
+  return __atomic_compare_exchange_n(&a->u, &expected_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+static inline
+bool atomic_compare_exchange(void **a, void *expected_val, void *new_val) {
+  return __atomic_compare_exchange_n(a, &expected_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -12,64 +12,196 @@ struct FreeListNode {
   FreeListNode *next_free;
 };
 
-// TODO maybe add a way to have the heap automatically expand instead of using create_heap
-// We could store a PushAllocator pointer inside and dynamically expand whenever full
+// NOTE : free_list is a FreeListNode pointer in the low 48 bits with a tag above it that changes
+// on every push and pop. A plain pointer CAS can succeed after the head was popped and pushed
+// back by other threads in between (ABA), handing out an element that is in use; the tag makes
+// that CAS fail. All user space pointers on x64 and arm64 fit in 48 bits.
+#define HEAP_POINTER_BITS 48
+#define HEAP_POINTER_MASK ((1ULL << HEAP_POINTER_BITS) - 1)
+
+// NOTE : With magazine_size set every thread keeps up to that many free elements to itself, so
+// most allocs and frees don't touch the shared list at all. Leave it off when one thread allocates
+// and others free (the work queue), the freed elements would pile up in the workers' caches.
+// A thread caches at most HEAP_MAGAZINE_SLOTS heaps, others it uses without a cache until
+// flush_thread_cache gives a slot back.
+#define HEAP_MAX_MAGAZINE_SIZE 64
+#define HEAP_MAGAZINE_SLOTS 4
+
+// NOTE : grow_heap adds elements to a heap, SlabAllocator (slab_allocator.h) does that by itself
+// when a size class runs out.
 struct HeapAllocator {
-  FreeListNode *free_list;
+  atomic_u64 free_list;
   uint32_t element_size;
   uint32_t count; // NOTE : this is currently unused and only here for future debug help
+  uint32_t magazine_size; // NOTE : 0 turns the per thread caches off
+  uint32_t id; // NOTE : Never reused, tells the heap apart from an earlier one at the same address.
+};
+
+struct HeapMagazine {
+  HeapAllocator *allocator;
+  uint32_t heap_id;
+  uint32_t count;
+  void *elements[HEAP_MAX_MAGAZINE_SIZE];
 };
 
 #define calc_max_needed_memory_size(count, size, alignment) ((count) * (size) + (alignment))
 
-static inline HeapAllocator create_heap_(PushAllocator *allocator, uint32_t elem_count, uint32_t elem_size, uint64_t alignment) {
-  assert(elem_size >= 8);
-  if (alignment < 8) alignment = 8;
-  auto memory = (uint8_t *) alloc_size(allocator, elem_size * elem_count, alignment);
-  if (!memory) return {};
+static inline FreeListNode *free_list_node(uint64_t head) {
+  return (FreeListNode *) (head & HEAP_POINTER_MASK);
+}
+
+static inline uint64_t next_free_list_head(uint64_t head, FreeListNode *node) {
+  assert(!((uint64_t) node & ~HEAP_POINTER_MASK));
+  return ((head & ~HEAP_POINTER_MASK) + (1ULL << HEAP_POINTER_BITS)) | (uint64_t) node;
+}
 
-  auto start_ptr = memory + (elem_count - 1) * elem_size;
+// NOTE : Links count elements starting at memory into a list ending in NULL, returns the first.
+static inline FreeListNode *link_elements(uint8_t *memory, uint32_t count, uint32_t size) {
+  auto start_ptr = memory + (count - 1) * size;
   FreeListNode *prev = NULL;
-  for (auto ptr = start_ptr; ptr >= memory; ptr -= elem_size) {
+  for (auto ptr = start_ptr; ptr >= memory; ptr -= size) {
     auto node = (FreeListNode *) ptr;
     node->next_free = prev;
     prev = node;
   }
+  return prev;
+}
+
+inline uint32_t next_heap_id() {
+  static atomic_uint last_id;
+  // NOTE : += returns the old value.
+  return (last_id += 1) + 1;
+}
+
+static inline HeapAllocator create_heap_(PushAllocator *allocator, uint32_t elem_count, uint32_t elem_size, uint64_t alignment,
+                                         uint32_t magazine_size = 0) {
+  assert(elem_size >= 8);
+  assert(magazine_size <= HEAP_MAX_MAGAZINE_SIZE);
+  if (alignment < 8) alignment = 8;
+  auto memory = (uint8_t *) alloc_size(allocator, elem_size * elem_count, alignment);
+  if (!memory) return {};
 
   HeapAllocator result;
   result.element_size = elem_size;
-  result.free_list = prev;
+  result.free_list = next_free_list_head(0, link_elements(memory, elem_count, elem_size));
   result.count = elem_count;
+  result.magazine_size = magazine_size;
+  result.id = next_heap_id();
   return result;
 }
 
 #define create_heap(allocator, count, type) (create_heap_((allocator), (count), sizeof(type), alignof(type)))
+#define create_cached_heap(allocator, count, type, magazine_size) \
+  (create_heap_((allocator), (count), sizeof(type), alignof(type), (magazine_size)))
 
-static inline void *alloc_element_(HeapAllocator *allocator, uint32_t size = 0) {
-  if (size) assert(size == allocator->element_size);
+// NOTE : Pushes first..last, already linked through next_free, with one CAS.
+static inline void push_free_chain(HeapAllocator *allocator, FreeListNode *first, FreeListNode *last) {
   while (true) {
-    FreeListNode *next = allocator->free_list;
-    if (!next) {
-      assert(!"HeapAllocator out of memory.");
-      return NULL;
+    uint64_t head = allocator->free_list;
+    last->next_free = free_list_node(head);
+    if (atomic_compare_exchange(&allocator->free_list, head, next_free_list_head(head, first))) return;
+  }
+}
+
+// NOTE : Adds count new elements carved from memory to the free list. Safe while other threads
+// use the heap, the elements go on with one CAS.
+static inline bool grow_heap(HeapAllocator *allocator, PushAllocator *memory, uint32_t count, uint64_t alignment = 8) {
+  auto elements = (uint8_t *) alloc_size(memory, allocator->element_size * count, alignment);
+  if (!elements) return false;
+  auto first = link_elements(elements, count, allocator->element_size);
+  auto last = (FreeListNode *) (elements + (count - 1) * allocator->element_size);
+  push_free_chain(allocator, first, last);
+  return true;
+}
+
+static inline FreeListNode *pop_free(HeapAllocator *allocator) {
+  while (true) {
+    uint64_t head = allocator->free_list;
+    FreeListNode *node = free_list_node(head);
+    if (!node) return NULL;
+    // NOTE : node may have been popped and written to by now, then the tag has changed and this fails.
+    if (atomic_compare_exchange(&allocator->free_list, head, next_free_list_head(head, node->next_free))) {
+      return node;
+    }
+  }
+}
+
+// NOTE : Gives back the elements from index keep on.
+static inline void flush_magazine(HeapMagazine *magazine, uint32_t keep = 0) {
+  if (magazine->count <= keep) return;
+  auto first = (FreeListNode *) magazine->elements[keep];
+  auto last = first;
+  for (uint32_t i = keep + 1; i < magazine->count; i++) {
+    auto node = (FreeListNode *) magazine->elements[i];
+    last->next_free = node;
+    last = node;
+  }
+  push_free_chain(magazine->allocator, first, last);
+  magazine->count = keep;
+}
+
+// NOTE : This thread's cache for allocator, NULL if all the slots are taken by other heaps. A slot
+// is never flushed to make room, its heap may be gone by now. A slot left by a gone heap at the
+// same address has another id, its elements went with that heap and are dropped.
+static inline HeapMagazine *get_thread_magazine(HeapAllocator *allocator, bool create = true) {
+  static thread_local HeapMagazine magazines[HEAP_MAGAZINE_SLOTS];
+  HeapMagazine *empty = NULL;
+  for (uint32_t i = 0; i < HEAP_MAGAZINE_SLOTS; i++) {
+    auto magazine = magazines + i;
+    if (magazine->allocator == allocator) {
+      if (magazine->heap_id == allocator->id) return magazine;
+      magazine->allocator = NULL;
     }
-    //allocator->free_list = next->next_free;
-    if (atomic_compare_exchange((void **) &allocator->free_list, next, next->next_free)) {
-      return (void *) next;
+    if (!magazine->allocator && !empty) empty = magazine;
+  }
+  if (!create || !empty) return NULL;
+
+  empty->allocator = allocator;
+  empty->heap_id = allocator->id;
+  empty->count = 0;
+  return empty;
+}
+
+// NOTE : Returns the elements this thread cached for allocator and frees its slot. Call it before
+// the thread exits, and before the heap goes away on every thread that used it, or the slot stays
+// taken.
+static inline void flush_thread_cache(HeapAllocator *allocator) {
+  auto magazine = get_thread_magazine(allocator, false);
+  if (!magazine) return;
+  flush_magazine(magazine);
+  magazine->allocator = NULL;
+}
+
+static inline void *alloc_element_(HeapAllocator *allocator, uint32_t size = 0) {
+  if (size) assert(size == allocator->element_size);
+  auto magazine = allocator->magazine_size ? get_thread_magazine(allocator) : NULL;
+  if (magazine) {
+    // NOTE : Refills half way so the frees that follow have room.
+    if (!magazine->count) {
+      while (magazine->count < (allocator->magazine_size + 1) / 2) {
+        auto node = pop_free(allocator);
+        if (!node) break;
+        magazine->elements[magazine->count++] = node;
+      }
     }
+    if (magazine->count) return magazine->elements[--magazine->count];
+  } else {
+    auto node = pop_free(allocator);
+    if (node) return (void *) node;
   }
+  assert(!"HeapAllocator out of memory.");
+  return NULL;
 }
 
 static inline void free_element_(HeapAllocator *allocator, void *elem) {
   auto new_free = (FreeListNode *) elem;
-  int count = 0;
-  while (true) {
-    auto last_free = allocator->free_list;
-    new_free->next_free = last_free;
-    if (atomic_compare_exchange((void **) &allocator->free_list, last_free, new_free)) return;
-    count++;
-    assert(count < 100);
+  auto magazine = allocator->magazine_size ? get_thread_magazine(allocator) : NULL;
+  if (magazine) {
+    if (magazine->count == allocator->magazine_size) flush_magazine(magazine, allocator->magazine_size / 2);
+    magazine->elements[magazine->count++] = elem;
+    return;
   }
+  push_free_chain(allocator, new_free, new_free);
 }
 
 #define alloc_element(allocator, type) ((type *) alloc_element_((allocator), sizeof(type)))
@@ -0,0 +1,159 @@
+
+#include <thread>
+#include "common.h"
+#include "atomics.h"
+#define PUSH_ALLOCATOR_MULTITHREADED
+#include "push_allocator.h"
+#include "heap_allocator.h"
+
+#define TEST_THREADS 8
+#define TEST_BATCH 8
+
+struct TestElement {
+  u64 owner;
+  u64 sequence;
+};
+
+// NOTE : Only when nothing else is using allocator.
+static u32 count_free(HeapAllocator *allocator) {
+  u32 count = 0;
+  for (auto node = free_list_node(allocator->free_list); node; node = node->next_free) count++;
+  return count;
+}
+
+void heap_allocator_test() {
+  printf("HeapAllocator test begin.\n");
+  PushAllocator memory = new_push_allocator(1024);
+  HeapAllocator heap = create_heap(&memory, 4, TestElement);
+  assert(heap.element_size == sizeof(TestElement));
+  assert(count_free(&heap) == 4);
+
+  TestElement *elements[4];
+  for (u32 i = 0; i < 4; i++) {
+    elements[i] = alloc_element(&heap, TestElement);
+    assert(elements[i]);
+    for (u32 j = 0; j < i; j++) assert(elements[i] != elements[j]);
+  }
+  assert(!free_list_node(heap.free_list));
+
+  // NOTE : The same head pointer comes back with a different tag.
+  u64 empty = heap.free_list;
+  free_element(&heap, elements[0]);
+  elements[0] = alloc_element(&heap, TestElement);
+  assert(free_list_node(heap.free_list) == free_list_node(empty));
+  assert(heap.free_list != empty);
+
+  for (u32 i = 0; i < 4; i++) free_element(&heap, elements[i]);
+  assert(count_free(&heap) == 4);
+
+  // NOTE : Cached frees stay in the thread until the magazine overflows or is flushed.
+  HeapAllocator cached = create_cached_heap(&memory, 16, TestElement, 4);
+  TestElement *first = alloc_element(&cached, TestElement);
+  assert(count_free(&cached) == 14);
+  free_element(&cached, first);
+  assert(alloc_element(&cached, TestElement) == first);
+  TestElement *many[8];
+  for (u32 i = 0; i < 8; i++) many[i] = alloc_element(&cached, TestElement);
+  for (u32 i = 0; i < 8; i++) free_element(&cached, many[i]);
+  free_element(&cached, first);
+  assert(count_free(&cached) + get_thread_magazine(&cached)->count == 16);
+  flush_thread_cache(&cached);
+  assert(count_free(&cached) == 16);
+  assert(!get_thread_magazine(&cached, false));
+
+  // NOTE : With every slot taken the next heap goes without a cache, nothing is flushed for it.
+  HeapAllocator slots[HEAP_MAGAZINE_SLOTS + 1];
+  for (u32 i = 0; i <= HEAP_MAGAZINE_SLOTS; i++) {
+    slots[i] = create_cached_heap(&memory, 2, TestElement, 4);
+    free_element(&slots[i], alloc_element(&slots[i], TestElement));
+  }
+  for (u32 i = 0; i < HEAP_MAGAZINE_SLOTS; i++) assert(count_free(&slots[i]) == 0);
+  assert(!get_thread_magazine(&slots[HEAP_MAGAZINE_SLOTS], false));
+  assert(count_free(&slots[HEAP_MAGAZINE_SLOTS]) == 2);
+
+  // NOTE : A new heap in the place of one that is gone doesn't get the old one's elements.
+  slots[0] = create_cached_heap(&memory, 2, TestElement, 4);
+  assert(!get_thread_magazine(&slots[0], false));
+  first = alloc_element(&slots[0], TestElement);
+  assert(get_thread_magazine(&slots[0])->count == 1 && count_free(&slots[0]) == 0);
+  free_element(&slots[0], first);
+  for (u32 i = 0; i < HEAP_MAGAZINE_SLOTS; i++) flush_thread_cache(&slots[i]);
+  assert(count_free(&slots[0]) == 2 && count_free(&slots[1]) == 2);
+
+  free(memory.memory);
+  printf("HeapAllocator test successful.\n\n");
+}
+
+struct StressWork {
+  HeapAllocator *heap;
+  u64 id;
+  u32 iterations;
+};
+
+// NOTE : Each element is stamped with its owner when allocated and checked before being freed,
+// an element handed out twice gets stamped by both.
+static void stress_heap(StressWork *work) {
+  u64 random = work->id * 0x9E3779B97F4A7C15ULL;
+  TestElement *held[TEST_BATCH];
+  for (u32 i = 0; i < work->iterations; i++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    u32 count = 1 + random % TEST_BATCH;
+    for (u32 j = 0; j < count; j++) {
+      held[j] = alloc_element(work->heap, TestElement);
+      assert(held[j]);
+      held[j]->owner = work->id;
+      held[j]->sequence = i * TEST_BATCH + j;
+    }
+    if (random & 0x100) std::this_thread::yield();
+    for (u32 j = 0; j < count; j++) {
+      u32 k = (j + random) % count;
+      if (!held[k]) k = j;
+      while (!held[k]) k = (k + 1) % count;
+      assert(held[k]->owner == work->id);
+      assert(held[k]->sequence == i * TEST_BATCH + k);
+      free_element(work->heap, held[k]);
+      held[k] = NULL;
+    }
+  }
+  flush_thread_cache(work->heap);
+}
+
+static void stress_test(u32 magazine_size) {
+  u32 count = TEST_THREADS * (TEST_BATCH + magazine_size);
+  PushAllocator memory = new_push_allocator(count * sizeof(TestElement) + 64);
+  HeapAllocator heap = create_cached_heap(&memory, count, TestElement, magazine_size);
+  assert(count_free(&heap) == count);
+
+  StressWork work[TEST_THREADS];
+  std::thread threads[TEST_THREADS];
+  for (u32 i = 0; i < TEST_THREADS; i++) {
+    work[i] = { &heap, i + 1, 200000 };
+    threads[i] = std::thread(stress_heap, work + i);
+  }
+  for (u32 i = 0; i < TEST_THREADS; i++) threads[i].join();
+
+  // NOTE : Everything is back and nothing is on the list twice.
+  assert(count_free(&heap) == count);
+  for (auto node = free_list_node(heap.free_list); node; node = node->next_free) {
+    auto element = (TestElement *) node;
+    assert(element->sequence != ~0ULL);
+    element->sequence = ~0ULL;
+  }
+  free(memory.memory);
+}
+
+void heap_allocator_stress_test() {
+  printf("HeapAllocator stress test begin.\n");
+  stress_test(0);
+  stress_test(8);
+  printf("HeapAllocator stress test successful.\n\n");
+}
+
+int main() {
+  heap_allocator_test();
+  heap_allocator_stress_test();
+
+  return EXIT_SUCCESS;
+}
@@ -2,42 +2,115 @@
 #define _POOL_ALLOCATOR_H_
 
 #include "push_allocator.h"
-#include "dynamic_array.h"
 
-// TODO test this
+// NOTE : An arena that never runs out, for when the size isn't known up front (parsing files).
+// Memory comes in malloc'd blocks chained together, each new block twice the size of the last
+// up to POOL_MAX_BLOCK_SIZE, and is bumped like a PushAllocator. reset keeps the blocks for the
+// next use, release frees them. A zeroed PoolAllocator is ready to use.
 
 // WARNING : This is not thread safe even if PushAllocator is multithreaded
-struct PoolAllocatorNode {
-  PushAllocator allocator;
-  PoolAllocatorNode *next;
+
+#define POOL_MIN_BLOCK_SIZE (2048*32)
+#define POOL_MAX_BLOCK_SIZE (64*1024*1024)
+
+struct PoolBlock {
+  PoolBlock *next;
+  u64 size;
+  u64 bytes_allocated;
+  u64 padding; // NOTE : Keeps the memory after the header 16 byte aligned like malloc.
 };
 
 struct PoolAllocator {
-  darray<PoolAllocatorNode> nodes;
+  PoolBlock *first;
+  PoolBlock *current; // NOTE : Blocks after current are empty.
+  PoolBlock *last;
+  u64 min_block_size;
+  u64 next_block_size;
+  u64 bytes_allocated; // NOTE : Asked for since the last reset, not counting alignment.
+  u64 capacity;        // NOTE : All the blocks together.
+  u32 block_count;
 };
 
-#define POOL_MIN_BLOCK_SIZE (2048*32)
+inline PoolAllocator new_pool_allocator(u64 min_block_size = POOL_MIN_BLOCK_SIZE) {
+  PoolAllocator result = {};
+  result.min_block_size = min_block_size;
+  result.next_block_size = min_block_size;
+  return result;
+}
 
-// TODO : Investigate possible weirdness with malloc alignments. If malloc gives an
-// alignment smaller than the argument passed in, and size is larger than POOL_MIN_BLOCK_SIZE,
-// then this will probably fail.
-static uint8_t *allocate(PoolAllocator *pool, uint64_t size, uint32_t alignment) {
-  assert(alignment <= sizeof(max_align_t));
-  auto node = peek(pool->nodes);
-  uint8_t *result = NULL;
-  if (node) {
-    result = alloc_size(node->allocator, size, alignment);
-    if (result) return result;
+static inline u8 *get_block_memory(PoolBlock *block) {
+  return (u8 *) (block + 1);
+}
+
+static inline void *alloc_from_block(PoolBlock *block, u64 size, u64 alignment) {
+  u64 memory_index = (u64) get_block_memory(block) + block->bytes_allocated;
+  u64 alignment_offset = (alignment - (memory_index & (alignment - 1))) & (alignment - 1);
+  if (block->bytes_allocated + alignment_offset + size > block->size) return NULL;
+  void *result = get_block_memory(block) + block->bytes_allocated + alignment_offset;
+  block->bytes_allocated += alignment_offset + size;
+  return result;
+}
+
+static PoolBlock *add_pool_block(PoolAllocator *pool, u64 min_size) {
+  if (!pool->next_block_size) {
+    if (!pool->min_block_size) pool->min_block_size = POOL_MIN_BLOCK_SIZE;
+    pool->next_block_size = pool->min_block_size;
   }
-  auto new_node = push(pool->nodes);
-  if (!new_node) return NULL;
-  *new_node = {};
-  new_node->next = node;
-  uint64_t block_size = max(size, POOL_MIN_BLOCK_SIZE);
-  new_node->allocator = new_push_allocator(block_size);
-  if (!is_initialized(new_node->allocator)) return NULL;
-  return alloc_size(new_node->allocator, size, alignment);
+  u64 size = max(pool->next_block_size, min_size);
+  auto block = (PoolBlock *) malloc(sizeof(PoolBlock) + size);
+  if (!block) return NULL;
+
+  *block = {};
+  block->size = size;
+  if (pool->last) pool->last->next = block;
+  else pool->first = block;
+  pool->last = block;
+  pool->capacity += size;
+  pool->block_count++;
+  pool->next_block_size = min(pool->next_block_size * 2, (u64) POOL_MAX_BLOCK_SIZE);
+  return block;
 }
 
-#endif
+static void *alloc_size(PoolAllocator *pool, u64 size, u64 alignment = 1) {
+  if (!size) return NULL;
+  void *result = NULL;
+  auto block = pool->current;
+  if (block) result = alloc_from_block(block, size, alignment);
 
+  // NOTE : Kept blocks too small for this are skipped until the next reset.
+  while (!result && block && block->next) {
+    block = block->next;
+    result = alloc_from_block(block, size, alignment);
+  }
+  if (!result) {
+    block = add_pool_block(pool, size + alignment - 1);
+    if (!block) {
+      FAILURE("PoolAllocator failed to allocate a block.", size, pool->capacity);
+      return NULL;
+    }
+    result = alloc_from_block(block, size, alignment);
+  }
+  pool->current = block;
+  pool->bytes_allocated += size;
+  return result;
+}
+
+// NOTE : Everything allocated is gone but the blocks stay for the next use.
+static inline void reset(PoolAllocator *pool) {
+  for (auto block = pool->first; block; block = block->next) block->bytes_allocated = 0;
+  pool->current = pool->first;
+  pool->bytes_allocated = 0;
+}
+
+// NOTE : Frees every block, the pool can still be used after.
+static inline void release(PoolAllocator *pool) {
+  auto block = pool->first;
+  while (block) {
+    auto next = block->next;
+    free(block);
+    block = next;
+  }
+  *pool = new_pool_allocator(pool->min_block_size);
+}
+
+#endif
@@ -0,0 +1,134 @@
+
+#include <time.h>
+#include "common.h"
+#include "pool_allocator.h"
+
+void pool_allocator_test() {
+  printf("PoolAllocator test begin.\n");
+  // NOTE : Zeroed is usable, with the default block size.
+  PoolAllocator zeroed = {};
+  assert(ALLOC_STRUCT(&zeroed, u64));
+  assert(zeroed.block_count == 1 && zeroed.capacity == POOL_MIN_BLOCK_SIZE);
+  release(&zeroed);
+  assert(!zeroed.block_count && !zeroed.first);
+
+  u64 block_size = 1024;
+  PoolAllocator pool_ = new_pool_allocator(block_size);
+  auto pool = &pool_;
+  assert(!pool->block_count);
+
+  u8 *first = (u8 *) alloc_size(pool, 3);
+  assert(first == get_block_memory(pool->first));
+  assert((u64) first % 16 == 0);
+  u64 *second = ALLOC_STRUCT(pool, u64);
+  assert((u8 *) second == first + 8);
+  assert(pool->bytes_allocated == 11);
+
+  // NOTE : Blocks double as they are added.
+  for (u32 i = 0; i < 200; i++) assert(ALLOC_ARRAY(pool, u32, 8));
+  assert(pool->block_count == 3);
+  assert(pool->first->size == block_size);
+  assert(pool->first->next->size == block_size * 2);
+  assert(pool->last->size == block_size * 4);
+  assert(pool->capacity == block_size * 7);
+
+  // NOTE : Bigger than the next block gets a block of its own size.
+  u8 *big = (u8 *) alloc_size(pool, block_size * 100, 64);
+  assert((u64) big % 64 == 0);
+  assert(pool->block_count == 4);
+  assert(pool->last->size == block_size * 100 + 63);
+  memset(big, 1, block_size * 100);
+
+  // NOTE : reset keeps the blocks and starts over from the first.
+  u64 capacity = pool->capacity;
+  PoolBlock *first_block = pool->first;
+  reset(pool);
+  assert(pool->bytes_allocated == 0);
+  assert(alloc_size(pool, 3) == first);
+  for (u32 i = 0; i < 200; i++) assert(ALLOC_ARRAY(pool, u32, 8));
+  assert(alloc_size(pool, block_size * 50));
+  assert(pool->block_count == 4 && pool->capacity == capacity);
+  assert(pool->first == first_block);
+
+  // NOTE : A kept block too small is skipped, not lost for good.
+  reset(pool);
+  assert(alloc_size(pool, block_size * 3));
+  assert(pool->current == pool->first->next->next);
+  assert(pool->block_count == 4);
+  reset(pool);
+  assert(pool->current == pool->first);
+
+  release(pool);
+  assert(!pool->first && !pool->last && !pool->current);
+  assert(pool->block_count == 0 && pool->capacity == 0);
+  assert(pool->min_block_size == block_size);
+  assert(alloc_size(pool, 16));
+  assert(pool->block_count == 1 && pool->capacity == block_size);
+  release(pool);
+
+  printf("PoolAllocator test successful.\n\n");
+}
+
+//
+// Benchmark ---
+//
+
+static inline u64 time_ns() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (u64) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+#define BENCH_ALLOCATIONS 100000
+#define BENCH_ROUNDS 20
+
+// NOTE : Sizes like tokens and nodes from a parser, 8 to 135 bytes.
+static u32 bench_sizes[BENCH_ALLOCATIONS];
+
+void pool_allocator_bench() {
+  u64 random = 0x9E3779B97F4A7C15ULL;
+  for (u32 i = 0; i < BENCH_ALLOCATIONS; i++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    bench_sizes[i] = 8 + random % 128;
+  }
+  static void *pointers[BENCH_ALLOCATIONS];
+
+  u64 start = time_ns();
+  for (u32 round = 0; round < BENCH_ROUNDS; round++) {
+    for (u32 i = 0; i < BENCH_ALLOCATIONS; i++) {
+      pointers[i] = malloc(bench_sizes[i]);
+      *(u8 *) pointers[i] = (u8) i;
+    }
+    for (u32 i = 0; i < BENCH_ALLOCATIONS; i++) free(pointers[i]);
+  }
+  f64 malloc_ns = (f64) (time_ns() - start) / (BENCH_ROUNDS * BENCH_ALLOCATIONS);
+
+  PoolAllocator pool = {};
+  start = time_ns();
+  for (u32 round = 0; round < BENCH_ROUNDS; round++) {
+    for (u32 i = 0; i < BENCH_ALLOCATIONS; i++) {
+      pointers[i] = alloc_size(&pool, bench_sizes[i], 8);
+      *(u8 *) pointers[i] = (u8) i;
+    }
+    reset(&pool);
+  }
+  f64 pool_ns = (f64) (time_ns() - start) / (BENCH_ROUNDS * BENCH_ALLOCATIONS);
+
+  printf("%u allocations of 8 to 135 bytes, %u rounds, ns per allocation :\n", BENCH_ALLOCATIONS, BENCH_ROUNDS);
+  printf("  malloc/free  %6.2f\n", malloc_ns);
+  printf("  pool/reset   %6.2f  (%u blocks, %llu bytes)\n", pool_ns, pool.block_count, (unsigned long long) pool.capacity);
+  release(&pool);
+}
+
+// NOTE : pool_allocator_test bench runs the benchmark against malloc instead.
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    pool_allocator_bench();
+    return EXIT_SUCCESS;
+  }
+  pool_allocator_test();
+
+  return EXIT_SUCCESS;
+}
@@ -11,6 +11,7 @@ struct PushAllocator {
   u8 *memory;
 #ifdef PUSH_ALLOCATOR_MULTITHREADED
   atomic_uint bytes_allocated;
+  atomic_uint clear_count; // NOTE : Lets ThreadPushAllocators notice their chunk was cleared.
 #else
   u32 bytes_allocated;
 #endif
@@ -112,11 +113,17 @@ struct TemporaryAllocator : PushAllocator {
     memory = NULL;
     bytes_allocated = 0;
     max_size = 0;
+#ifdef PUSH_ALLOCATOR_MULTITHREADED
+    clear_count = 0;
+#endif
   }
   inline TemporaryAllocator(PushAllocator alloc) {
     memory = alloc.memory;
     bytes_allocated = alloc.bytes_allocated;
     max_size = alloc.max_size;
+#ifdef PUSH_ALLOCATOR_MULTITHREADED
+    clear_count = alloc.clear_count;
+#endif
   }
   inline ~TemporaryAllocator() {
     if (memory) ASSERT(!"Temporary Allocator was not freed.");
@@ -141,6 +148,9 @@ static inline void pop_temporary(PushAllocator *old, TemporaryAllocator *tempora
 
 static inline void clear(PushAllocator *allocator) {
   allocator->bytes_allocated = 0;
+#ifdef PUSH_ALLOCATOR_MULTITHREADED
+  allocator->clear_count++;
+#endif
 }
 
 // TODO make this thread safe somehow?
@@ -150,6 +160,154 @@ static inline void *pop_size(PushAllocator *allocator, u32 size) {
   return allocator->memory + allocator->bytes_allocated;
 }
 
+//
+// Markers ---
+//
+
+// NOTE : Unlike push_temporary a marker doesn't take the rest of the allocator, it keeps being
+// used as normal and restore_marker frees everything allocated since. Markers nest, restoring
+// an outer one frees the inner ones too. Nothing else may allocate from it in between, so with
+// PUSH_ALLOCATOR_MULTITHREADED use them on allocators only one thread is using.
+
+struct PushMarker {
+  u32 bytes_allocated;
+};
+
+static inline PushMarker save_marker(PushAllocator *allocator) {
+  PushMarker result;
+  result.bytes_allocated = allocator->bytes_allocated;
+  return result;
+}
+
+static inline void restore_marker(PushAllocator *allocator, PushMarker marker) {
+  // NOTE : Catches an inner marker restored after an outer one, or one from another allocator.
+  assert(marker.bytes_allocated <= allocator->bytes_allocated);
+  allocator->bytes_allocated = marker.bytes_allocated;
+#ifdef PUSH_ALLOCATOR_MULTITHREADED
+  // NOTE : Like clear this drops every ThreadPushAllocator's current chunk, also the ones taken
+  // before the marker.
+  allocator->clear_count++;
+#endif
+}
+
+struct ScopedMarker {
+  PushAllocator *allocator;
+  PushMarker marker;
+
+  inline ScopedMarker(PushAllocator *a) {
+    allocator = a;
+    marker = save_marker(a);
+  }
+  inline ~ScopedMarker() {
+    restore_marker(allocator, marker);
+  }
+  ScopedMarker(const ScopedMarker &) = delete;
+  ScopedMarker &operator=(const ScopedMarker &) = delete;
+};
+
+// NOTE : Frees whatever allocator got since this line at the end of the scope.
+#define SCOPED_MARKER__(mangle, allocator) ScopedMarker _scoped_marker_##mangle(allocator)
+#define SCOPED_MARKER_(number, allocator) SCOPED_MARKER__(number, allocator)
+#define SCOPED_MARKER(allocator) SCOPED_MARKER_(__LINE__, allocator)
+
+#ifdef PUSH_ALLOCATOR_MULTITHREADED
+//
+// ThreadPushAllocator ---
+//
+
+// NOTE : Every alloc_size on a shared PushAllocator is a CAS on bytes_allocated, and with all
+// the workers allocating that cache line bounces between cores. A ThreadPushAllocator takes a
+// chunk of the shared one with a single CAS and bumps inside it without atomics, so it must
+// only be used by one thread. thread_push_allocator gives each thread its own.
+
+#define PUSH_ALLOCATOR_CHUNK_SIZE (64 * 1024)
+#define PUSH_ALLOCATOR_CHUNK_ALIGNMENT 64
+
+struct ThreadPushAllocator {
+  PushAllocator *parent;
+  u8 *memory;
+  u32 bytes_allocated;
+  u32 max_size;
+  u32 chunk_size;
+  u32 clear_count; // parent->clear_count when the chunk was taken
+};
+
+inline ThreadPushAllocator new_thread_push_allocator(PushAllocator *parent, u32 chunk_size = PUSH_ALLOCATOR_CHUNK_SIZE) {
+  ThreadPushAllocator result = {};
+  result.parent = parent;
+  result.chunk_size = chunk_size;
+  result.clear_count = parent->clear_count;
+  return result;
+}
+
+// NOTE : Takes chunk_size bytes from the parent, or whatever is left if that is less but still at
+// least min_size. One CAS unless another thread got there first.
+static u8 *take_chunk(PushAllocator *parent, u32 min_size, u32 *chunk_size) {
+  while (true) {
+    u32 bytes_allocated = parent->bytes_allocated;
+    u64 start = bytes_allocated + get_alignment_offset(parent->memory, bytes_allocated, PUSH_ALLOCATOR_CHUNK_ALIGNMENT);
+    if (start + min_size > parent->max_size) return NULL;
+
+    u32 size = (u32) min((u64) *chunk_size, parent->max_size - start);
+    if (atomic_compare_exchange(&parent->bytes_allocated, bytes_allocated, (u32) start + size)) {
+      *chunk_size = size;
+      return parent->memory + start;
+    }
+  }
+}
+
+static void *alloc_size(ThreadPushAllocator *allocator, u32 size, u64 alignment = 1) {
+  TIMED_FUNCTION();
+
+  if (!size) return NULL;
+  auto parent = allocator->parent;
+  u32 clear_count = parent->clear_count;
+  if (allocator->clear_count != clear_count) {
+    allocator->memory = NULL;
+    allocator->bytes_allocated = allocator->max_size = 0;
+    allocator->clear_count = clear_count;
+  }
+
+  // NOTE : Big or oddly aligned allocations go straight to the parent, they would waste too much
+  // of a chunk.
+  if (size > allocator->chunk_size / 4 || alignment > PUSH_ALLOCATOR_CHUNK_ALIGNMENT) {
+    return alloc_size(parent, size, alignment);
+  }
+
+  u32 bytes_allocated = allocator->bytes_allocated;
+  auto alignment_offset = get_alignment_offset(allocator->memory, bytes_allocated, alignment);
+  if (!allocator->memory || bytes_allocated + size + alignment_offset > allocator->max_size) {
+    u32 chunk_size = allocator->chunk_size;
+    u8 *chunk = take_chunk(parent, size, &chunk_size);
+    if (!chunk) {
+      FAILURE("PushAllocator out of memory.", (u32) parent->bytes_allocated, parent->max_size, size);
+      return NULL;
+    }
+    allocator->memory = chunk;
+    allocator->max_size = chunk_size;
+    bytes_allocated = 0;
+    alignment_offset = 0;
+  }
+
+  allocator->bytes_allocated = bytes_allocated + size + alignment_offset;
+  return allocator->memory + bytes_allocated + alignment_offset;
+}
+
+// NOTE : Lets the next alloc_size take a new chunk. The rest of the old one is lost until the parent is cleared.
+static inline void clear(ThreadPushAllocator *allocator) {
+  allocator->memory = NULL;
+  allocator->bytes_allocated = allocator->max_size = 0;
+}
+
+// NOTE : This thread's allocator for parent. There is one per thread, not one per parent, so
+// switching between parents on the same thread drops the current chunk each time.
+static inline ThreadPushAllocator *thread_push_allocator(PushAllocator *parent) {
+  static thread_local ThreadPushAllocator allocator = {};
+  if (allocator.parent != parent) allocator = new_thread_push_allocator(parent);
+  return &allocator;
+}
+#endif
+
 #define ALLOC_STRUCT(allocator, type) ((type *) alloc_size((allocator), sizeof(type), alignof(type)))
 #define ALLOC_ARRAY(allocator, type, count) ((type *) alloc_size((allocator), sizeof(type) * (count), alignof(type)))
 
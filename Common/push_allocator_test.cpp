@@ -0,0 +1,209 @@
+
+#include <thread>
+#include <time.h>
+#include "common.h"
+#include "atomics.h"
+#define PUSH_ALLOCATOR_MULTITHREADED
+#include "push_allocator.h"
+
+#define TEST_THREADS 8
+
+void thread_push_allocator_test() {
+  printf("ThreadPushAllocator test begin.\n");
+  u32 chunk_size = 1024;
+  // NOTE : Aligned like a chunk so the offsets below are exact.
+  PushAllocator raw = new_push_allocator(chunk_size * 8 + PUSH_ALLOCATOR_CHUNK_ALIGNMENT);
+  PushAllocator parent_ = new_push_allocator(&raw, chunk_size * 8, PUSH_ALLOCATOR_CHUNK_ALIGNMENT);
+  auto parent = &parent_;
+  assert(is_initialized(parent));
+
+  // NOTE : The first allocation takes a chunk, the rest bump inside it.
+  ThreadPushAllocator local_ = new_thread_push_allocator(parent, chunk_size);
+  auto local = &local_;
+  u8 *first = (u8 *) alloc_size(local, 3);
+  assert(first == parent->memory);
+  assert(parent->bytes_allocated == chunk_size);
+  u64 *second = ALLOC_STRUCT(local, u64);
+  assert((u8 *) second == first + 8);
+  u32 *array = ALLOC_ARRAY(local, u32, 4);
+  assert((u8 *) array == first + 16);
+  assert(local->bytes_allocated == 32);
+  assert(parent->bytes_allocated == chunk_size);
+
+  // NOTE : Big ones come from the parent and leave the chunk alone.
+  u8 *big = (u8 *) alloc_size(local, chunk_size / 2);
+  assert(big == parent->memory + chunk_size);
+  assert(local->memory == first && local->bytes_allocated == 32);
+
+  // NOTE : A full chunk is replaced by a new aligned one.
+  assert(alloc_size(parent, 1));
+  for (u32 i = 0; i < (chunk_size - 32) / 16; i++) assert(alloc_size(local, 16));
+  assert(local->bytes_allocated == chunk_size);
+  u8 *next = (u8 *) alloc_size(local, 16);
+  assert(next == parent->memory + chunk_size * 2 - chunk_size / 2 + PUSH_ALLOCATOR_CHUNK_ALIGNMENT);
+
+  // NOTE : Clearing the parent makes the chunk stale.
+  clear(parent);
+  assert(alloc_size(local, 16) == parent->memory);
+  assert(parent->bytes_allocated == chunk_size);
+
+  // NOTE : The last chunk is whatever is left if it is smaller.
+  parent->bytes_allocated = chunk_size * 8 - 128;
+  clear(local);
+  assert(alloc_size(local, 64) == parent->memory + chunk_size * 8 - 128);
+  assert(local->max_size == 128);
+  assert(parent->bytes_allocated == parent->max_size);
+
+  assert(thread_push_allocator(parent) == thread_push_allocator(parent));
+  assert(thread_push_allocator(parent)->parent == parent);
+
+  free(raw.memory);
+  printf("ThreadPushAllocator test successful.\n\n");
+}
+
+void push_marker_test() {
+  printf("PushMarker test begin.\n");
+  PushAllocator a_ = new_push_allocator(1024);
+  auto a = &a_;
+  assert(alloc_size(a, 10));
+
+  // NOTE : Unlike push_temporary the allocator is still usable after saving.
+  PushMarker outer = save_marker(a);
+  assert(remaining_size(a) == 1014);
+  u8 *scratch = (u8 *) alloc_size(a, 100);
+  assert(scratch == a->memory + 10);
+  {
+    SCOPED_MARKER(a);
+    assert(alloc_size(a, 200));
+    {
+      SCOPED_MARKER(a);
+      SCOPED_MARKER(a);
+      assert(alloc_size(a, 300));
+      assert(a->bytes_allocated == 610);
+    }
+    assert(a->bytes_allocated == 310);
+  }
+  assert(a->bytes_allocated == 110);
+  PushMarker inner = save_marker(a);
+  assert(alloc_size(a, 50));
+  restore_marker(a, inner);
+  assert(a->bytes_allocated == 110);
+  restore_marker(a, outer);
+  assert(a->bytes_allocated == 10);
+  assert(alloc_size(a, 100) == scratch);
+
+  // NOTE : Chunks taken after a marker are dropped when it is restored.
+  ThreadPushAllocator local = new_thread_push_allocator(a, 256);
+  PushMarker before_chunk = save_marker(a);
+  u8 *in_chunk = (u8 *) alloc_size(&local, 16);
+  assert(in_chunk);
+  restore_marker(a, before_chunk);
+  assert(alloc_size(&local, 16) == in_chunk);
+
+  free(a->memory);
+  printf("PushMarker test successful.\n\n");
+}
+
+struct ThreadTestWork {
+  PushAllocator *parent;
+  u32 id;
+  u32 count;
+  u32 **allocations;
+};
+
+static void fill_allocations(ThreadTestWork *work) {
+  auto local = thread_push_allocator(work->parent);
+  for (u32 i = 0; i < work->count; i++) {
+    u32 length = 1 + i % 7;
+    u32 *allocation = ALLOC_ARRAY(local, u32, length + 1);
+    assert(allocation);
+    allocation[0] = length;
+    for (u32 j = 1; j <= length; j++) allocation[j] = work->id;
+    work->allocations[i] = allocation;
+  }
+}
+
+// NOTE : Every thread writes its id over its own allocations, so any overlap shows up afterwards.
+void thread_push_allocator_threads_test() {
+  printf("ThreadPushAllocator threads test begin.\n");
+  u32 count = 20000;
+  PushAllocator parent = new_push_allocator(TEST_THREADS * count * 32 + TEST_THREADS * PUSH_ALLOCATOR_CHUNK_SIZE);
+  assert(is_initialized(&parent));
+
+  ThreadTestWork work[TEST_THREADS];
+  std::thread threads[TEST_THREADS];
+  for (u32 i = 0; i < TEST_THREADS; i++) {
+    work[i] = { &parent, i + 1, count, (u32 **) malloc(count * sizeof(u32 *)) };
+    threads[i] = std::thread(fill_allocations, work + i);
+  }
+  for (u32 i = 0; i < TEST_THREADS; i++) threads[i].join();
+
+  for (u32 i = 0; i < TEST_THREADS; i++) {
+    for (u32 j = 0; j < count; j++) {
+      u32 *allocation = work[i].allocations[j];
+      assert((u64) allocation % alignof(u32) == 0);
+      assert(allocation[0] == 1 + j % 7);
+      for (u32 k = 1; k <= allocation[0]; k++) assert(allocation[k] == work[i].id);
+    }
+    free(work[i].allocations);
+  }
+
+  free(parent.memory);
+  printf("ThreadPushAllocator threads test successful.\n\n");
+}
+
+//
+// Benchmark ---
+//
+
+static inline u64 time_ns() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (u64) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void bench_shared(PushAllocator *parent, u32 count) {
+  for (u32 i = 0; i < count; i++) *ALLOC_STRUCT(parent, u64) = i;
+}
+
+static void bench_local(PushAllocator *parent, u32 count) {
+  auto local = thread_push_allocator(parent);
+  for (u32 i = 0; i < count; i++) *ALLOC_STRUCT(local, u64) = i;
+}
+
+static f64 run_bench(void (*proc)(PushAllocator *, u32), PushAllocator *parent, u32 thread_count, u32 count) {
+  clear(parent);
+  std::thread threads[TEST_THREADS];
+  u64 start = time_ns();
+  for (u32 i = 0; i < thread_count; i++) threads[i] = std::thread(proc, parent, count);
+  for (u32 i = 0; i < thread_count; i++) threads[i].join();
+  return (f64) (time_ns() - start) / ((f64) thread_count * count);
+}
+
+// NOTE : Same small allocations through the shared CAS and through thread_push_allocator.
+void push_allocator_bench() {
+  u32 count = 1000000;
+  PushAllocator parent = new_push_allocator(TEST_THREADS * count * 8 + TEST_THREADS * PUSH_ALLOCATOR_CHUNK_SIZE);
+  assert(is_initialized(&parent));
+  printf("%u u64 allocations per thread, ns per allocation :\n", count);
+  printf("threads    shared     local\n");
+  for (u32 thread_count = 1; thread_count <= TEST_THREADS; thread_count *= 2) {
+    f64 shared = run_bench(bench_shared, &parent, thread_count, count);
+    f64 local = run_bench(bench_local, &parent, thread_count, count);
+    printf("%7u %9.2f %9.2f\n", thread_count, shared, local);
+  }
+  free(parent.memory);
+}
+
+// NOTE : push_allocator_test bench runs the contention benchmark instead.
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    push_allocator_bench();
+    return EXIT_SUCCESS;
+  }
+  push_marker_test();
+  thread_push_allocator_test();
+  thread_push_allocator_threads_test();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+#ifndef _SLAB_ALLOCATOR_H_
+#define _SLAB_ALLOCATOR_H_
+
+#include "heap_allocator.h"
+
+// NOTE : A HeapAllocator per power of two size class, 8 bytes up to SLAB_MAX_ELEMENT_SIZE. When a
+// class runs out it takes another slab from the backing PushAllocator instead of failing, so
+// small objects that come and go don't need malloc. Memory only goes back to the backing
+// allocator when it is cleared. Allocs and frees are thread safe if the backing allocator is
+// (PUSH_ALLOCATOR_MULTITHREADED). Two threads that find a class empty at once both add a slab.
+
+#define SLAB_MIN_SIZE_SHIFT 3
+#define SLAB_CLASS_COUNT 10
+#define SLAB_MAX_ELEMENT_SIZE (1U << (SLAB_MIN_SIZE_SHIFT + SLAB_CLASS_COUNT - 1))
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MAX_ALIGNMENT 64
+
+struct SlabClass {
+  HeapAllocator heap;
+  atomic_uint slab_count;
+  atomic_uint capacity; // NOTE : Elements in all the slabs.
+  atomic_uint in_use;
+  atomic_uint peak;     // NOTE : Most in_use has been.
+};
+
+struct SlabAllocator {
+  PushAllocator *backing;
+  u32 slab_size;
+  SlabClass classes[SLAB_CLASS_COUNT];
+};
+
+static inline u32 get_slab_class(u32 size) {
+  if (size <= (1U << SLAB_MIN_SIZE_SHIFT)) return 0;
+  return 32 - __builtin_clz(size - 1) - SLAB_MIN_SIZE_SHIFT;
+}
+
+static inline u32 get_slab_alignment(u32 element_size) {
+  return min(element_size, (u32) SLAB_MAX_ALIGNMENT);
+}
+
+// NOTE : Nothing is taken from backing until the first alloc of each class.
+inline SlabAllocator new_slab_allocator(PushAllocator *backing, u32 slab_size = SLAB_SIZE) {
+  SlabAllocator result = {};
+  result.backing = backing;
+  result.slab_size = slab_size;
+  for (u32 i = 0; i < SLAB_CLASS_COUNT; i++) {
+    result.classes[i].heap.element_size = 1U << (SLAB_MIN_SIZE_SHIFT + i);
+  }
+  return result;
+}
+
+static bool grow_slab_class(SlabAllocator *allocator, SlabClass *slab_class) {
+  u32 element_size = slab_class->heap.element_size;
+  // NOTE : Classes bigger than slab_size get one element per slab.
+  u32 count = max(allocator->slab_size / element_size, 1U);
+  if (!grow_heap(&slab_class->heap, allocator->backing, count, get_slab_alignment(element_size))) return false;
+  slab_class->slab_count++;
+  slab_class->capacity += count;
+  return true;
+}
+
+static void *alloc_size(SlabAllocator *allocator, u32 size, u64 alignment = 1) {
+  if (!size) return NULL;
+  u32 index = get_slab_class(size);
+  if (index >= SLAB_CLASS_COUNT) {
+    FAILURE("SlabAllocator size too big.", size, (u32) SLAB_MAX_ELEMENT_SIZE);
+    return NULL;
+  }
+  auto slab_class = allocator->classes + index;
+  assert(alignment <= get_slab_alignment(slab_class->heap.element_size));
+
+  FreeListNode *node;
+  while (!(node = pop_free(&slab_class->heap))) {
+    if (!grow_slab_class(allocator, slab_class)) return NULL;
+  }
+
+  // NOTE : += returns the old value.
+  u32 in_use = (slab_class->in_use += 1) + 1;
+  u32 peak = slab_class->peak;
+  while (in_use > peak && !atomic_compare_exchange(&slab_class->peak, peak, in_use)) peak = slab_class->peak;
+  return (void *) node;
+}
+
+// NOTE : size has to be what it was allocated with, or at least in the same class.
+static void free_size(SlabAllocator *allocator, void *elem, u32 size) {
+  if (!elem) return;
+  u32 index = get_slab_class(size);
+  assert(index < SLAB_CLASS_COUNT);
+  auto slab_class = allocator->classes + index;
+  auto node = (FreeListNode *) elem;
+  push_free_chain(&slab_class->heap, node, node);
+  slab_class->in_use -= 1;
+}
+
+#define SLAB_FREE(allocator, elem) free_size((allocator), (void *) (elem), sizeof(*(elem)))
+#define SLAB_FREE_ARRAY(allocator, elems, count) free_size((allocator), (void *) (elems), sizeof(*(elems)) * (count))
+
+// NOTE : in_use / capacity for the class size falls in, 0 if it has no slabs yet.
+static inline f32 get_occupancy(SlabAllocator *allocator, u32 size) {
+  auto slab_class = allocator->classes + get_slab_class(size);
+  u32 capacity = slab_class->capacity;
+  if (!capacity) return 0;
+  return (f32) (u32) slab_class->in_use / (f32) capacity;
+}
+
+static void print_slab_occupancy(SlabAllocator *allocator, FILE *out = stdout) {
+  fprintf(out, "  size  slabs    in use  capacity      peak  occupancy\n");
+  for (u32 i = 0; i < SLAB_CLASS_COUNT; i++) {
+    auto slab_class = allocator->classes + i;
+    if (!slab_class->slab_count) continue;
+    fprintf(out, "%6u %6u %9u %9u %9u %9.1f%%\n", slab_class->heap.element_size, (u32) slab_class->slab_count,
+            (u32) slab_class->in_use, (u32) slab_class->capacity, (u32) slab_class->peak,
+            100.0f * get_occupancy(allocator, slab_class->heap.element_size));
+  }
+}
+
+#endif // _SLAB_ALLOCATOR_H_
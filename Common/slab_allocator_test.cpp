@@ -0,0 +1,123 @@
+
+#include <thread>
+#include "common.h"
+#include "atomics.h"
+#define PUSH_ALLOCATOR_MULTITHREADED
+#include "push_allocator.h"
+#include "slab_allocator.h"
+
+#define TEST_THREADS 4
+
+struct SmallThing {
+  u32 a, b, c;
+};
+
+struct alignas(64) BigThing {
+  u8 data[200];
+};
+
+void slab_allocator_test() {
+  printf("SlabAllocator test begin.\n");
+  assert(get_slab_class(1) == 0);
+  assert(get_slab_class(8) == 0);
+  assert(get_slab_class(9) == 1);
+  assert(get_slab_class(16) == 1);
+  assert(get_slab_class(SLAB_MAX_ELEMENT_SIZE) == SLAB_CLASS_COUNT - 1);
+
+  u32 slab_size = 1024;
+  PushAllocator backing = new_push_allocator(64 * 1024);
+  SlabAllocator slabs_ = new_slab_allocator(&backing, slab_size);
+  auto slabs = &slabs_;
+  assert(backing.bytes_allocated == 0);
+
+  // NOTE : 12 bytes go in the 16 byte class, 64 per slab.
+  SmallThing *things[200];
+  for (u32 i = 0; i < 200; i++) {
+    things[i] = ALLOC_STRUCT(slabs, SmallThing);
+    assert(things[i]);
+    assert((u64) things[i] % 16 == 0);
+    things[i]->a = i;
+  }
+  auto small = slabs->classes + get_slab_class(sizeof(SmallThing));
+  assert(small->slab_count == 4);
+  assert(small->capacity == 256);
+  assert(small->in_use == 200);
+  assert(get_occupancy(slabs, sizeof(SmallThing)) == 200.0f / 256.0f);
+  for (u32 i = 0; i < 200; i++) assert(things[i]->a == i);
+
+  // NOTE : Freed elements are reused before any new slab.
+  u32 backing_used = backing.bytes_allocated;
+  for (u32 i = 0; i < 100; i++) SLAB_FREE(slabs, things[i]);
+  assert(small->in_use == 100);
+  for (u32 i = 0; i < 150; i++) assert(ALLOC_STRUCT(slabs, SmallThing));
+  assert(backing.bytes_allocated == backing_used);
+  assert(small->in_use == 250 && small->peak == 250);
+  assert(small->slab_count == 4);
+
+  // NOTE : Classes are separate and big ones keep their alignment.
+  BigThing *big = ALLOC_STRUCT(slabs, BigThing);
+  assert((u64) big % 64 == 0);
+  auto big_class = slabs->classes + get_slab_class(sizeof(BigThing));
+  assert(big_class->heap.element_size == 256);
+  assert(big_class->slab_count == 1 && big_class->in_use == 1);
+  u32 *array = ALLOC_ARRAY(slabs, u32, 100);
+  assert(array);
+  SLAB_FREE_ARRAY(slabs, array, 100);
+  assert(slabs->classes[get_slab_class(400)].in_use == 0);
+  SLAB_FREE(slabs, big);
+  assert(big_class->in_use == 0 && big_class->peak == 1);
+
+  free(backing.memory);
+  printf("SlabAllocator test successful.\n\n");
+}
+
+// NOTE : Every thread keeps a window of live objects of changing sizes, stamped to catch overlap.
+static void churn_slabs(SlabAllocator *slabs, u32 id) {
+  u32 *live[64] = {};
+  u32 sizes[64] = {};
+  u64 random = id * 0x9E3779B97F4A7C15ULL;
+  for (u32 i = 0; i < 100000; i++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    u32 slot = random % 64;
+    if (live[slot]) {
+      for (u32 j = 0; j < sizes[slot] / 4; j++) assert(live[slot][j] == id);
+      free_size(slabs, live[slot], sizes[slot]);
+    }
+    sizes[slot] = 4 * (1 + (random >> 8) % 128);
+    live[slot] = (u32 *) alloc_size(slabs, sizes[slot], 4);
+    for (u32 j = 0; j < sizes[slot] / 4; j++) live[slot][j] = id;
+  }
+  for (u32 slot = 0; slot < 64; slot++) {
+    if (live[slot]) free_size(slabs, live[slot], sizes[slot]);
+  }
+}
+
+void slab_allocator_threads_test() {
+  printf("SlabAllocator threads test begin.\n");
+  PushAllocator backing = new_push_allocator(16 * 1024 * 1024);
+  SlabAllocator slabs = new_slab_allocator(&backing);
+
+  std::thread threads[TEST_THREADS];
+  for (u32 i = 0; i < TEST_THREADS; i++) threads[i] = std::thread(churn_slabs, &slabs, i + 1);
+  for (u32 i = 0; i < TEST_THREADS; i++) threads[i].join();
+
+  for (u32 i = 0; i < SLAB_CLASS_COUNT; i++) {
+    auto slab_class = slabs.classes + i;
+    assert(slab_class->in_use == 0);
+    assert(slab_class->peak <= slab_class->capacity);
+    assert(slab_class->capacity == slab_class->slab_count * (SLAB_SIZE / slab_class->heap.element_size));
+  }
+  print_slab_occupancy(&slabs);
+
+  free(backing.memory);
+  printf("SlabAllocator threads test successful.\n\n");
+}
+
+int main() {
+  slab_allocator_test();
+  slab_allocator_threads_test();
+
+  return EXIT_SUCCESS;
+}
@@ -1,33 +1,54 @@
-
-// TODO make this multithreaded
-
 #ifndef _SWAP_ALLOCATOR_H_
 #define _SWAP_ALLOCATOR_H_
 
 #include "push_allocator.h"
+#include "atomics.h"
+
+// NOTE : Allocations go into the active buffer, or the next one with room. A buffer empties by
+// itself once everything in it is freed. Allocs and frees are thread safe : each buffer's ref
+// count and size share one 64 bit word that is only changed by CAS, so a buffer can't be reset
+// by its last free while another thread is allocating from it.
+//
+// Frames : begin_frame moves allocation to the next buffer and holds it with a fence reference
+// until end_frame, so a producer can have buffer_count frames in flight while consumers free
+// what they used. When the next buffer is still busy begin_frame returns false instead of
+// blocking. While a frame is open allocations only come from its buffer and fail once it is
+// full, spilling into another buffer could put them in a frame that is still in flight.
 
 struct SwapAllocatorReference {
   void *memory;
   uint32_t buffer_idx;
 };
 
+// NOTE : ref count in the high 32 bits, bytes allocated in the low 32.
 struct SwapBufferHead {
-  uint32_t ref_count;
-  uint32_t bytes_allocated;
+  atomic_u64 state;
+};
+
+struct SwapFrame {
+  uint32_t buffer_idx;
 };
 
 #ifndef SWAP_ALLOCATOR_BUFFER_COUNT
 #define SWAP_ALLOCATOR_BUFFER_COUNT 2
 #endif
+#define SWAP_ALLOCATOR_MAX_BUFFERS 8
+#define SWAP_FRAME_OPEN 0x80000000 // NOTE : Set in active_buffer from begin_frame to end_frame.
 
 struct SwapAllocator {
   uint8_t *memory;
-  SwapBufferHead buffers[SWAP_ALLOCATOR_BUFFER_COUNT];
-  uint32_t active_buffer;
+  SwapBufferHead buffers[SWAP_ALLOCATOR_MAX_BUFFERS];
+  atomic_uint active_buffer;
   uint32_t buffer_size; // NOTE : Size of each individual buffer
+  uint32_t buffer_count;
 };
 
-static uint32_t calc_swap_allocator_memory_size(uint32_t buffer_size) { return buffer_size * SWAP_ALLOCATOR_BUFFER_COUNT; }
+static inline uint32_t get_ref_count(SwapBufferHead *buffer) { return (uint32_t) ((uint64_t) buffer->state >> 32); }
+static inline uint32_t get_bytes_allocated(SwapBufferHead *buffer) { return (uint32_t) buffer->state; }
+
+static uint32_t calc_swap_allocator_memory_size(uint32_t buffer_size, uint32_t buffer_count = SWAP_ALLOCATOR_BUFFER_COUNT) {
+  return buffer_size * buffer_count;
+}
 
 static bool is_initialized(SwapAllocator *allocator) {
   if (!allocator) return false;
@@ -36,22 +57,23 @@ static bool is_initialized(SwapAllocator *allocator) {
   return true;
 }
 
+// NOTE : Not thread safe, nothing may be using the allocator.
 static void clear(SwapAllocator *allocator) {
-  auto mem = allocator->memory;
-  auto size = allocator->buffer_size;
-  *allocator = {};
-  allocator->memory = mem;
-  allocator->buffer_size = size;
+  for (uint32_t i = 0; i < SWAP_ALLOCATOR_MAX_BUFFERS; i++) allocator->buffers[i].state = 0;
+  allocator->active_buffer = 0;
 }
 
-static SwapAllocator new_swap_allocator(PushAllocator *allocator, uint32_t buffer_size) {
+static SwapAllocator new_swap_allocator(PushAllocator *allocator, uint32_t buffer_size,
+                                        uint32_t buffer_count = SWAP_ALLOCATOR_BUFFER_COUNT) {
+  assert(buffer_count > 0 && buffer_count <= SWAP_ALLOCATOR_MAX_BUFFERS);
   // TODO choose a good alignment here
-  uint8_t *mem = (uint8_t *) alloc_size(allocator, calc_swap_allocator_memory_size(buffer_size), 8);
+  uint8_t *mem = (uint8_t *) alloc_size(allocator, calc_swap_allocator_memory_size(buffer_size, buffer_count), 8);
   if (!mem) return {};
 
   SwapAllocator result = {};
   result.memory = mem;
   result.buffer_size = buffer_size;
+  result.buffer_count = buffer_count;
 
   return result;
 }
@@ -59,29 +81,36 @@ static SwapAllocator new_swap_allocator(PushAllocator *allocator, uint32_t buffe
 static SwapAllocatorReference alloc_size(SwapAllocator *allocator, uint32_t size, uint64_t alignment = 1) {
   assert(is_initialized(allocator));
 
-  for (int i = 0; i < SWAP_ALLOCATOR_BUFFER_COUNT; i++) {
-    uint32_t buffer_idx = (allocator->active_buffer + i) % SWAP_ALLOCATOR_BUFFER_COUNT;
+  uint32_t active = allocator->active_buffer;
+  uint32_t buffers = active & SWAP_FRAME_OPEN ? 1 : allocator->buffer_count;
+  active &= ~SWAP_FRAME_OPEN;
+  for (uint32_t i = 0; i < buffers; i++) {
+    uint32_t buffer_idx = (active + i) % allocator->buffer_count;
     auto active_buffer = allocator->buffers + buffer_idx;
-    auto active_memory = allocator->memory + allocator->buffer_size * buffer_idx; 
+    auto active_memory = allocator->memory + allocator->buffer_size * buffer_idx;
 
-    uint32_t bytes_allocated = active_buffer->bytes_allocated;
+    while (true) {
+      uint64_t state = active_buffer->state;
+      uint32_t bytes_allocated = (uint32_t) state;
+      auto alignment_offset = get_alignment_offset(active_memory, bytes_allocated, alignment);
 
-    auto alignment_offset = get_alignment_offset(active_memory, bytes_allocated, alignment);
+      if (bytes_allocated + size + alignment_offset > allocator->buffer_size) {
+        break;
+      }
 
-    if (bytes_allocated + size + alignment_offset > allocator->buffer_size) {
-      continue;
-    }
+      uint64_t new_state = state + (1ULL << 32) + size + alignment_offset;
+      if (!atomic_compare_exchange(&active_buffer->state, state, new_state)) continue;
 
-    // Allocation Success
-    allocator->active_buffer = buffer_idx;
-    active_buffer->bytes_allocated += size + alignment_offset;
-    active_buffer->ref_count++;
+      // Allocation Success
+      // NOTE : Doesn't move it if a frame began in the meantime.
+      if (buffer_idx != active) atomic_compare_exchange(&allocator->active_buffer, active, buffer_idx);
 
-    SwapAllocatorReference result;
-    result.memory = active_memory + bytes_allocated + alignment_offset;
-    result.buffer_idx = buffer_idx;
-    assert(((uint64_t)result.memory) % alignment == 0);
-    return result;
+      SwapAllocatorReference result;
+      result.memory = active_memory + bytes_allocated + alignment_offset;
+      result.buffer_idx = buffer_idx;
+      assert(((uint64_t)result.memory) % alignment == 0);
+      return result;
+    }
   }
 
   // Allocation Failed
@@ -91,11 +120,14 @@ static SwapAllocatorReference alloc_size(SwapAllocator *allocator, uint32_t size
 
 static void free(SwapAllocator *allocator, SwapAllocatorReference ref) {
   assert(is_initialized(allocator));
-  assert(ref.buffer_idx < SWAP_ALLOCATOR_BUFFER_COUNT);
+  assert(ref.buffer_idx < allocator->buffer_count);
   auto buf = allocator->buffers + ref.buffer_idx;
-  buf->ref_count--;
-  if (buf->ref_count == 0) {
-    buf->bytes_allocated = 0;
+  while (true) {
+    uint64_t state = buf->state;
+    assert(state >> 32);
+    // NOTE : The last reference empties the buffer.
+    uint64_t new_state = (state >> 32) == 1 ? 0 : state - (1ULL << 32);
+    if (atomic_compare_exchange(&buf->state, state, new_state)) return;
   }
 }
 
@@ -105,5 +137,23 @@ static void free(SwapAllocator *allocator, void *ptr) {
   free(allocator, {ptr, buffer_idx});
 }
 
-#endif
+// NOTE : Only one thread should be producing frames.
+static bool begin_frame(SwapAllocator *allocator, SwapFrame *frame) {
+  assert(is_initialized(allocator));
+  uint32_t active = allocator->active_buffer;
+  assert(!(active & SWAP_FRAME_OPEN));
+  uint32_t buffer_idx = (active + 1) % allocator->buffer_count;
+  // NOTE : Only takes the buffer if it is empty, the fence is its first reference.
+  if (!atomic_compare_exchange(&allocator->buffers[buffer_idx].state, 0, 1ULL << 32)) return false;
+  allocator->active_buffer = buffer_idx | SWAP_FRAME_OPEN;
+  frame->buffer_idx = buffer_idx;
+  return true;
+}
+
+// NOTE : The frame's buffer empties once everything allocated in it is freed too.
+static void end_frame(SwapAllocator *allocator, SwapFrame frame) {
+  allocator->active_buffer = frame.buffer_idx;
+  free(allocator, SwapAllocatorReference{NULL, frame.buffer_idx});
+}
 
+#endif
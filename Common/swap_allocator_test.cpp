@@ -1,8 +1,11 @@
 
 
+#include <thread>
 #include "common.h"
 #include "swap_allocator.h"
 
+#define TEST_THREADS 4
+
 void swap_allocator_test() {
   printf("SwapAllocator test begin.\n");
   uint32_t buffer_size = 2048;
@@ -23,10 +26,10 @@ void swap_allocator_test() {
   assert(ref.memory == a->memory);
   assert(ref.buffer_idx == 0);
 
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == buffer_size);
-  assert(buf_2->ref_count == 0);
-  assert(buf_2->bytes_allocated == 0);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == buffer_size);
+  assert(get_ref_count(buf_2) == 0);
+  assert(get_bytes_allocated(buf_2) == 0);
 
   ref = alloc_size(a, buffer_size);
   auto ref_2 = ref;
@@ -34,19 +37,19 @@ void swap_allocator_test() {
   assert(ref_1.memory != ref_2.memory);
   assert(ref_1.buffer_idx != ref_2.buffer_idx);
 
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == buffer_size);
-  assert(buf_2->ref_count == 1);
-  assert(buf_2->bytes_allocated == buffer_size);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == buffer_size);
+  assert(get_ref_count(buf_2) == 1);
+  assert(get_bytes_allocated(buf_2) == buffer_size);
 
   ref = alloc_size(a, buffer_size);
   assert(!ref.memory);
 
   free(a, ref_1);
-  assert(buf_1->ref_count == 0);
-  assert(buf_1->bytes_allocated == 0);
-  assert(buf_2->ref_count == 1);
-  assert(buf_2->bytes_allocated == buffer_size);
+  assert(get_ref_count(buf_1) == 0);
+  assert(get_bytes_allocated(buf_1) == 0);
+  assert(get_ref_count(buf_2) == 1);
+  assert(get_bytes_allocated(buf_2) == buffer_size);
 
   ref = alloc_size(a, buffer_size);
   assert(ref.memory);
@@ -54,46 +57,46 @@ void swap_allocator_test() {
   assert(ref.buffer_idx == ref_1.buffer_idx);
 
   free(a, ref_2.memory);
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == buffer_size);
-  assert(buf_2->ref_count == 0);
-  assert(buf_2->bytes_allocated == 0);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == buffer_size);
+  assert(get_ref_count(buf_2) == 0);
+  assert(get_bytes_allocated(buf_2) == 0);
 
   SwapAllocatorReference refs[4];
   ref = refs[0] = alloc_size(a, buffer_size / 4);
   assert(ref.memory);
   assert(ref.buffer_idx == 1);
-  assert(buf_2->ref_count == 1);
+  assert(get_ref_count(buf_2) == 1);
 
   ref = refs[1] = alloc_size(a, buffer_size / 4);
   assert(ref.memory);
   assert(ref.buffer_idx == 1);
-  assert(buf_2->ref_count == 2);
+  assert(get_ref_count(buf_2) == 2);
 
   ref = refs[2] = alloc_size(a, buffer_size / 4);
   assert(ref.memory);
   assert(ref.buffer_idx == 1);
-  assert(buf_2->ref_count == 3);
+  assert(get_ref_count(buf_2) == 3);
 
   ref = refs[3] = alloc_size(a, buffer_size / 4);
   assert(ref.memory);
   assert(ref.buffer_idx == 1);
-  assert(buf_2->ref_count == 4);
+  assert(get_ref_count(buf_2) == 4);
 
   free(a, refs[2]);
-  assert(buf_2->ref_count == 3);
+  assert(get_ref_count(buf_2) == 3);
   free(a, refs[0]);
-  assert(buf_2->ref_count == 2);
+  assert(get_ref_count(buf_2) == 2);
   free(a, refs[3].memory);
-  assert(buf_2->ref_count == 1);
+  assert(get_ref_count(buf_2) == 1);
   free(a, refs[1]);
-  assert(buf_2->ref_count == 0);
+  assert(get_ref_count(buf_2) == 0);
 
   clear(a);
-  assert(buf_1->ref_count == 0);
-  assert(buf_1->bytes_allocated == 0);
-  assert(buf_2->ref_count == 0);
-  assert(buf_2->bytes_allocated == 0);
+  assert(get_ref_count(buf_1) == 0);
+  assert(get_bytes_allocated(buf_1) == 0);
+  assert(get_ref_count(buf_2) == 0);
+  assert(get_bytes_allocated(buf_2) == 0);
 
   uint32_t mid_size = buffer_size * 3 / 4;
   ref = alloc_size(a, mid_size);
@@ -102,10 +105,10 @@ void swap_allocator_test() {
   assert(ref.memory == a->memory);
   assert(ref.buffer_idx == 0);
 
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == mid_size);
-  assert(buf_2->ref_count == 0);
-  assert(buf_2->bytes_allocated == 0);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == mid_size);
+  assert(get_ref_count(buf_2) == 0);
+  assert(get_bytes_allocated(buf_2) == 0);
 
   ref = alloc_size(a, mid_size);
   ref_2 = ref;
@@ -113,19 +116,19 @@ void swap_allocator_test() {
   assert(ref_1.memory != ref_2.memory);
   assert(ref_1.buffer_idx != ref_2.buffer_idx);
 
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == mid_size);
-  assert(buf_2->ref_count == 1);
-  assert(buf_2->bytes_allocated == mid_size);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == mid_size);
+  assert(get_ref_count(buf_2) == 1);
+  assert(get_bytes_allocated(buf_2) == mid_size);
 
   ref = alloc_size(a, mid_size);
   assert(!ref.memory);
 
   free(a, ref_1);
-  assert(buf_1->ref_count == 0);
-  assert(buf_1->bytes_allocated == 0);
-  assert(buf_2->ref_count == 1);
-  assert(buf_2->bytes_allocated == mid_size);
+  assert(get_ref_count(buf_1) == 0);
+  assert(get_bytes_allocated(buf_1) == 0);
+  assert(get_ref_count(buf_2) == 1);
+  assert(get_bytes_allocated(buf_2) == mid_size);
 
   ref = alloc_size(a, mid_size);
   assert(ref.memory);
@@ -133,16 +136,117 @@ void swap_allocator_test() {
   assert(ref.buffer_idx == ref_1.buffer_idx);
 
   free(a, ref_2.memory);
-  assert(buf_1->ref_count == 1);
-  assert(buf_1->bytes_allocated == mid_size);
-  assert(buf_2->ref_count == 0);
-  assert(buf_2->bytes_allocated == 0);
+  assert(get_ref_count(buf_1) == 1);
+  assert(get_bytes_allocated(buf_1) == mid_size);
+  assert(get_ref_count(buf_2) == 0);
+  assert(get_bytes_allocated(buf_2) == 0);
 
   printf("SwapAllocator test successful.\n\n");
 }
 
+void swap_allocator_frame_test() {
+  printf("SwapAllocator frame test begin.\n");
+  uint32_t buffer_size = 1024;
+  uint32_t buffer_count = 3;
+  PushAllocator mem = new_push_allocator(calc_swap_allocator_memory_size(buffer_size, buffer_count));
+  SwapAllocator a_ = new_swap_allocator(&mem, buffer_size, buffer_count);
+  auto a = &a_;
+  assert(a->buffer_count == 3);
+
+  // NOTE : Each frame takes the next buffer, three can be in flight.
+  SwapFrame frames[3];
+  SwapAllocatorReference refs[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    assert(begin_frame(a, frames + i));
+    assert(frames[i].buffer_idx == (i + 1) % 3);
+    refs[i] = alloc_size(a, 100);
+    assert(refs[i].buffer_idx == frames[i].buffer_idx);
+    assert(get_ref_count(a->buffers + frames[i].buffer_idx) == 2);
+    end_frame(a, frames[i]);
+  }
+  SwapFrame frame;
+  assert(!begin_frame(a, &frame));
+
+  // NOTE : The oldest frame's buffer comes back once its last allocation is freed.
+  free(a, refs[0]);
+  assert(get_bytes_allocated(a->buffers + frames[0].buffer_idx) == 0);
+  assert(begin_frame(a, &frame));
+  assert(frame.buffer_idx == frames[0].buffer_idx);
+
+  // NOTE : The fence keeps the buffer while the frame is open even with nothing else in it.
+  auto ref = alloc_size(a, 10);
+  free(a, ref);
+  assert(get_ref_count(a->buffers + frame.buffer_idx) == 1);
+  assert(get_bytes_allocated(a->buffers + frame.buffer_idx) == 10);
+  end_frame(a, frame);
+  assert(get_bytes_allocated(a->buffers + frame.buffer_idx) == 0);
+
+  free(a, refs[1]);
+  free(a, refs[2].memory);
+  for (uint32_t i = 0; i < buffer_count; i++) assert(a->buffers[i].state == 0);
+
+  // NOTE : A full frame fails instead of spilling into a buffer another frame may be using.
+  assert(begin_frame(a, &frame));
+  ref = alloc_size(a, buffer_size - 100);
+  assert(ref.buffer_idx == frame.buffer_idx);
+  assert(!alloc_size(a, 200).memory);
+  assert(a->active_buffer == (frame.buffer_idx | SWAP_FRAME_OPEN));
+  end_frame(a, frame);
+  auto spilled = alloc_size(a, 200);
+  assert(spilled.memory && spilled.buffer_idx != frame.buffer_idx);
+  free(a, ref);
+  free(a, spilled);
+  for (uint32_t i = 0; i < buffer_count; i++) assert(a->buffers[i].state == 0);
+
+  free(mem.memory);
+  printf("SwapAllocator frame test successful.\n\n");
+}
+
+// NOTE : Threads allocate, stamp and free at once, any overlap or early reset shows up as a
+// changed stamp.
+static void churn_swap_allocator(SwapAllocator *a, uint32_t id) {
+  SwapAllocatorReference refs[8] = {};
+  uint32_t sizes[8] = {};
+  uint64_t random = id * 0x9E3779B97F4A7C15ULL;
+  for (uint32_t i = 0; i < 200000; i++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    uint32_t slot = random % 8;
+    if (refs[slot].memory) {
+      auto words = (uint32_t *) refs[slot].memory;
+      for (uint32_t j = 0; j < sizes[slot] / 4; j++) assert(words[j] == id);
+      free(a, refs[slot]);
+    }
+    sizes[slot] = 4 * (1 + (random >> 8) % 16);
+    refs[slot] = alloc_size(a, sizes[slot], 4);
+    auto words = (uint32_t *) refs[slot].memory;
+    for (uint32_t j = 0; refs[slot].memory && j < sizes[slot] / 4; j++) words[j] = id;
+  }
+  for (uint32_t slot = 0; slot < 8; slot++) {
+    if (refs[slot].memory) free(a, refs[slot]);
+  }
+}
+
+void swap_allocator_threads_test() {
+  printf("SwapAllocator threads test begin.\n");
+  uint32_t buffer_size = 4096;
+  PushAllocator mem = new_push_allocator(calc_swap_allocator_memory_size(buffer_size, 4));
+  SwapAllocator a = new_swap_allocator(&mem, buffer_size, 4);
+
+  std::thread threads[TEST_THREADS];
+  for (uint32_t i = 0; i < TEST_THREADS; i++) threads[i] = std::thread(churn_swap_allocator, &a, i + 1);
+  for (uint32_t i = 0; i < TEST_THREADS; i++) threads[i].join();
+  for (uint32_t i = 0; i < 4; i++) assert(a.buffers[i].state == 0);
+
+  free(mem.memory);
+  printf("SwapAllocator threads test successful.\n\n");
+}
+
 int main() {
   swap_allocator_test();
+  swap_allocator_frame_test();
+  swap_allocator_threads_test();
 
   return EXIT_SUCCESS;
 }
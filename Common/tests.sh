@@ -2,3 +2,8 @@
 ./swap_allocator_test
 ./dynamic_array_test
 ./sort_test
+./push_allocator_test
+./virtual_push_allocator_test
+./heap_allocator_test
+./slab_allocator_test
+./pool_allocator_test
@@ -0,0 +1,140 @@
+#ifndef _VIRTUAL_PUSH_ALLOCATOR_H_
+#define _VIRTUAL_PUSH_ALLOCATOR_H_
+
+#include <sys/mman.h>
+#include "push_allocator.h"
+
+// NOTE : A PushAllocator with 64 bit sizes that reserves address space up front and only commits
+// pages as they are bumped into, so a huge reservation costs nothing until it is used. Pages are
+// committed VIRTUAL_COMMIT_SIZE at a time. Single threaded, unix only (mmap).
+
+#ifndef TIMED_FUNCTION
+#define VIRTUAL_PUSH_ALLOCATOR_NO_DEFINED_TIMER
+#define TIMED_FUNCTION()
+#endif
+
+#define VIRTUAL_COMMIT_SIZE (64 * 1024)
+
+struct VirtualPushAllocator {
+  u8 *memory;
+  u64 bytes_allocated;
+  u64 committed; // NOTE : Bytes from memory that are readable and writable.
+  u64 max_size;  // NOTE : Reserved, a multiple of VIRTUAL_COMMIT_SIZE.
+};
+
+static inline bool is_initialized(VirtualPushAllocator *a) {
+  if (!a) return false;
+  if (!a->memory) return false;
+  if (!a->max_size) return false;
+  return true;
+}
+
+static inline u64 remaining_size(VirtualPushAllocator *allocator) {
+  return allocator->max_size - allocator->bytes_allocated;
+}
+
+static inline u64 round_up_commit_size(u64 size) {
+  return (size + VIRTUAL_COMMIT_SIZE - 1) & ~((u64) VIRTUAL_COMMIT_SIZE - 1);
+}
+
+inline VirtualPushAllocator new_virtual_push_allocator(u64 max_size) {
+  max_size = round_up_commit_size(max_size);
+  void *memory = mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    return {};
+  }
+
+  VirtualPushAllocator result = {};
+  result.memory = (u8 *) memory;
+  result.max_size = max_size;
+  return result;
+}
+
+static inline void free_virtual_push_allocator(VirtualPushAllocator *allocator) {
+  if (allocator->memory) munmap(allocator->memory, allocator->max_size);
+  *allocator = {};
+}
+
+static bool commit_to(VirtualPushAllocator *allocator, u64 size) {
+  u64 committed = round_up_commit_size(size);
+  if (committed <= allocator->committed) return true;
+  if (mprotect(allocator->memory + allocator->committed, committed - allocator->committed, PROT_READ | PROT_WRITE)) {
+    return false;
+  }
+  allocator->committed = committed;
+  return true;
+}
+
+// NOTE : Gives the pages after bytes_allocated back to the os. Mapping PROT_NONE over them again
+// drops their contents on both linux and osx, madvise doesn't always.
+static void decommit(VirtualPushAllocator *allocator) {
+  u64 keep = round_up_commit_size(allocator->bytes_allocated);
+  if (keep >= allocator->committed) return;
+  void *start = allocator->memory + keep;
+  void *result = mmap(start, allocator->committed - keep, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  assert(result == start);
+  allocator->committed = keep;
+}
+
+static void *alloc_size(VirtualPushAllocator *allocator, u64 size, u64 alignment = 1) {
+  TIMED_FUNCTION();
+
+  if (!size) return NULL;
+  u64 bytes_allocated = allocator->bytes_allocated;
+  u64 memory_index = (u64) allocator->memory + bytes_allocated;
+  u64 alignment_offset = (alignment - (memory_index & (alignment - 1))) & (alignment - 1);
+
+  if (size + alignment_offset > remaining_size(allocator)) {
+    FAILURE("VirtualPushAllocator out of memory.", allocator->bytes_allocated, allocator->max_size, size);
+    return NULL;
+  }
+  u64 new_allocated = bytes_allocated + alignment_offset + size;
+  if (!commit_to(allocator, new_allocated)) {
+    FAILURE("VirtualPushAllocator failed to commit.", allocator->committed, new_allocated);
+    return NULL;
+  }
+  allocator->bytes_allocated = new_allocated;
+  return allocator->memory + bytes_allocated + alignment_offset;
+}
+
+// NOTE : Keeps the committed pages for the next use unless decommit_pages.
+static inline void clear(VirtualPushAllocator *allocator, bool decommit_pages = false) {
+  allocator->bytes_allocated = 0;
+  if (decommit_pages) decommit(allocator);
+}
+
+// NOTE : Same as the PushAllocator markers. Restoring doesn't decommit, clear or decommit does.
+struct VirtualPushMarker {
+  u64 bytes_allocated;
+};
+
+static inline VirtualPushMarker save_marker(VirtualPushAllocator *allocator) {
+  VirtualPushMarker result;
+  result.bytes_allocated = allocator->bytes_allocated;
+  return result;
+}
+
+static inline void restore_marker(VirtualPushAllocator *allocator, VirtualPushMarker marker) {
+  assert(marker.bytes_allocated <= allocator->bytes_allocated);
+  allocator->bytes_allocated = marker.bytes_allocated;
+}
+
+// NOTE : A regular PushAllocator inside this one, for code that takes those.
+inline PushAllocator new_push_allocator(VirtualPushAllocator *old, u32 size, u32 alignment = 8) {
+  u8 *memory = (u8 *) alloc_size(old, size, alignment);
+  if (!memory) {
+    return {};
+  }
+
+  PushAllocator result = {};
+  result.memory = memory;
+  result.max_size = size;
+
+  return result;
+}
+
+#ifdef VIRTUAL_PUSH_ALLOCATOR_NO_DEFINED_TIMER
+#undef TIMED_FUNCTION
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+
+#include "common.h"
+#include "virtual_push_allocator.h"
+
+#define GIB (1024ULL * 1024 * 1024)
+
+void virtual_push_allocator_test() {
+  printf("VirtualPushAllocator test begin.\n");
+  // NOTE : Only address space, nothing is committed yet.
+  VirtualPushAllocator a_ = new_virtual_push_allocator(16 * GIB + 1);
+  auto a = &a_;
+  assert(is_initialized(a));
+  assert(a->max_size == 16 * GIB + VIRTUAL_COMMIT_SIZE);
+  assert(a->committed == 0);
+
+  // NOTE : Commits whole steps as it bumps.
+  u8 *first = (u8 *) alloc_size(a, 3);
+  assert(first == a->memory);
+  assert(a->committed == VIRTUAL_COMMIT_SIZE);
+  u64 *second = ALLOC_STRUCT(a, u64);
+  assert((u8 *) second == first + 8);
+  *second = 1234;
+  u8 *array = ALLOC_ARRAY(a, u8, VIRTUAL_COMMIT_SIZE);
+  assert(array == first + 16);
+  array[VIRTUAL_COMMIT_SIZE - 1] = 1;
+  assert(a->committed == 2 * VIRTUAL_COMMIT_SIZE);
+
+  // NOTE : Past 4 GiB, only the touched pages cost anything.
+  u8 *big = ALLOC_ARRAY(a, u8, 5 * GIB);
+  assert(big);
+  big[0] = 1;
+  big[5 * GIB - 1] = 2;
+  assert(a->bytes_allocated > 5 * GIB);
+  u64 *past = ALLOC_STRUCT(a, u64);
+  assert((u8 *) past >= a->memory + 5 * GIB);
+  *past = 5678;
+  assert(*second == 1234);
+
+  // NOTE : Plain clear keeps the pages committed, decommitting drops them and their contents.
+  u64 committed = a->committed;
+  clear(a);
+  assert(a->bytes_allocated == 0 && a->committed == committed);
+  assert(*second == 1234);
+  u64 *again = ALLOC_STRUCT(a, u64);
+  assert(again == (u64 *) a->memory);
+  clear(a, true);
+  assert(a->committed == 0);
+  second = (u64 *) alloc_size(a, 16, 8);
+  assert(second == (u64 *) a->memory);
+  assert(second[1] == 0);
+  assert(a->committed == VIRTUAL_COMMIT_SIZE);
+
+  // NOTE : Decommitting keeps what is still allocated.
+  ALLOC_ARRAY(a, u8, 3 * VIRTUAL_COMMIT_SIZE);
+  second[1] = 42;
+  a->bytes_allocated = 16;
+  decommit(a);
+  assert(a->committed == VIRTUAL_COMMIT_SIZE);
+  assert(second[1] == 42);
+
+  VirtualPushMarker marker = save_marker(a);
+  assert(ALLOC_ARRAY(a, u8, 2 * VIRTUAL_COMMIT_SIZE));
+  restore_marker(a, marker);
+  assert(a->bytes_allocated == 16);
+  assert(a->committed == 3 * VIRTUAL_COMMIT_SIZE);
+
+  PushAllocator inner = new_push_allocator(a, 1024);
+  assert(is_initialized(&inner));
+  assert(inner.memory == a->memory + 16);
+  assert(ALLOC_ARRAY(&inner, u32, 256));
+
+  free_virtual_push_allocator(a);
+  assert(!is_initialized(a));
+
+  // NOTE : Out of reserved space
+  VirtualPushAllocator small = new_virtual_push_allocator(VIRTUAL_COMMIT_SIZE);
+  assert(alloc_size(&small, VIRTUAL_COMMIT_SIZE));
+  assert(remaining_size(&small) == 0);
+  free_virtual_push_allocator(&small);
+
+  printf("VirtualPushAllocator test successful.\n\n");
+}
+
+int main() {
+  virtual_push_allocator_test();
+
+  return EXIT_SUCCESS;
+}
@@ -100,7 +100,34 @@ bool atomic_compare_exchange(atomic_uint *a, u32 expected_val, u32 new_val) {
 }
 
 
-// TODO atomic pointers/64 bit numbers?
+//
+// atomic_u64 ---
+//
+
+// NOTE : SDL has no 64 bit atomics, these are the gcc/clang builtins.
+struct atomic_u64 {
+  u64 u;
+
+  inline u64 operator=(u64 val) {
+    __atomic_store_n(&u, val, __ATOMIC_SEQ_CST);
+    return val;
+  }
+
+  inline operator u64() {
+    return __atomic_load_n(&u, __ATOMIC_SEQ_CST);
+  }
+
+  inline u64 operator+=(u64 b) {
+    return __atomic_fetch_add(&u, b, __ATOMIC_SEQ_CST);
+  }
+};
+
+static inline
+bool atomic_compare_exchange(atomic_u64 *a, u64 expected_val, u64 new_val) {
+  return __atomic_compare_exchange_n(&a->u, &expected_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// TODO atomic pointers?
 
 static inline
 bool atomic_compare_exchange(void **a, void *expected_val, void *new_val) {